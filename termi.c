@@ -10,9 +10,18 @@ exec gcc $0 -o termi \
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
 #include <vte/vte.h>
 #include <vte/pty.h>
 #include <gdk/gdkkeysyms.h>
+#if GLIB_CHECK_VERSION(2,36,0)
+#include <glib-unix.h>
+#endif
 
 #define VERSION  "1.0"
 /// Name of the application (used for config file name, etc.).
@@ -21,29 +30,362 @@ exec gcc $0 -o termi \
 #define TERMI_QUARK_STR  PROGRAM_NAME
 #define TERMI_CFGGRP_GENERAL  "General"
 #define TERMI_CFGGRP_KEYS     "Keys"
+/// Regex of URIs, always matched.
+#define TERMI_URI_PATTERN  "[a-zA-Z0-9+-]+://\\S*[a-zA-Z0-9_/%&=]"
+/// Prefix of matcher groups (e.g. <tt>[Matcher jira]</tt>).
+#define TERMI_CFGGRP_MATCHER_PREFIX  "Matcher "
+/// Prefix of trigger groups (e.g. <tt>[Trigger failed]</tt>).
+#define TERMI_CFGGRP_TRIGGER_PREFIX  "Trigger "
+/// Estimated memory used by a terminal cell in scrollback, in bytes.
+#define TERMI_SCROLLBACK_CELL_SIZE  8
+/// Number of lines between two entries of the scrollback archive index.
+#define TERMI_ARCHIVE_INDEX_STEP  1024
+/// Maximum size of output kept for a hibernated tab.
+#define TERMI_HIBERNATE_DRAIN_SIZE  (1024*1024)
+/// Maximum size of child output read at once, and fed to the terminal.
+#define TERMI_TAP_BATCH_SIZE  (256*1024)
+/// Maximum size of throttled output, older output is skipped.
+#define TERMI_THROTTLE_MAX_SIZE  (4*TERMI_TAP_BATCH_SIZE)
+
+
+typedef struct TermiWindow TermiWindow;
+
+/// Number of buckets of latency histograms, plus one for overflow.
+#define TERMI_LATENCY_BUCKETS  200
+/// Width of latency histogram buckets, in microseconds.
+#define TERMI_LATENCY_BUCKET_US  250
+/// Size of the chunks written to the pty when pasting.
+#define TERMI_PASTE_CHUNK_SIZE  4096
+/// Delay before retrying to paste while a broadcast member is busy, in milliseconds.
+#define TERMI_PASTE_RETRY_MS  10
+/// Delay before compiling the search bar pattern, in milliseconds.
+#define TERMI_SEARCH_DEBOUNCE_MS  150
+/// Delay before checking the foreground process after input, in milliseconds.
+#define TERMI_FG_CHECK_DELAY_MS  100
+/// Delay before reloading the modified configuration file, in milliseconds.
+#define TERMI_CONF_RELOAD_DELAY_MS  200
+/// Output lines longer than this are truncated before being matched by triggers.
+#define TERMI_TRIGGER_LINE_MAX  4096
+/// Rows of a tab snapshotted at once when searching all tabs.
+#define TERMI_FIND_ALL_ROWS  2000
+/// Threads used to search all tabs.
+#define TERMI_FIND_ALL_THREADS  4
+/// Size of the excerpts of matching lines, in characters.
+#define TERMI_FIND_ALL_EXCERPT  200
+/// Size of session log ring buffers (power of 2).
+#define TERMI_LOG_RING_SIZE  (4*1024*1024)
+/// Maximum size of a daemon client request, larger requests are dropped.
+#define TERMI_DAEMON_REQUEST_MAX  (1024*1024)
+
+/** @brief Session log of a tab.
+ *
+ * Output is pushed into a ring buffer by the main thread and written to disk
+ * by a dedicated thread. Ring positions are free-running, each one is updated
+ * by a single thread.
+ *
+ * Once stopped, the log is owned (and freed) by the writer thread.
+ */
+typedef struct {
+  gchar *ring;             ///< Ring buffer, TERMI_LOG_RING_SIZE bytes.
+  volatile gint head;      ///< Write position, updated by the main thread.
+  volatile gint tail;      ///< Read position, updated by the writer thread.
+  volatile gint dropped;   ///< Bytes dropped because the ring was full.
+  volatile gint sleeping;  ///< Writer thread is (about to be) waiting for data.
+  volatile gint stop;      ///< Writer thread exits once the ring is empty.
+#if GLIB_CHECK_VERSION(2,32,0)
+  GMutex mutex_data;       ///< Storage of \e mutex.
+  GCond cond_data;         ///< Storage of \e cond.
+#endif
+  GMutex *mutex;           ///< Mutex for \e cond.
+  GCond *cond;             ///< Signaled to wake up the writer thread.
+  GThread *thread;         ///< Writer thread.
+  gchar *path;             ///< Path of log files, without part number and extension.
+  gboolean timestamps;     ///< Prefix lines with a timestamp.
+  gboolean compress;       ///< Write gzip files.
+  guint64 rotate_size;     ///< Size of output per file (0: no rotation).
+  gboolean line_start;     ///< Next output starts a line (for timestamps).
+  gboolean cast;           ///< Record in asciicast format (ring holds TermiCastRecord).
+  gint64 start_time;       ///< Start of the recording (monotonic time).
+  glong columns, rows;     ///< Terminal size at the start of the recording.
+} TermiLog;
+
+/** @brief Record of an asciicast recording ring.
+ *
+ * Event data follows the record.
+ */
+typedef struct {
+  gint64 time;             ///< Event time (monotonic time).
+  guint32 len;             ///< Size of event data.
+  gchar type;              ///< Event type: 'o' (output) or 'r' (resize).
+} TermiCastRecord;
 
+/// Keypress-to-screen latency trace of a tab.
+typedef struct {
+  gint64 key_time;     ///< Key press of the traced keystroke, or 0.
+  gint64 write_time;   ///< Input written to the pty, or 0.
+  gint64 read_time;    ///< First output read after the write, or 0.
+  guint count;         ///< Number of complete traces.
+  gint64 max;          ///< Maximum latency, in microseconds.
+  gint64 sum_write;    ///< Cumulated key-to-write durations.
+  gint64 sum_read;     ///< Cumulated write-to-read durations.
+  gint64 sum_draw;     ///< Cumulated read-to-draw durations.
+  guint histogram[TERMI_LATENCY_BUCKETS + 1];  ///< Latency distribution.
+} TermiLatency;
 
 /// Data for a single termi's tab.
 typedef struct {
-  VteTerminal *vte;   ///< Terminal widget.
+  TermiWindow *win;   ///< Window containing the tab.
+  GtkWidget *page;    ///< Notebook page, contains the terminal.
+  VteTerminal *vte;   ///< Terminal widget, NULL until spawned.
+  GtkLabel *placeholder;  ///< Label displayed until spawned.
   GtkLabel *lbl;      ///< Tabl label
   GPid pid;           ///< Child PID.
-  int uri_regex_tag;
+  gchar *cmd;         ///< Command run in the tab, NULL for a shell.
+  gchar *wdir;        ///< Working directory of the command.
+  GList *lazy_link;   ///< Link in the lazy tab queue, NULL if not queued.
+  GList *lru_link;    ///< Link in the tab LRU list.
+  guint scrollback_lines;  ///< Scrollback limit set on the terminal.
+  int match_tag;      ///< Tag of match_regex in the terminal, or -1.
+  GRegex *match_regex;  ///< Matchers regex added to the terminal (a reference), or NULL.
+  int archive_fd;          ///< Scrollback archive (unlinked file), or -1.
+  guint64 archive_size;    ///< Size of the archive.
+  guint64 archive_lines;   ///< Number of complete lines in the archive.
+  GArray *archive_index;   ///< Offsets of every TERMI_ARCHIVE_INDEX_STEP lines.
+  GArray *archive_marks;   ///< Archive offsets of terminal rows (TermiArchiveMark).
+  glong archive_row;       ///< First terminal row not archived yet.
+  guint conf_serial;       ///< Value of termi.conf_serial when configuration was last applied.
+  guint font_serial;       ///< Value of termi.font_serial when the font was last set.
+#if VTE_CHECK_VERSION(0,26,0)
+  VtePty *pty;        ///< Pty of the child, kept while hibernated.
+  guint child_watch_id;  ///< Child watch source, or 0.
+  guint hibernate_id;    ///< Hibernation timer, or 0.
+  gboolean hibernated;   ///< Terminal has been freed, see termi_tab_hibernate().
+  int spill_fd;          ///< Compressed scrollback snapshot (unlinked file), or -1.
+  gsize spill_size;      ///< Size of the compressed snapshot.
+  glong columns, rows;   ///< Terminal size when hibernated.
+  glong cursor_col, cursor_row;  ///< Cursor position (on screen) when hibernated.
+  GByteArray *drain;     ///< Child output received while hibernated.
+  guint tap_id;          ///< Watch source reading child output, or 0.
+  GByteArray *throttled; ///< Output not fed yet, while the tab is hidden.
+  guint64 throttle_skipped;  ///< Throttled output skipped since the last feed.
+  guint throttle_id;     ///< Timer feeding throttled output, or 0.
+  GByteArray *input;     ///< Input not written to the pty yet, or NULL.
+  guint input_id;        ///< Watch source writing pending input, or 0.
+  guint64 output_bytes;  ///< Bytes of output read from the child.
+  guint64 output_reads;  ///< Number of reads from the pty.
+  guint64 output_feeds;  ///< Number of chunks fed to the terminal.
+  guint64 output_lines;  ///< Number of newlines in child output.
+  TermiLatency *latency; ///< Latency trace, NULL until traced.
+  gint64 launch_time;    ///< Launch time to report on first output, or 0.
+  struct TermiPaste *paste;  ///< Paste in progress, or NULL.
+  gboolean bracketed_paste;  ///< Child enabled bracketed paste mode.
+  gboolean broadcast;    ///< Tab is a member of the broadcast group.
+  TermiLog *log;         ///< Session log, or NULL.
+  TermiLog *cast;        ///< Session recording (asciicast), or NULL.
+  guint mode_state;      ///< Progress in a DEC private mode sequence, see termi_stage_modes().
+  guint mode_param;      ///< Current parameter of the mode sequence.
+  gboolean mode_paste;   ///< Bracketed paste is among the parameters of the mode sequence.
+  GArray *search_hits;   ///< Search matches on screen (TermiSearchHit), NULL if outdated.
+  GString *trigger_line; ///< Incomplete output line, not matched by triggers yet.
+  GHashTable *trigger_times;  ///< Time of the last alert of triggers (gint64), by trigger name.
+  pid_t fg_pgid;         ///< Foreground process group of the pty, as last seen.
+  gchar *fg_command;     ///< Foreground command, NULL when the child itself is in foreground.
+  gint64 fg_start;       ///< Time the foreground command was first seen.
+  guint fg_check_id;     ///< Deferred foreground check, or 0.
+  gchar *session_file;   ///< Scrollback file of the tab in the saved session, or NULL.
+  guint64 session_bytes; ///< Output fed to the terminal when the scrollback was saved.
+  gchar *restore_file;   ///< Scrollback to feed once spawned (restored session), or NULL.
+#endif
 
 } TermiTab;
 
-/// Key binding.
+/// Action on text matched in the terminal.
+typedef struct {
+  gchar *name;     ///< Matcher name, from its configuration group.
+  gchar *command;  ///< Command run on the match (\c %s is replaced by the match), NULL to open it as an URI.
+} TermiMatcher;
+
+#if VTE_CHECK_VERSION(0,26,0)
+/// Alert on child output.
+typedef struct {
+  gchar *name;        ///< Trigger name, from its configuration group.
+  gboolean notify;    ///< Show a desktop notification, not only the urgency hint.
+  gint64 interval;    ///< Minimum delay between two alerts, in microseconds.
+} TermiTrigger;
+#endif
+
+/// Archive position of a terminal row.
+typedef struct {
+  glong row;
+  guint64 offset;
+} TermiArchiveMark;
+
+/** @brief Archive write, queued to termi_archive_write_cb().
+ *
+ * Offsets are assigned by the main thread, so that a failed write does not
+ * shift the following ones. A chunk without text closes the archive.
+ */
+typedef struct {
+  int fd;
+  guint64 offset;
+  gchar *text;
+  gsize len;
+} TermiArchiveChunk;
+
+#if VTE_CHECK_VERSION(0,26,0)
+/// Search match highlighted on screen, one per row.
+typedef struct {
+  glong row;
+  glong col;
+  glong ncols;
+} TermiSearchHit;
+#endif
+
+#if VTE_CHECK_VERSION(0,26,0)
+/** @brief Paste in progress.
+ *
+ * Data is written to the pty by chunks, once previous input has been written.
+ */
+typedef struct TermiPaste {
+  GInputStream *stream;  ///< Pasted data.
+  goffset size;          ///< Size of pasted data, 0 if unknown.
+  goffset done;          ///< Size of data already written.
+  GPtrArray *bracketed;  ///< Destination tabs in bracketed paste mode, which received the start sequence.
+  guint end_match;       ///< Length of the paste end sequence held at the end of the last chunk.
+  guint id;              ///< Watch source writing the next chunk, or retry timer.
+  GtkProgressBar *bar;   ///< Progress bar, shown below the terminal.
+} TermiPaste;
+
+/// Shell spawned in advance, waiting for a tab.
+typedef struct {
+  VtePty *pty;        ///< Pty of the shell.
+  GPid pid;           ///< Shell PID.
+  gchar *wdir;        ///< Working directory of the shell, NULL for termi's one.
+  guint watch_id;     ///< Child watch source, while in the pool.
+} TermiPooledShell;
+#endif
+
+#if VTE_CHECK_VERSION(0,26,0)
+/** @brief Child output processing stage.
+ *
+ * Stages are run in order on each chunk of output read from the pty, before
+ * it is fed to the terminal (or kept while the tab is hibernated).
+ */
+typedef void (*TermiOutputStage)(TermiTab *tab, const gchar *data, gsize len);
+#endif
+
+#if VTE_CHECK_VERSION(0,26,0)
+/// Benchmark state, see termi_bench_start().
+typedef struct {
+  guint ntabs;            ///< Tabs run for each generator.
+  guint size_mb;          ///< Output size of each generator tab, in MiB.
+  guint generator;        ///< Index of the current generator.
+  guint running;          ///< Running tabs of the current generator.
+  gint64 start_time;      ///< Start time of the current generator.
+  guint64 bytes;          ///< Output read for the current generator.
+  guint64 lines;          ///< Lines read for the current generator.
+  guint64 frames;         ///< Terminal redraws for the current generator.
+  guint64 rss_start;      ///< RSS at the start of the current generator, in KiB.
+  GArray *stalls;         ///< Main loop stalls for the current generator (gint64, us).
+  gint64 tick_time;       ///< Expected time of the next stall measure.
+  guint tick_id;          ///< Timer measuring main loop stalls.
+  GString *report;        ///< JSON report.
+  gboolean infinite_scrollback;  ///< Configured infinite scrollback, restored after each generator.
+} TermiBench;
+
+/** @brief Search of all tabs, see termi_find_all_start().
+ *
+ * Tabs are snapshotted by the main thread, a chunk of rows at a time, then
+ * searched by a thread pool. Each chunk job holds a reference.
+ */
+typedef struct {
+  volatile gint ref;      ///< Reference count.
+  volatile gint canceled; ///< Results dialog has been closed.
+  GRegex *regex;          ///< Searched regex.
+  GThreadPool *pool;      ///< Threads searching chunks.
+  GQueue tabs;            ///< Tabs to snapshot.
+  TermiTab *tab;          ///< Tab being snapshotted, or NULL.
+  glong row;              ///< Next row to snapshot.
+  guint snapshot_id;      ///< Idle source taking snapshots, or 0.
+  guint pending;          ///< Chunks whose results have not been received.
+  guint nresults;         ///< Number of results.
+  GtkDialog *dlg;         ///< Results dialog.
+  GtkListStore *store;    ///< Results.
+} TermiFindAll;
+
+/// Chunk of a tab searched by the thread pool.
+typedef struct {
+  TermiFindAll *find;
+  TermiTab *tab;          ///< Tab of the chunk (compared, not accessed by threads).
+  glong row;              ///< First row of the chunk.
+  gchar *text;            ///< Chunk text.
+  GArray *hits;           ///< Row of matches (glong), set by the thread.
+  GPtrArray *excerpts;    ///< Excerpt of matching lines, set by the thread.
+} TermiFindAllChunk;
+
+/// Replay state, see termi_replay_start().
+typedef struct {
+  gchar *path;            ///< Path of the recording.
+  GDataInputStream *in;   ///< Recording, after the last read event.
+  gboolean fast;          ///< Feed events as fast as possible.
+  TermiTab *tab;          ///< Replay tab, NULL once closed.
+  gint64 start_time;      ///< Start time of the replay.
+  gdouble time;           ///< Time of the pending event, in seconds.
+  gchar type;             ///< Type of the pending event, 0 if none.
+  GString *data;          ///< Data of the pending event.
+  guint64 events;         ///< Events replayed.
+  guint64 bytes;          ///< Output fed to the terminal.
+  guint64 frames;         ///< Terminal redraws.
+} TermiReplay;
+
+/// Tab of a session snapshot.
+typedef struct {
+  TermiTab *tab;      ///< Tab, may be closed before being snapshotted.
+  guint window;       ///< Index of the tab window in the session.
+} TermiSessionTab;
+
+/// Scrollback of a tab, written along with the session.
 typedef struct {
-  GdkModifierType mod;
-  guint key;
-} TermiKeyBinding;
+  gchar *file;        ///< File name, in the session directory.
+  GString *text;      ///< Scrollback text, not compressed yet.
+} TermiSessionDump;
+
+typedef struct {
+  gchar *dir;         ///< Session directory.
+  GKeyFile *kf;       ///< Session file content, one group per tab.
+  gchar *data;        ///< Serialized session file, set once all tabs are snapshotted.
+  GArray *tabs;       ///< Tabs to snapshot (TermiSessionTab).
+  guint next;         ///< Index of the next tab to snapshot.
+  GPtrArray *dumps;   ///< Scrollback files to write (TermiSessionDump).
+  guint idle_id;      ///< Idle source snapshotting tabs, or 0.
+} TermiSession;
+#endif
+
+typedef struct TermiKeyNode TermiKeyNode;
+
+/** @brief Node of the key binding tree.
+ *
+ * Bindings are sequences of keys. Each key of a sequence but the last one is
+ * a prefix node, whose \e next table holds the bindings following it.
+ */
+struct TermiKeyNode {
+  gint64 id;          ///< Key (modifiers and keyval), also used as hash key.
+  void (*cb)(TermiWindow *win);  ///< Binding callback, NULL for prefixes.
+  GHashTable *next;   ///< Keys following a prefix, NULL for bindings.
+};
 
 
 #if VTE_CHECK_VERSION(0,26,0)
 #define TERMI_KEY_BINDINGS_FIND_APPLY(expr) \
   expr(find,      "Find",        GDK_CONTROL_MASK|GDK_SHIFT_MASK, 'f') \
   expr(find_next, "FindNext",    GDK_CONTROL_MASK|GDK_SHIFT_MASK, 'n') \
-  expr(find_prev, "FindPrev",    GDK_CONTROL_MASK|GDK_SHIFT_MASK, 'p')
+  expr(find_prev, "FindPrev",    GDK_CONTROL_MASK|GDK_SHIFT_MASK, 'p') \
+  expr(find_all,  "FindAll",     GDK_CONTROL_MASK|GDK_SHIFT_MASK, 'a')
+#define TERMI_KEY_BINDINGS_PTY_APPLY(expr) \
+  expr(broadcast, "Broadcast",   GDK_CONTROL_MASK|GDK_SHIFT_MASK, 'b')
+#else
+#define TERMI_KEY_BINDINGS_FIND_APPLY(expr)
+#define TERMI_KEY_BINDINGS_PTY_APPLY(expr)
 #endif
 
 /// Apply code on all configurable key bindings.
@@ -54,24 +396,86 @@ typedef struct {
   expr(prev_tab,  "PreviousTab", GDK_CONTROL_MASK, GDK_Tab) \
   expr(copy,      "Copy",        GDK_CONTROL_MASK|GDK_SHIFT_MASK, 'c') \
   expr(paste,     "Paste",       GDK_CONTROL_MASK|GDK_SHIFT_MASK, 'v') \
-  TERMI_KEY_BINDINGS_FIND_APPLY(expr)
+  expr(history,   "History",     GDK_CONTROL_MASK|GDK_SHIFT_MASK, 'h') \
+  expr(tab_1,     "Tab1",        GDK_CONTROL_MASK|GDK_MOD1_MASK, '1') \
+  expr(tab_2,     "Tab2",        GDK_CONTROL_MASK|GDK_MOD1_MASK, '2') \
+  expr(tab_3,     "Tab3",        GDK_CONTROL_MASK|GDK_MOD1_MASK, '3') \
+  expr(tab_4,     "Tab4",        GDK_CONTROL_MASK|GDK_MOD1_MASK, '4') \
+  expr(tab_5,     "Tab5",        GDK_CONTROL_MASK|GDK_MOD1_MASK, '5') \
+  expr(tab_6,     "Tab6",        GDK_CONTROL_MASK|GDK_MOD1_MASK, '6') \
+  expr(tab_7,     "Tab7",        GDK_CONTROL_MASK|GDK_MOD1_MASK, '7') \
+  expr(tab_8,     "Tab8",        GDK_CONTROL_MASK|GDK_MOD1_MASK, '8') \
+  expr(tab_9,     "Tab9",        GDK_CONTROL_MASK|GDK_MOD1_MASK, '9') \
+  TERMI_KEY_BINDINGS_FIND_APPLY(expr) \
+  TERMI_KEY_BINDINGS_PTY_APPLY(expr)
+
+
+/// Data for a single termi's window.
+struct TermiWindow {
+  GtkWindow *winmain;        ///< Main window.
+  GtkNotebook *notebook;     ///< Notebook (with tabs).
+  TermiTab *prev_tab;        ///< Previously selected tab.
+  TermiTab *cur_tab;         ///< Currently selected tab.
+  GHashTable *key_prefix;    ///< Bindings following the keys typed so far, NULL if none.
+#if VTE_CHECK_VERSION(0,26,0)
+  GtkWidget *search_bar;     ///< Incremental search bar, hidden when not searching.
+  GtkEntry *search_entry;    ///< Search pattern.
+  GtkToggleButton *search_wrap;  ///< Wrap around check button.
+  GtkLabel *search_status;   ///< Pattern errors, search failures.
+  guint search_compile_id;   ///< Pending pattern compilation, or 0.
+#endif
+};
 
 
-/// Global data of the termi instance.
+/// Global data of the termi instance, shared by all windows.
 typedef struct {
   GQuark quark;              ///< Application quark.
   GKeyFile *cfg;             ///< Current configuration.
   gchar *cfg_file;           ///< Configuration file.
-  GtkWindow *winmain;        ///< Main window.
-  GtkNotebook *notebook;     ///< Notebook (with tabs).
-  TermiTab *prev_tab;        ///< Previously selected tab.
-  TermiTab *cur_tab;         ///< Currently selected tab.
+  gchar *cfg_data;           ///< Content of the configuration file, as last loaded or saved.
+  GKeyFile *cfg_dirty;       ///< Entries modified since the last save.
+  gboolean cfg_saving;       ///< A save is in progress (in a worker thread).
+  GFileMonitor *cfg_monitor; ///< Watch changes of the configuration file.
+  guint cfg_reload_id;       ///< Pending configuration reload, or 0.
+  guint conf_serial;         ///< Incremented when tab configuration changes.
+  GList *windows;            ///< Opened windows, most recently focused first.
   gboolean quitting;         ///< True when quitting.
+  int exit_status;           ///< Exit status, when the main loop ends.
+  gboolean daemon;           ///< Keep running without windows and serve clients.
+  gchar *socket_path;        ///< Daemon socket path.
+  int socket_fd;             ///< Daemon listening socket, or -1.
   guint label_nb;            ///< Tab label number (starting at 1).
-  GRegex *uri_regex;         ///< Regex object for underlined URIs.
-  gchar *menu_uri;           ///< Allocated URI for the current popup menu.
+  GQueue lazy_tabs;          ///< Tabs waiting to be spawned.
+  GQueue tab_lru;            ///< Tabs of all windows, most recently selected first.
+  guint lazy_tabs_id;        ///< Idle source spawning lazy tabs, or 0.
+  GRegex *match_regex;       ///< All matchers combined, one named group per matcher.
+  GArray *matchers;          ///< Matchers (TermiMatcher), the first one matches URIs.
+  gchar *menu_match;         ///< Allocated match for the current popup menu.
+  guint menu_matcher;        ///< Matcher of menu_match.
+  GThreadPool *archive_pool; ///< Writer of scrollback archives (TermiArchiveChunk), single thread.
+  guint archive_pending;     ///< Archive chunks not processed yet, protected by archive_mutex.
+#if GLIB_CHECK_VERSION(2,32,0)
+  GMutex archive_mutex_data; ///< Storage of archive_mutex.
+  GCond archive_cond_data;   ///< Storage of archive_cond.
+#endif
+  GMutex *archive_mutex;     ///< Mutex for archive_cond.
+  GCond *archive_cond;       ///< Signaled when all archive chunks have been processed.
 #if VTE_CHECK_VERSION(0,26,0)
   GRegex *search_regex;        ///< Current search regex.
+  GQueue shell_pool;         ///< Pre-spawned shells (TermiPooledShell).
+  guint shell_pool_refill_id;  ///< Idle source refilling the pool, or 0.
+  gchar *shell_pool_wdir;    ///< Working directory of new pooled shells, the one of the last shell tab.
+  TermiBench *bench;         ///< Benchmark state, NULL unless running --bench.
+  TermiReplay *replay;       ///< Replay state, NULL unless running --replay.
+  GPtrArray *broadcast;      ///< Tabs receiving input sent to any of them.
+  TermiTab *typing_tab;      ///< Tab handling a key press, NULL once the key is released.
+  GPtrArray *log_threads;    ///< Writer threads of closed logs, joined at exit.
+  gboolean session_enabled;  ///< Session is saved periodically and at exit.
+  TermiSession *session;     ///< Session snapshot in progress, or NULL.
+  gboolean session_saving;   ///< A session is being written (in a worker thread).
+  gchar *session_data;       ///< Content of the session file, as last written.
+  guint session_timer_id;    ///< Timer of the next session snapshot, or 0.
+  guint session_file_nb;     ///< Number of the next session scrollback file.
 #endif
 
   // configuration
@@ -79,24 +483,40 @@ typedef struct {
   gboolean show_single_tab;  ///< Show the tabbar even when there is only one tab.
   gboolean force_tab_title;  ///< Terminal is not allowed to change tab title.
   gboolean adjust_tab_title_width;  ///< Tab titles are ellispized and use full tab bar width.
+  gboolean lazy_tabs_enabled;  ///< Spawn background tabs given on command line lazily.
+  gboolean infinite_scrollback;  ///< Archive lines scrolled out of the screen to disk.
   gboolean audible_bell;
   gboolean visible_bell;
   gboolean blink_mode;  // note: don't support the 3-state mode, on purpose
   guint buffer_lines;
+  guint scrollback_budget_mb;  ///< Scrollback memory of all tabs, in MiB (0: unlimited).
   gchar *word_chars;
 #if VTE_CHECK_VERSION(0,26,0)
   gboolean search_wrap;
+  GRegex *trigger_regex;     ///< All triggers combined, NULL if there is none.
+  GArray *triggers;          ///< Triggers (TermiTrigger).
+  guint shell_pool_size;  ///< Number of shells to spawn in advance.
+  guint hibernate_delay;  ///< Delay before hibernating hidden tabs, in seconds (0: never).
+  guint background_feed_rate;  ///< Feeds per second of hidden tabs output (0: no throttling).
+  gboolean latency_trace;  ///< Trace keypress-to-screen latency.
+  gchar *log_dir;         ///< Directory of session logs, NULL if disabled.
+  gboolean log_new_tabs;  ///< Log sessions of new tabs.
+  gboolean log_timestamps;  ///< Prefix lines of logs with a timestamp.
+  gboolean log_compress;  ///< Compress logs.
+  guint log_rotate_mb;    ///< Size of log files before rotation, in MiB (0: never).
+  guint command_notify_delay;  ///< Notify completion of commands running longer, in seconds (0: never).
+  guint session_save_interval;  ///< Interval between session snapshots, in seconds (0: only at exit).
+  gboolean session_scrollback;  ///< Save scrollback of tabs along with the session.
 #endif
   PangoFontDescription *vte_font;  ///< Font for terminals.
+  guint font_serial;         ///< Incremented when the font changes.
+  guint font_update_id;      ///< Pending font update of visible tabs, or 0.
   GdkColor vte_fg_color;
   GdkColor vte_bg_color;
   GdkColor vte_cursor_color;
   gboolean vte_cursor_color_default;
 
-  // key bindings
-#define TERMI_DEFINE_KB(n,k,dm,dk)   TermiKeyBinding kb_##n;
-  TERMI_KEY_BINDINGS_APPLY(TERMI_DEFINE_KB)
-#undef TERMI_DEFINE_KB
+  GHashTable *key_bindings;  ///< Key binding tree (TermiKeyNode), by key.
 
 } TermiInstance;
 
@@ -105,16 +525,49 @@ static TermiInstance termi = {
   .quark     = 0,
   .cfg       = NULL,
   .cfg_file  = NULL,
-  .winmain   = NULL,
-  .notebook  = NULL,
-  .prev_tab  = NULL,
-  .cur_tab   = NULL,
+  .cfg_data  = NULL,
+  .cfg_dirty = NULL,
+  .cfg_saving = FALSE,
+  .cfg_monitor = NULL,
+  .cfg_reload_id = 0,
+  .conf_serial = 0,
+  .windows   = NULL,
   .quitting  = FALSE,
+  .exit_status = 0,
+  .daemon    = FALSE,
+  .socket_path = NULL,
+  .socket_fd = -1,
   .label_nb  = 1,
-  .uri_regex = NULL,
-  .menu_uri  = NULL,
+  .lazy_tabs = G_QUEUE_INIT,
+  .tab_lru   = G_QUEUE_INIT,
+  .lazy_tabs_id = 0,
+  .match_regex = NULL,
+  .matchers  = NULL,
+  .menu_match = NULL,
+  .menu_matcher = 0,
+  .archive_pool = NULL,
+  .archive_pending = 0,
+  .archive_mutex = NULL,
+  .archive_cond = NULL,
+  .key_bindings = NULL,
 #if VTE_CHECK_VERSION(0,26,0)
   .search_regex = NULL,
+  .trigger_regex = NULL,
+  .triggers = NULL,
+  .shell_pool = G_QUEUE_INIT,
+  .shell_pool_refill_id = 0,
+  .shell_pool_wdir = NULL,
+  .bench = NULL,
+  .replay = NULL,
+  .broadcast = NULL,
+  .typing_tab = NULL,
+  .log_threads = NULL,
+  .session_enabled = FALSE,
+  .session = NULL,
+  .session_saving = FALSE,
+  .session_data = NULL,
+  .session_timer_id = 0,
+  .session_file_nb = 0,
 #endif
 
    // binding and conf values initialized in termi_conf_load()
@@ -122,22 +575,68 @@ static TermiInstance termi = {
 
 
 
-/** @brief Initialize main window.
- * @note The main window is not shown.
+/// Load the application icons, shared by all windows.
+static void termi_icons_init(void);
+/** @brief Create a new window.
+ * @note The window is not shown.
+ */
+static TermiWindow *termi_window_new(void);
+/// Close a window and all its tabs.
+static void termi_window_close(TermiWindow *win);
+/// Get the current tab of a window.
+static TermiTab *termi_window_get_cur_tab(TermiWindow *win);
+/** @brief Let the window handle a key press, as typed input.
+ *
+ * Input committed by the terminal until the key is released is typed by the
+ * user, thus broadcast. Other commits (replies to queries, mouse reports) are
+ * not.
+ * @return FALSE, for the key press handler.
  */
-static void termi_winmain_init(void);
-/// Close and exit.
+static gboolean termi_window_type_key(TermiWindow *win);
+/// Close all windows and exit.
 static void termi_quit(void);
 
-/// Load or reload configuration file.
+/** @brief Load or reload configuration file.
+ *
+ * On reload, only changed settings are applied. Tab settings are applied to
+ * visible tabs, hidden tabs get them when selected.
+ */
 static void termi_conf_load(void);
-/// Save configuration file.
+/// Watch the configuration file, reload it when modified.
+static void termi_conf_monitor_start(void);
+/** @brief Save configuration file.
+ *
+ * Only modified entries are written, merged into the current content of the
+ * file (last writer wins for each entry). Nothing is written if no entry has
+ * been modified. Writing is done in a worker thread when possible.
+ */
 static void termi_conf_save(void);
+/// Check whether entries have been modified since the last save.
+static gboolean termi_conf_is_dirty(void);
+/// Write modified entries, unless a save is already in progress.
+static void termi_conf_save_start(void);
+/// Wait for pending saves before exiting, still processing events.
+static void termi_conf_save_wait(void);
+/// Set entries of \e changes in \e cfg.
+static void termi_conf_merge(GKeyFile *cfg, GKeyFile *changes);
+/** @brief Merge entries into a configuration file.
+ *
+ * May be run from a worker thread.
+ * @return the written content, or NULL on error.
+ */
+static gchar *termi_conf_save_merge(const gchar *path, GKeyFile *changes, GError **error);
 /** @brief Helper method to loading key bindings.
  *
- * \e kb must be filled with the default value.
+ * Keys of a sequence are separated by spaces (e.g. <tt>\<Control\>a c</tt>).
+ * \e mod and \e key are the default binding, used when not set at all.
  */
-static void termi_conf_load_keys(const char *name, TermiKeyBinding *kb);
+static void termi_conf_load_keys(const char *name, GdkModifierType mod, guint key, void (*cb)(TermiWindow *));
+/// Get a key identifier, as used in the key binding tree.
+static gint64 termi_key_id(GdkModifierType mod, guint key);
+/// Create a table of key binding nodes.
+static GHashTable *termi_key_table_new(void);
+/// Free a key binding node.
+static void termi_key_node_free(TermiKeyNode *node);
 /// Helper method to load boolean values.
 static gboolean termi_conf_load_bool(const char *grp, const char *name, gboolean def);
 /** @brief Helper method to load colors.
@@ -147,9 +646,48 @@ static gboolean termi_conf_load_color(const char *grp, const char *name, GdkColo
 /** @brief Helper to save colors.
  *
  * If \e color is NULL, set value to an empty string.
- * @todo Don't replace values if color did not changed, to preserve color names.
+ * Values are not replaced if the color did not change, to preserve color names.
  */
 static void termi_conf_save_color(const char *grp, const char *name, const GdkColor *color);
+/** @name Helpers to save values.
+ *
+ * The entry is updated and marked as modified only if its value changed.
+ */
+//@{
+static void termi_conf_save_bool(const char *grp, const char *name, gboolean val);
+static void termi_conf_save_int(const char *grp, const char *name, gint val);
+static void termi_conf_save_string(const char *grp, const char *name, const gchar *val);
+//@}
+/** @brief Helper to load the regex of a matcher or trigger group.
+ *
+ * Errors are reported using \e kind to name the group.
+ * @return an allocated pattern, or NULL if missing or invalid.
+ */
+static gchar *termi_conf_load_regex(const char *grp, const char *kind, const char *name);
+/** @brief Load matchers and combine them into termi.match_regex.
+ *
+ * Each matcher pattern is an alternative of the combined regex, in a named
+ * group. Terminals check a single regex, whatever the number of matchers.
+ */
+static void termi_conf_load_matchers(void);
+/// Free all matchers.
+static void termi_matchers_free(void);
+#if VTE_CHECK_VERSION(0,26,0)
+/** @brief Load triggers and combine them into termi.trigger_regex.
+ *
+ * As for matchers, all patterns are matched in a single pass.
+ */
+static void termi_conf_load_triggers(void);
+/// Free all triggers.
+static void termi_triggers_free(void);
+/** @brief Match a complete output line against triggers.
+ *
+ * Escape sequences are stripped from \e line, in place.
+ */
+static void termi_tab_triggers_scan(TermiTab *tab, gchar *line, gsize len);
+/// Alert the user that a trigger matched in a tab, unless rate limited.
+static void termi_tab_trigger_fire(TermiTab *tab, TermiTrigger *trigger, const gchar *line);
+#endif
 
 /** @brief Display the popup menu.
  *
@@ -158,89 +696,521 @@ static void termi_conf_save_color(const char *grp, const char *name, const GdkCo
  */
 static void termi_menu_popup(TermiTab *tab, const GdkEvent *ev, gboolean full);
 /** @brief Update terminal font on all tabs and resize them.
+ *
+ * Changes are coalesced and applied to visible tabs once, before the next
+ * redraw. Hidden tabs are updated when selected.
  * @note It is safe to set \e font to \e termi.vte_font.
  */
 static void termi_set_vte_font(PangoFontDescription *font);
+/// Set the current font on a tab, if not already done.
+static void termi_tab_apply_font(TermiTab *tab);
 /** @brief Change terminal colors on all tabs.
  *
  * If \e cursor is NULL, \e vte_cursor_color_default i set to TRUE.
  * Other parameters must not be NULL.
  */
 static void termi_set_vte_colors(const GdkColor *fg, const GdkColor *bg, const GdkColor *cursor);
-/** @brief Resize the window.
+/** @brief Set scrollback limits of all tabs to fit in the memory budget.
+ *
+ * Tabs get up to \e buffer_lines, from what remains of the budget after the
+ * limits of more recently selected tabs, and may be truncated. Limits are
+ * summed, not usages: the budget holds as output grows.
+ */
+static void termi_scrollback_budget_apply(void);
+/// Print internal state to stderr, for debugging.
+static void termi_debug_dump(void);
+/** @brief Resize a window.
  *
  * This should be called after changing the font.
  * If \e row or \e col is -1, current value is used.
  */
-static void termi_resize(gint col, gint row);
+static void termi_resize(TermiWindow *win, gint col, gint row);
 
-/** @brief Add a new tab.
+/** @brief Add a new tab to a window.
  *
  * If \e cmd is NULL, run a shell.
  * If \e cwd is NULL, use current tab's directory or the current directory.
- * The new tab will receive focus.
+ * The new tab will receive focus, unless \e lazy is TRUE.
+ *
+ * Lazy tabs display a placeholder. The terminal is created and the command
+ * run when the tab is first selected, or later from an idle callback.
  *
  * @return the created tab or \e NULL.
  */
-static TermiTab *termi_tab_new(gchar *cmd, const gchar *cwd);
+static TermiTab *termi_tab_new(TermiWindow *win, gchar *cmd, const gchar *cwd, gboolean lazy);
+/** @brief Create the terminal of a tab and run its command.
+ *
+ * On error, the placeholder is kept and updated.
+ * @return TRUE on success or if already spawned.
+ */
+static gboolean termi_tab_spawn(TermiTab *tab);
+/// Replace the placeholder of a tab by its terminal and setup the terminal.
+static void termi_tab_attach_vte(TermiTab *tab);
+/// Free a tab, called when its page is destroyed.
+static void termi_tab_free(TermiTab *tab);
 /** @brief Remove a tab.
  *
  * If removed tab is the current tab, focus will be transferred.
  */
 static void termi_tab_del(TermiTab *tab);
+/// Apply configuration options to a tab.
+static void termi_tab_apply_conf(TermiTab *tab);
+/// Apply configuration options to the label of a tab.
+static void termi_tab_apply_label_conf(TermiTab *tab);
 /// Transfer focus to a given tab.
 static void termi_tab_focus(TermiTab *tab);
-/// Transfer focus to another tab by relative index.
-static void termi_tab_focus_rel(int n);
+/// Transfer focus to another tab of a window by relative index.
+static void termi_tab_focus_rel(TermiWindow *win, int n);
+/// Transfer focus to a tab of a window by index, if it exists.
+static void termi_tab_focus_nth(TermiWindow *win, int n);
 /// Check if tab as running processes.
 static gboolean termi_tab_has_running_processes(TermiTab *tab);
+#if VTE_CHECK_VERSION(0,26,0)
+/** @brief Update the foreground command of a tab.
+ *
+ * Called on child output and after input, not periodically. The command is
+ * looked up only when the foreground process group changes.
+ */
+static void termi_tab_fg_update(TermiTab *tab);
+/// Format a duration (in microseconds) for display.
+static void termi_format_duration(gint64 duration, gchar *buf, gsize size);
+/** @brief Alert the user about an event in a tab they are not looking at.
+ *
+ * The window urgency hint is set. If \e body is not NULL, a desktop
+ * notification is also shown (if notify-send is available).
+ * @return FALSE if the tab is visible in the active window, nothing is done.
+ */
+static gboolean termi_tab_alert(TermiTab *tab, const gchar *summary, const gchar *body);
+#endif
 /// Set tab title
 static void termi_tab_set_title(TermiTab *tab, const gchar *title);
+/** @brief Estimate memory used by tab scrollback.
+ *
+ * If \e lines is not NULL, set it to the number of lines in scrollback.
+ */
+static gsize termi_tab_scrollback_usage(TermiTab *tab, glong *lines);
+/** @brief Append rows scrolled out of the screen to the scrollback archive.
+ *
+ * The archive is created on first use.
+ */
+static void termi_tab_archive_update(TermiTab *tab);
+/// Write or close an archive, in the archive writer thread.
+static void termi_archive_write_cb(TermiArchiveChunk *chunk, void *data);
+/// Queue an archive chunk to the writer thread.
+static void termi_archive_push(TermiArchiveChunk *chunk);
+/// Wait for queued archive chunks to be written.
+static void termi_archive_flush(void);
+/** @brief Open the scrollback archive in a pager, in a new tab.
+ *
+ * If \e line is 0, start at the end of the archive.
+ */
+static void termi_tab_archive_show(TermiTab *tab, guint64 line);
+#if VTE_CHECK_VERSION(0,26,0)
+/** @brief Find the last archived line matching a regex, which is no longer in
+ * the terminal, and show it.
+ * @return TRUE if found.
+ */
+static gboolean termi_tab_archive_find(TermiTab *tab, const GRegex *regex);
+#endif
+
+#if VTE_CHECK_VERSION(0,26,0)
+/// Get the user shell, as an allocated string.
+static gchar *termi_get_user_shell(void);
+/** @brief Spawn shells in background until the pool is full.
+ *
+ * Extra shells are killed if the pool is too large. Shells are spawned in the
+ * directory of the last shell tab. If the pool is full without a shell in this
+ * directory, the oldest shell is replaced.
+ */
+static void termi_shell_pool_refill(void);
+/** @brief Take a shell running in a given directory from the pool.
+ *
+ * The pool is then refilled with shells running in this directory. Shells
+ * running elsewhere are kept, for tabs opened there later.
+ * @return the shell, or NULL if there is none.
+ */
+static TermiPooledShell *termi_shell_pool_pop(const gchar *wdir);
+/// Kill a pooled shell, it is freed when it exits.
+static void termi_shell_pool_kill(TermiPooledShell *shell);
+/// Check whether the pool has a shell running in the directory of new pooled shells.
+static gboolean termi_shell_pool_has_wdir(void);
+/** @brief Get the environment of spawned children.
+ *
+ * Same environment as vte_terminal_fork_command_full(): termi's one, with
+ * variables describing the terminal.
+ */
+static gchar **termi_spawn_environ(void);
+/** @brief Spawn a command on a new pty.
+ *
+ * The child is not watched, the caller must reap it.
+ * @return TRUE on success.
+ */
+static gboolean termi_spawn(char **argv, const gchar *wdir, VtePty **pty, GPid *pid, GError **error);
+/** @brief Run data through a converter (compression, decompression).
+ * @return TRUE on success.
+ */
+static gboolean termi_convert(GConverter *conv, const guint8 *data, gsize len, GByteArray *out);
+/// Start the hibernation timer of a hidden tab, if enabled.
+static void termi_tab_hibernate_schedule(TermiTab *tab);
+/** @brief Free the terminal of a tab, keeping its child running.
+ *
+ * Scrollback is saved as plain text to a compressed spill file. Child output
+ * is kept in a bounded buffer until the tab is woken up.
+ * @return TRUE on success.
+ */
+static gboolean termi_tab_hibernate(TermiTab *tab);
+/** @brief Dump the whole terminal buffer as text.
+ *
+ * Lines end with CRLF, to be fed back as is.
+ * @return the dump, NULL on error.
+ */
+static GString *termi_tab_dump(TermiTab *tab);
+/// Cancel tab hibernation, restore the terminal if already hibernated.
+static void termi_tab_wake(TermiTab *tab);
+/// Start reading child output of a tab.
+static void termi_tab_tap_start(TermiTab *tab);
+/** @brief Process child output: run output stages, then feed the terminal.
+ *
+ * Output of tabs which are not visible in a focused window is throttled: it is
+ * fed at most BackgroundFeedRate times per second. The child is never
+ * blocked: when too much output is pending, the oldest is skipped.
+ */
+static void termi_tab_output(TermiTab *tab, const gchar *data, gsize len);
+/// Check whether a tab is the current tab of the focused window.
+static gboolean termi_tab_is_visible(TermiTab *tab);
+/// Feed all throttled output of a tab to its terminal.
+static void termi_tab_throttle_flush(TermiTab *tab);
+/// Feed throttled output (not empty), after a marker if some was skipped.
+static void termi_tab_throttle_feed(TermiTab *tab);
+/** @brief Start tracing a keystroke latency.
+ *
+ * The trace goes through the key press, the write to the pty, the first read
+ * of output and the next redraw of the terminal. A single keystroke is traced
+ * at a time.
+ */
+static void termi_tab_latency_key(TermiTab *tab);
+/// Complete the current latency trace on terminal redraw.
+static void termi_tab_latency_draw(TermiTab *tab);
+/// Get a latency percentile of a tab, in microseconds.
+static gint64 termi_tab_latency_percentile(const TermiTab *tab, guint percent);
+/// Send data to the child, buffered if the pty is full.
+static void termi_tab_write(TermiTab *tab, const gchar *data, gsize len);
+/** @brief Send user input to a tab.
+ *
+ * If the tab is in the broadcast group, input is also written to the pty of
+ * all other members.
+ */
+static void termi_tab_send(TermiTab *tab, const gchar *data, gsize len);
+/// Add or remove a tab from the broadcast group.
+static void termi_tab_set_broadcast(TermiTab *tab, gboolean broadcast);
+/** @brief Start logging tab session to a new file of the log directory.
+ *
+ * If \e cast is TRUE, output is recorded with timestamps, in asciicast v2
+ * format.
+ */
+static TermiLog *termi_log_new(TermiTab *tab, gboolean cast);
+/** @brief Stop logging tab session.
+ *
+ * The writer thread completes in the background, it is joined at exit.
+ */
+static void termi_log_close(TermiLog *log);
+/// Wait for writer threads of closed logs to complete.
+static void termi_log_join_all(void);
+/** @brief Push data to a session log ring, dropped if it does not fit.
+ *
+ * \e hdr (of size \e hlen) is pushed before data, or dropped along with it.
+ */
+static void termi_log_push(TermiLog *log, gconstpointer hdr, gsize hlen, const gchar *data, gsize len);
+/// Wake up the writer thread of a log, if needed.
+static void termi_log_wake(TermiLog *log);
+/// Read data from a log ring, at a given position (writer thread).
+static void termi_log_read(TermiLog *log, guint pos, gpointer buf, gsize len);
+/** @brief Write asciicast events from a log ring (writer thread).
+ *
+ * \e pending keeps incomplete UTF-8 sequences between events.
+ */
+static gboolean termi_log_write_cast(TermiLog *log, GOutputStream *out, guint tail, guint len,
+                                     GByteArray *pending, GError **error);
+/** @brief Append data as a JSON string content.
+ *
+ * Invalid UTF-8 sequences are replaced by U+FFFD.
+ * @return the size of data processed, an incomplete sequence at the end is
+ * left unprocessed.
+ */
+static gsize termi_json_escape(GString *out, const gchar *data, gsize len);
+/** @brief Parse a JSON string, unescaped into \e out.
+ *
+ * \e p must point to the opening quote. It is moved after the closing one.
+ */
+static gboolean termi_json_unescape(const gchar **p, GString *out);
+/** @brief Open a log file, called from the writer thread.
+ * @return the stream, NULL on error.
+ */
+static GOutputStream *termi_log_open(TermiLog *log, guint part);
+/** @brief Paste data from a stream, by chunks.
+ *
+ * \e size is the size of the data (0 if unknown), used to show progress.
+ * The stream reference is taken. A previous paste is stopped.
+ */
+static void termi_tab_paste_start(TermiTab *tab, GInputStream *stream, goffset size);
+/// Stop (or complete) the paste in progress.
+static void termi_tab_paste_stop(TermiTab *tab);
+/// Wait for the pty of a tab to be writable to paste the next chunk.
+static void termi_tab_paste_watch(TermiTab *tab);
+/** @brief Append pasted data, without bracketed paste end sequences.
+ *
+ * Pasted data must not leave bracketed paste mode. The sequence may be
+ * split between chunks.
+ */
+static void termi_paste_filter(TermiPaste *paste, const gchar *data, gsize len, GString *out);
+/** @brief Write pasted data to a destination tab.
+ *
+ * Tabs in bracketed paste mode get \e filtered data, others get raw data.
+ */
+static void termi_paste_write(TermiPaste *paste, TermiTab *dest, const gchar *data, gsize len,
+                              const GString *filtered);
+/// Send bracketed paste end sequences, release destination tabs.
+static void termi_paste_end(TermiPaste *paste);
+/// Paste clipboard content (asynchronously).
+static void termi_tab_paste_clipboard(TermiTab *tab);
+
+/** @name Output stages.
+ */
+//@{
+static void termi_stage_stats(TermiTab *tab, const gchar *data, gsize len);
+/// Track terminal modes handled by termi (bracketed paste).
+static void termi_stage_modes(TermiTab *tab, const gchar *data, gsize len);
+/// Push output to the session log.
+static void termi_stage_log(TermiTab *tab, const gchar *data, gsize len);
+/// Match completed lines against triggers.
+static void termi_stage_triggers(TermiTab *tab, const gchar *data, gsize len);
+//@}
+
+/** @brief Start benchmarks, in new windows.
+ *
+ * Each generator is run in turn in \e ntabs tabs. Results are printed as JSON
+ * on stdout, then termi exits. The exit status is 1 if RSS is not bounded
+ * while archiving scrollback.
+ */
+static gboolean termi_bench_start(guint ntabs, guint size_mb);
+/// Account a finished benchmark tab, called when the tab is freed.
+static void termi_bench_tab_done(TermiTab *tab);
+/** @brief Write generator output to stdout (run in benchmark tabs).
+ * @return the exit code.
+ */
+static int termi_bench_generate(const gchar *name, guint size_mb);
+/** @brief Replay an asciicast recording in a new window.
+ *
+ * Output is fed directly to the terminal, there is no child process.
+ * In \e fast mode, events are fed as fast as the terminal can draw them,
+ * results are printed as JSON on stdout, then termi exits.
+ */
+static gboolean termi_replay_start(const gchar *path, gboolean fast);
+/** @brief Read the next event of the replayed recording.
+ * @return FALSE at the end of the recording.
+ */
+static gboolean termi_replay_read(TermiReplay *replay);
+/// End the replay, report results in fast mode.
+static void termi_replay_done(TermiReplay *replay);
+/// Get the directory of the saved session (allocated).
+static gchar *termi_session_dir(void);
+/** @brief Start a session snapshot, unless one is already in progress.
+ *
+ * Tabs are snapshotted one at a time from an idle callback, files are then
+ * written in a worker thread.
+ */
+static void termi_session_save_start(void);
+/** @brief Snapshot all tabs immediately and write the session.
+ *
+ * Called at exit, before the last window is removed. Nothing is written if
+ * there is no tab left.
+ */
+static void termi_session_save_now(void);
+/// Wait for the session to be written, still processing events.
+static void termi_session_save_wait(void);
+/// Schedule the next periodic snapshot, if enabled.
+static void termi_session_schedule(void);
+/// Create a session snapshot of all tabs, none of them snapshotted yet.
+static TermiSession *termi_session_new(void);
+/// Free a session snapshot.
+static void termi_session_free(TermiSession *session);
+/** @brief Add a tab to a session snapshot.
+ *
+ * Scrollback is dumped only if output has been received since it was last
+ * saved.
+ */
+static void termi_session_snapshot_tab(TermiSession *session, guint index);
+/** @brief Write a complete session snapshot.
+ *
+ * Nothing is written if neither tabs nor scrollback changed since the last
+ * write.
+ */
+static void termi_session_write_start(TermiSession *session);
+/** @brief Write session files, remove scrollback files not used anymore.
+ *
+ * May be run from a worker thread.
+ */
+static void termi_session_write(TermiSession *session);
+/** @brief Replace a file of the session directory, readable by the user only.
+ * @return TRUE on success.
+ */
+static gboolean termi_session_write_file(TermiSession *session, const gchar *name, const gchar *data, gsize len);
+/** @brief Reopen windows and tabs of the saved session.
+ *
+ * Only the current tab of each window is spawned immediately, other tabs are
+ * spawned lazily.
+ * @return FALSE if no tab has been restored.
+ */
+static gboolean termi_session_restore(void);
+/** @brief Reopen a window of the saved session.
+ * @return the number of restored tabs.
+ */
+static guint termi_session_restore_window(GKeyFile *kf, GPtrArray *groups);
+/// Reopen a tab of the saved session.
+static TermiTab *termi_session_restore_tab(GKeyFile *kf, const gchar *group, TermiWindow *win);
+/// Feed the saved scrollback of a restored tab to its terminal.
+static void termi_tab_restore_scrollback(TermiTab *tab);
+
+/// Output stages, run in order, NULL-terminated.
+static const TermiOutputStage termi_output_stages[] = {
+  termi_stage_stats,
+  termi_stage_modes,
+  termi_stage_log,
+  termi_stage_triggers,
+  NULL
+};
+#endif
 
-/** @brief Get URI under the cursor, if any.
+/** @brief Get matched text under the cursor, if any.
+ *
+ * If \e matcher is not NULL, it is set to the index of the matcher.
  * @return an allocated string, or NULL.
  */
-static gchar *termi_get_cursor_uri(const TermiTab *tab, const GdkEventButton *ev);
+static gchar *termi_get_cursor_match(const TermiTab *tab, const GdkEventButton *ev, guint *matcher);
+/// Run the action of a matcher on matched text.
+static void termi_match_open(guint matcher, gchar *match);
 /// Open a given URI.
 static void termi_open_uri(gchar *uri);
 
 #if VTE_CHECK_VERSION(0,26,0)
-/** @brief Show dialog to change search regex.
- * @return TRUE if modified, FALSE otherwise.
+/// Create the incremental search bar of a window.
+static GtkWidget *termi_search_bar_new(TermiWindow *win);
+/// Show and focus the search bar, select the current pattern.
+static void termi_search_bar_show(TermiWindow *win);
+/// Hide the search bar, give focus back to the terminal.
+static void termi_search_bar_hide(TermiWindow *win);
+/** @brief Set the search regex of all tabs.
+ *
+ * The regex reference is taken. Highlighted matches are updated.
+ */
+static void termi_search_set_regex(GRegex *regex);
+/** @brief Find the last match of the pattern being typed.
+ * @return TRUE if found, FALSE otherwise.
+ */
+static gboolean termi_search_incremental(TermiTab *tab);
+/// Drop search matches of a tab, they will be computed on next redraw.
+static void termi_tab_search_hits_clear(TermiTab *tab);
+/// Highlight search matches of the screen, when the search bar is visible.
+static void termi_tab_search_hits_draw(TermiTab *tab, GdkEventExpose *ev);
+/** @brief Find next/previous string.
+ *
+ * With infinite scrollback, the archive is searched when there is no previous
+ * match in the terminal.
+ */
+static void termi_search_find(TermiTab *tab, int way);
+/** @brief Search all tabs of all windows, show results in a dialog.
+ *
+ * Hibernated tabs and archived scrollback are not searched.
+ * If there is no current search, the search bar is shown instead.
  */
-static gboolean termi_search_modify(void);
-/// Find next/previous string.
-static void termi_search_find(const TermiTab *tab, int way);
+static void termi_find_all_start(TermiWindow *win);
+/// Release a reference to a search of all tabs.
+static void termi_find_all_unref(TermiFindAll *find);
+/// Check whether a tab still exists.
+static gboolean termi_tab_exists(TermiTab *tab);
 #endif
 
 
 /** @name Signal callbacks.
  */
 //@{
-static void termi_winmain_destroy_cb(GtkWindow *, void *);
-static gboolean termi_winmain_delete_event_cb(GtkWindow *, GdkEvent *, void *);
-static gboolean termi_winmain_key_press_event_cb(GtkWindow *, GdkEventKey *, void *);
-static gboolean termi_winmain_focus_in_event_cb(GtkWindow *, GdkEvent *, void *);
-static void termi_notebook_switch_page_cb(GtkNotebook *, gpointer, gint index, void *);
+static void termi_winmain_destroy_cb(GtkWindow *, TermiWindow *);
+static gboolean termi_winmain_delete_event_cb(GtkWindow *, GdkEvent *, TermiWindow *);
+static gboolean termi_winmain_key_press_event_cb(GtkWindow *, GdkEventKey *, TermiWindow *);
+static gboolean termi_winmain_key_release_event_cb(GtkWindow *, GdkEventKey *, TermiWindow *);
+static gboolean termi_winmain_focus_in_event_cb(GtkWindow *, GdkEvent *, TermiWindow *);
+static void termi_notebook_switch_page_cb(GtkNotebook *, gpointer, gint index, TermiWindow *);
+#if VTE_CHECK_VERSION(0,26,0)
+static void termi_tab_child_watch_cb(GPid, gint, TermiTab *);
+static void termi_child_reap_cb(GPid, gint, void *);
+static gboolean termi_tab_hibernate_cb(TermiTab *);
+static gboolean termi_tab_tap_cb(GIOChannel *, GIOCondition, TermiTab *);
+static gboolean termi_tab_input_cb(GIOChannel *, GIOCondition, TermiTab *);
+static gboolean termi_tab_paste_cb(GIOChannel *, GIOCondition, TermiTab *);
+static gboolean termi_tab_paste_retry_cb(TermiTab *);
+static void termi_tab_paste_clipboard_cb(GtkClipboard *, const gchar *, GtkWidget *);
+static gpointer termi_log_thread(TermiLog *);
+static gboolean termi_tab_throttle_cb(TermiTab *);
+static gboolean termi_tab_fg_check_cb(TermiTab *);
+static gboolean termi_bench_next_cb(void *);
+static gboolean termi_bench_tick_cb(void *);
+static gboolean termi_replay_next_cb(void *);
+static gboolean termi_session_step_cb(void *);
+static gboolean termi_session_timer_cb(void *);
+#if GLIB_CHECK_VERSION(2,36,0)
+static void termi_session_write_thread(GTask *, gpointer, TermiSession *, GCancellable *);
+static void termi_session_write_done_cb(GObject *, GAsyncResult *, void *);
+#endif
+static gboolean termi_tab_expose_event_cb(GtkWidget *, GdkEventExpose *, void *);
+static void termi_tab_commit_cb(VteTerminal *, gchar *, guint, void *);
+static void termi_tab_size_allocate_cb(GtkWidget *, GtkAllocation *, void *);
+#else
 static void termi_tab_child_exited_cb(VteTerminal *, void *);
 static void termi_tab_eof_cb(VteTerminal *, void *);
+#endif
 static void termi_tab_beep_cb(VteTerminal *, void *);
 static void termi_tab_window_title_changed_cb(VteTerminal *, void *);
+static void termi_tab_contents_changed_cb(VteTerminal *, void *);
 static void termi_tab_decrease_font_size_cb(VteTerminal *, void *);
 static void termi_tab_increase_font_size_cb(VteTerminal *, void *);
 static gboolean termi_tab_button_press_event_cb(VteTerminal *, GdkEventButton *, void *);
 static gboolean termi_tablbl_button_press_event_cb(GtkWidget *, GdkEventButton *, TermiTab *);
+static gboolean termi_lazy_tabs_cb(void *);
+static gboolean termi_font_update_cb(void *);
+static void termi_conf_monitor_changed_cb(GFileMonitor *, GFile *, GFile *, GFileMonitorEvent, void *);
+#if GLIB_CHECK_VERSION(2,36,0)
+static void termi_conf_save_thread(GTask *, gpointer, GKeyFile *, GCancellable *);
+static void termi_conf_save_done_cb(GObject *, GAsyncResult *, void *);
+#endif
+static gboolean termi_conf_reload_cb(void *);
+#if GLIB_CHECK_VERSION(2,36,0)
+static gboolean termi_sigusr1_cb(void *);
+#endif
 static void termi_dlgcolor_cursor_toggled_cb(GtkToggleButton *, GtkWidget *);
+#if VTE_CHECK_VERSION(0,26,0)
+static gboolean termi_shell_pool_refill_cb(void *);
+static void termi_shell_pool_child_exited_cb(GPid, gint, TermiPooledShell *);
+#endif
 static void termi_dlgtitle_entry_changed_cb(GtkEntry *, GtkDialog *);
 #if VTE_CHECK_VERSION(0,26,0)
-static void termi_dlgfind_entry_changed_cb(GtkEntry *, GtkDialog *);
+static void termi_searchbar_entry_changed_cb(GtkEntry *, TermiWindow *);
+static gboolean termi_searchbar_compile_cb(TermiWindow *);
+static gboolean termi_searchbar_key_press_event_cb(GtkWidget *, GdkEventKey *, TermiWindow *);
+static void termi_searchbar_wrap_toggled_cb(GtkToggleButton *, TermiWindow *);
+static void termi_searchbar_close_clicked_cb(GtkButton *, TermiWindow *);
+static void termi_tab_adjustment_value_changed_cb(GtkAdjustment *, TermiTab *);
+static gboolean termi_find_all_snapshot_cb(TermiFindAll *);
+static void termi_find_all_search_cb(TermiFindAllChunk *, TermiFindAll *);
+static gboolean termi_find_all_result_cb(TermiFindAllChunk *);
+static void termi_find_all_destroy_cb(GtkDialog *, TermiFindAll *);
+static void termi_find_all_row_activated_cb(GtkTreeView *, GtkTreePath *, GtkTreeViewColumn *, TermiFindAll *);
 #endif
 //@}
 
 /** @name Keybinding callbacks.
  */
 //@{
-#define TERMI_DEFINE_KB_CB(n,k,dm,dk)   static void termi_kb_##n##_cb(void);
+#define TERMI_DEFINE_KB_CB(n,k,dm,dk)   static void termi_kb_##n##_cb(TermiWindow *win);
   TERMI_KEY_BINDINGS_APPLY(TERMI_DEFINE_KB_CB)
 #undef TERMI_DEFINE_KB_CB
 //@}
@@ -248,10 +1218,16 @@ static void termi_dlgfind_entry_changed_cb(GtkEntry *, GtkDialog *);
 /** @name Popup menu callbacks.
  */
 //@{
-static void termi_menu_open_uri_cb(TermiTab *, GtkMenuItem *);
-static void termi_menu_copy_uri_cb(TermiTab *, GtkMenuItem *);
+static void termi_menu_open_match_cb(TermiTab *, GtkMenuItem *);
+static void termi_menu_copy_match_cb(TermiTab *, GtkMenuItem *);
 static void termi_menu_copy_selection_cb(TermiTab *, GtkMenuItem *);
 static void termi_menu_paste_cb(TermiTab *, GtkMenuItem *);
+#if VTE_CHECK_VERSION(0,26,0)
+static void termi_menu_paste_file_cb(TermiTab *, GtkMenuItem *);
+static void termi_menu_broadcast_cb(TermiTab *, GtkCheckMenuItem *);
+static void termi_menu_log_cb(TermiTab *, GtkCheckMenuItem *);
+static void termi_menu_record_cb(TermiTab *, GtkCheckMenuItem *);
+#endif
 static void termi_menu_set_tab_title_cb(TermiTab *, GtkMenuItem *);
 static void termi_menu_new_tab_cb(TermiTab *, GtkMenuItem *);
 static void termi_menu_close_tab_cb(TermiTab *, GtkMenuItem *);
@@ -265,8 +1241,8 @@ static void termi_menu_save_conf_at_exit_cb(TermiTab *, GtkCheckMenuItem *);
 
 /// Retrieve TermiTab from a VteTerminal widget.
 static TermiTab *termi_tab_from_vte(VteTerminal *vte);
-/// Retrieve TermiTab from an index page.
-static TermiTab *termi_tab_from_index(gint index);
+/// Retrieve TermiTab from an index page of a window.
+static TermiTab *termi_tab_from_index(TermiWindow *win, gint index);
 /// Retrieve page index from a TermiTab.
 static gint termi_tab_get_index(TermiTab *tab);
 
@@ -276,13 +1252,8 @@ static gint termi_tab_get_index(TermiTab *tab);
 
 
 
-void termi_winmain_init(void)
+void termi_icons_init(void)
 {
-  // create the main window
-  termi.winmain = GTK_WINDOW(gtk_window_new(GTK_WINDOW_TOPLEVEL));
-  gtk_window_set_title(termi.winmain, PROGRAM_NAME);
-  gtk_widget_set_name(GTK_WIDGET(termi.winmain), PROGRAM_NAME);
-  // set icon
   GtkIconTheme *icon_theme = gtk_icon_theme_get_default();
   gint *icon_sizes = gtk_icon_theme_get_icon_sizes(icon_theme, TERMI_ICON_NAME);
   GList *icons = NULL;
@@ -294,7 +1265,8 @@ void termi_winmain_init(void)
     }
   }
   g_free(icon_sizes);
-  gtk_window_set_icon_list(termi.winmain, icons);
+  // used by all windows created afterwards
+  gtk_window_set_default_icon_list(icons);
 #if GLIB_CHECK_VERSION(2,28,0)
   g_list_free_full(icons, g_object_unref);
 #else
@@ -304,20 +1276,61 @@ void termi_winmain_init(void)
   }
   g_list_free(icons);
 #endif
+}
+
+TermiWindow *termi_window_new(void)
+{
+  TermiWindow *win = g_new0(TermiWindow, 1);
+
+  // create the main window
+  win->winmain = GTK_WINDOW(gtk_window_new(GTK_WINDOW_TOPLEVEL));
+  gtk_window_set_title(win->winmain, PROGRAM_NAME);
+  gtk_widget_set_name(GTK_WIDGET(win->winmain), PROGRAM_NAME);
 
   // create the notebook
-  termi.notebook = GTK_NOTEBOOK(gtk_notebook_new());
-  gtk_notebook_set_scrollable(termi.notebook, TRUE);
-  gtk_notebook_set_show_border(termi.notebook, FALSE);
+  win->notebook = GTK_NOTEBOOK(gtk_notebook_new());
+  gtk_notebook_set_scrollable(win->notebook, TRUE);
+  gtk_notebook_set_show_border(win->notebook, FALSE);
 
-  gtk_container_add(GTK_CONTAINER(termi.winmain), GTK_WIDGET(termi.notebook));
+#if VTE_CHECK_VERSION(0,26,0)
+  GtkWidget *vbox = gtk_vbox_new(FALSE, 0);
+  gtk_box_pack_start(GTK_BOX(vbox), GTK_WIDGET(win->notebook), TRUE, TRUE, 0);
+  win->search_bar = termi_search_bar_new(win);
+  gtk_box_pack_end(GTK_BOX(vbox), win->search_bar, FALSE, FALSE, 0);
+  gtk_container_add(GTK_CONTAINER(win->winmain), vbox);
+#else
+  gtk_container_add(GTK_CONTAINER(win->winmain), GTK_WIDGET(win->notebook));
+#endif
 
   // setup signals
-  g_signal_connect(G_OBJECT(termi.winmain), "destroy", G_CALLBACK(termi_winmain_destroy_cb), NULL);
-  g_signal_connect(G_OBJECT(termi.winmain), "delete-event", G_CALLBACK(termi_winmain_delete_event_cb), NULL);
-  g_signal_connect(G_OBJECT(termi.winmain), "key-press-event", G_CALLBACK(termi_winmain_key_press_event_cb), NULL);
-  g_signal_connect(G_OBJECT(termi.winmain), "focus-in-event", G_CALLBACK(termi_winmain_focus_in_event_cb), NULL);
-  g_signal_connect(G_OBJECT(termi.notebook), "switch-page", G_CALLBACK(termi_notebook_switch_page_cb), NULL);
+  g_signal_connect(G_OBJECT(win->winmain), "destroy", G_CALLBACK(termi_winmain_destroy_cb), win);
+  g_signal_connect(G_OBJECT(win->winmain), "delete-event", G_CALLBACK(termi_winmain_delete_event_cb), win);
+  g_signal_connect(G_OBJECT(win->winmain), "key-press-event", G_CALLBACK(termi_winmain_key_press_event_cb), win);
+  g_signal_connect(G_OBJECT(win->winmain), "key-release-event", G_CALLBACK(termi_winmain_key_release_event_cb), win);
+  g_signal_connect(G_OBJECT(win->winmain), "focus-in-event", G_CALLBACK(termi_winmain_focus_in_event_cb), win);
+  g_signal_connect(G_OBJECT(win->notebook), "switch-page", G_CALLBACK(termi_notebook_switch_page_cb), win);
+
+  termi.windows = g_list_prepend(termi.windows, win);
+  return win;
+}
+
+void termi_window_close(TermiWindow *win)
+{
+  // termi_winmain_destroy_cb() does the cleanup
+  gtk_widget_destroy(GTK_WIDGET(win->winmain));
+}
+
+TermiTab *termi_window_get_cur_tab(TermiWindow *win)
+{
+  return termi_tab_from_index(win, gtk_notebook_get_current_page(win->notebook));
+}
+
+gboolean termi_window_type_key(TermiWindow *win)
+{
+#if VTE_CHECK_VERSION(0,26,0)
+  termi.typing_tab = win->cur_tab;
+#endif
+  return FALSE;  // handled by the window
 }
 
 void termi_quit(void)
@@ -330,17 +1343,44 @@ void termi_quit(void)
   if( termi.save_conf_at_exit ) {
     termi_conf_save();
   }
+#if VTE_CHECK_VERSION(0,26,0)
+  if( termi.session_enabled ) {
+    termi_session_save_now();
+  }
+#endif
 
-  gint npages = gtk_notebook_get_n_pages(termi.notebook);
-  gint i;
-  for( i=0; i<npages; i++ ) {
-    g_free( termi_tab_from_index(i) );
+  if( termi.lazy_tabs_id != 0 ) {
+    g_source_remove(termi.lazy_tabs_id);
   }
+  if( termi.font_update_id != 0 ) {
+    g_source_remove(termi.font_update_id);
+  }
+  // tabs are freed with their widget
+  while( termi.windows != NULL ) {
+    termi_window_close(termi.windows->data);
+  }
+  termi_conf_save_wait();
 
-  gtk_widget_destroy(GTK_WIDGET(termi.winmain));
+#if VTE_CHECK_VERSION(0,26,0)
+  termi_session_save_wait();
+  termi_log_join_all();  // logs of closed tabs
+  if( termi.shell_pool_refill_id != 0 ) {
+    g_source_remove(termi.shell_pool_refill_id);
+  }
+  while( !g_queue_is_empty(&termi.shell_pool) ) {
+    termi_shell_pool_kill(g_queue_peek_head(&termi.shell_pool));
+  }
+#endif
+  if( termi.socket_fd != -1 ) {
+    close(termi.socket_fd);
+    unlink(termi.socket_path);
+  }
+  g_free(termi.socket_path);
   g_free(termi.word_chars);
-  g_regex_unref(termi.uri_regex);
+  termi_matchers_free();
+  g_free(termi.menu_match);
 #if VTE_CHECK_VERSION(0,26,0)
+  termi_triggers_free();
   if( termi.search_regex ) {
     g_regex_unref(termi.search_regex);
   }
@@ -348,8 +1388,16 @@ void termi_quit(void)
   if( termi.vte_font != NULL ) {
     pango_font_description_free(termi.vte_font);
   }
+  if( termi.cfg_reload_id != 0 ) {
+    g_source_remove(termi.cfg_reload_id);
+  }
+  if( termi.cfg_monitor != NULL ) {
+    g_object_unref(termi.cfg_monitor);
+  }
   g_key_file_free(termi.cfg);
+  g_key_file_free(termi.cfg_dirty);
   g_free(termi.cfg_file);
+  g_free(termi.cfg_data);
 
   gtk_main_quit();
 }
@@ -360,14 +1408,40 @@ void termi_conf_load(void)
   if( termi.cfg_file == NULL ) {
     termi.cfg_file = g_build_filename(g_get_user_config_dir(), PROGRAM_NAME, PROGRAM_NAME".ini", NULL);
   }
+  gboolean reload = termi.cfg != NULL;
   if( termi.cfg != NULL ) {
     g_key_file_free(termi.cfg);
   }
   termi.cfg = g_key_file_new();
+  if( termi.cfg_dirty == NULL ) {
+    termi.cfg_dirty = g_key_file_new();
+  }
 
-  if( !g_key_file_load_from_file(termi.cfg, termi.cfg_file, G_KEY_FILE_KEEP_COMMENTS, NULL) ) {
+  g_free(termi.cfg_data);
+  termi.cfg_data = NULL;
+  gsize cfg_len;
+  if( !g_file_get_contents(termi.cfg_file, &termi.cfg_data, &cfg_len, NULL) ||
+     !g_key_file_load_from_data(termi.cfg, termi.cfg_data, cfg_len, G_KEY_FILE_KEEP_COMMENTS, NULL) ) {
     // silently ignore errors (file does not exist, etc.)
   }
+  // changes not saved yet are kept over the reloaded values
+  termi_conf_merge(termi.cfg, termi.cfg_dirty);
+
+  // previous values, to apply changes only
+  gboolean old_audible_bell = termi.audible_bell;
+  gboolean old_visible_bell = termi.visible_bell;
+  gboolean old_blink_mode = termi.blink_mode;
+  gboolean old_show_single_tab = termi.show_single_tab;
+  gboolean old_adjust_tab_title_width = termi.adjust_tab_title_width;
+  guint old_buffer_lines = termi.buffer_lines;
+  guint old_scrollback_budget_mb = termi.scrollback_budget_mb;
+  gchar *old_word_chars = termi.word_chars;
+  termi.word_chars = NULL;
+  gchar *old_match_pattern = termi.match_regex ? g_strdup(g_regex_get_pattern(termi.match_regex)) : NULL;
+#if VTE_CHECK_VERSION(0,26,0)
+  gboolean old_search_wrap = termi.search_wrap;
+  guint old_shell_pool_size = termi.shell_pool_size;
+#endif
 
   // load cfg entries
   gchar *val_s;
@@ -377,6 +1451,8 @@ void termi_conf_load(void)
   termi.show_single_tab = termi_conf_load_bool(TERMI_CFGGRP_GENERAL, "ShowSingleTab", FALSE);
   termi.force_tab_title = termi_conf_load_bool(TERMI_CFGGRP_GENERAL, "ForceTabTitle", FALSE);
   termi.adjust_tab_title_width = termi_conf_load_bool(TERMI_CFGGRP_GENERAL, "AdjustTabTitleWidth", FALSE);
+  termi.lazy_tabs_enabled = termi_conf_load_bool(TERMI_CFGGRP_GENERAL, "LazyTabs", TRUE);
+  termi.infinite_scrollback = termi_conf_load_bool(TERMI_CFGGRP_GENERAL, "InfiniteScrollback", FALSE);
   termi.audible_bell = termi_conf_load_bool(TERMI_CFGGRP_GENERAL, "AudibleBell", FALSE);
   termi.visible_bell = termi_conf_load_bool(TERMI_CFGGRP_GENERAL, "VisibleBell", FALSE);
   termi.blink_mode = termi_conf_load_bool(TERMI_CFGGRP_GENERAL, "BlinkMode", FALSE);
@@ -385,8 +1461,9 @@ void termi_conf_load(void)
   if( termi.buffer_lines <= 0 ) {
     termi.buffer_lines = 100; // default (errors silently ignored)
   }
+  gint scrollback_budget_mb = g_key_file_get_integer(termi.cfg, TERMI_CFGGRP_GENERAL, "ScrollbackBudgetMB", NULL);
+  termi.scrollback_budget_mb = scrollback_budget_mb > 0 ? scrollback_budget_mb : 0; // default: unlimited
 
-  g_free(termi.word_chars);
   termi.word_chars = g_key_file_get_string(termi.cfg, TERMI_CFGGRP_GENERAL, "WordChars", NULL);
   if( termi.word_chars == NULL ) {
     termi.word_chars = g_strdup("-a-zA-Z0-9_./@~"); // default
@@ -394,6 +1471,53 @@ void termi_conf_load(void)
 
 #if VTE_CHECK_VERSION(0,26,0)
   termi.search_wrap = termi_conf_load_bool(TERMI_CFGGRP_GENERAL, "SearchWrap", TRUE);
+
+  gint shell_pool_size = g_key_file_get_integer(termi.cfg, TERMI_CFGGRP_GENERAL, "ShellPoolSize", NULL);
+  termi.shell_pool_size = shell_pool_size > 0 ? shell_pool_size : 0; // default: disabled
+  gint hibernate_delay = g_key_file_get_integer(termi.cfg, TERMI_CFGGRP_GENERAL, "HibernateDelay", NULL);
+  termi.hibernate_delay = hibernate_delay > 0 ? hibernate_delay : 0; // default: disabled
+  GError *gerror = NULL;
+  gint background_feed_rate = g_key_file_get_integer(termi.cfg, TERMI_CFGGRP_GENERAL, "BackgroundFeedRate", &gerror);
+  if( gerror != NULL ) {
+    background_feed_rate = 5; // default
+    g_clear_error(&gerror);
+  }
+  termi.background_feed_rate = background_feed_rate > 0 ? background_feed_rate : 0;
+  termi.latency_trace = termi_conf_load_bool(TERMI_CFGGRP_GENERAL, "LatencyTrace", FALSE);
+
+  g_free(termi.log_dir);
+  termi.log_dir = g_key_file_get_string(termi.cfg, TERMI_CFGGRP_GENERAL, "LogDir", NULL);
+  if( termi.log_dir != NULL && *termi.log_dir == '\0' ) {
+    g_free(termi.log_dir);
+    termi.log_dir = NULL; // default: disabled
+  }
+  termi.log_new_tabs = termi_conf_load_bool(TERMI_CFGGRP_GENERAL, "LogNewTabs", FALSE);
+  termi.log_timestamps = termi_conf_load_bool(TERMI_CFGGRP_GENERAL, "LogTimestamps", FALSE);
+  termi.log_compress = termi_conf_load_bool(TERMI_CFGGRP_GENERAL, "LogCompress", FALSE);
+  gint log_rotate_mb = g_key_file_get_integer(termi.cfg, TERMI_CFGGRP_GENERAL, "LogRotateMB", NULL);
+  termi.log_rotate_mb = log_rotate_mb > 0 ? log_rotate_mb : 0; // default: never
+  gint command_notify_delay = g_key_file_get_integer(termi.cfg, TERMI_CFGGRP_GENERAL, "CommandNotifyDelay", &gerror);
+  if( gerror != NULL ) {
+    command_notify_delay = 30; // default
+    g_clear_error(&gerror);
+  }
+  termi.command_notify_delay = command_notify_delay > 0 ? command_notify_delay : 0;
+  gint session_save_interval = g_key_file_get_integer(termi.cfg, TERMI_CFGGRP_GENERAL, "SessionSaveInterval", &gerror);
+  if( gerror != NULL ) {
+    session_save_interval = 60; // default
+    g_clear_error(&gerror);
+  }
+  termi.session_save_interval = session_save_interval > 0 ? session_save_interval : 0;
+  termi.session_scrollback = termi_conf_load_bool(TERMI_CFGGRP_GENERAL, "SessionScrollback", FALSE);
+  if( termi.session_enabled ) {
+    termi_session_schedule();  // interval may have been enabled
+  }
+#endif
+
+  // Matchers, triggers
+  termi_conf_load_matchers();
+#if VTE_CHECK_VERSION(0,26,0)
+  termi_conf_load_triggers();
 #endif
 
   // Font
@@ -415,67 +1539,126 @@ void termi_conf_load(void)
   gboolean col_cursor_default = !termi_conf_load_color(TERMI_CFGGRP_GENERAL, "CursorColor", &col_cursor);
 
   // Keys
+  if( termi.key_bindings != NULL ) {
+    g_hash_table_destroy(termi.key_bindings);
+  }
+  termi.key_bindings = termi_key_table_new();
 #define TERMI_LOAD_CONF_KB(n,k,dm,dk) \
-  termi.kb_##n.mod = dm; \
-  termi.kb_##n.key = dk; \
-  termi_conf_load_keys(k, &termi.kb_##n);
+  termi_conf_load_keys(k, dm, dk, termi_kb_##n##_cb);
   TERMI_KEY_BINDINGS_APPLY(TERMI_LOAD_CONF_KB);
 #undef TERMI_LOAD_CONF_KB
 
 
-  // Reapply configuration
-  gint npages = gtk_notebook_get_n_pages(termi.notebook);
-  gint i;
-  for( i=0; i<npages; i++ ) {
-    TermiTab *tab = termi_tab_from_index(i);
-    VteTerminal *vte = tab->vte;
-    vte_terminal_set_audible_bell(vte, termi.audible_bell);
-    vte_terminal_set_visible_bell(vte, termi.visible_bell);
-    vte_terminal_set_cursor_blink_mode(vte, termi.blink_mode ? VTE_CURSOR_BLINK_ON : VTE_CURSOR_BLINK_OFF);
-    vte_terminal_set_scrollback_lines(vte, termi.buffer_lines);
-    vte_terminal_set_word_chars(vte, termi.word_chars);
+  // Reapply configuration, only what changed
+  gboolean tab_changed = !reload ||
+      termi.audible_bell != old_audible_bell ||
+      termi.visible_bell != old_visible_bell ||
+      termi.blink_mode != old_blink_mode ||
+      g_strcmp0(termi.word_chars, old_word_chars) != 0 ||
+      g_strcmp0(g_regex_get_pattern(termi.match_regex), old_match_pattern) != 0;
 #if VTE_CHECK_VERSION(0,26,0)
-    vte_terminal_search_set_wrap_around(vte, termi.search_wrap);
+  tab_changed = tab_changed || termi.search_wrap != old_search_wrap;
 #endif
-    if(termi.adjust_tab_title_width) {
-      gtk_label_set_ellipsize(tab->lbl, PANGO_ELLIPSIZE_END);
-      gtk_container_child_set(GTK_CONTAINER(termi.notebook), GTK_WIDGET(tab->vte), "tab-expand", TRUE, NULL);
-    } else {
-      gtk_label_set_ellipsize(tab->lbl, PANGO_ELLIPSIZE_NONE);
-      gtk_container_child_set(GTK_CONTAINER(termi.notebook), GTK_WIDGET(tab->vte), "tab-expand", FALSE, NULL);
-    }
+  gboolean label_changed = termi.adjust_tab_title_width != old_adjust_tab_title_width;
+  g_free(old_word_chars);
+  g_free(old_match_pattern);
+  if( tab_changed ) {
+    termi.conf_serial++;
   }
-  if( npages == 1 ) {
-    gtk_notebook_set_show_tabs(termi.notebook, termi.show_single_tab);
-  }
-  termi_set_vte_font(vte_font);
-  termi_set_vte_colors(&col_fg, &col_bg, col_cursor_default ? NULL : &col_cursor);
-}
+
+  GList *win_it;
+  for( win_it=termi.windows; win_it!=NULL; win_it=win_it->next ) {
+    TermiWindow *win = win_it->data;
+    win->key_prefix = NULL;  // pointed to the old bindings
+    gint npages = gtk_notebook_get_n_pages(win->notebook);
+    if( tab_changed && win->cur_tab != NULL ) {
+      // other tabs are updated when selected
+      termi_tab_apply_conf(win->cur_tab);
+    }
+    if( label_changed ) {
+      gint i;
+      for( i=0; i<npages; i++ ) {
+        termi_tab_apply_label_conf(termi_tab_from_index(win, i));
+      }
+    }
+    if( npages == 1 && termi.show_single_tab != old_show_single_tab ) {
+      gtk_notebook_set_show_tabs(win->notebook, termi.show_single_tab);
+    }
+  }
+  if( !reload || (vte_font == NULL) != (termi.vte_font == NULL) ||
+     (vte_font != NULL && !pango_font_description_equal(vte_font, termi.vte_font)) ) {
+    termi_set_vte_font(vte_font);
+  } else if( vte_font != NULL ) {
+    pango_font_description_free(vte_font);
+  }
+  if( !reload || !gdk_color_equal(&col_fg, &termi.vte_fg_color) || !gdk_color_equal(&col_bg, &termi.vte_bg_color) ||
+     col_cursor_default != termi.vte_cursor_color_default ||
+     (!col_cursor_default && !gdk_color_equal(&col_cursor, &termi.vte_cursor_color)) ) {
+    termi_set_vte_colors(&col_fg, &col_bg, col_cursor_default ? NULL : &col_cursor);
+  }
+  if( !reload || termi.buffer_lines != old_buffer_lines || termi.scrollback_budget_mb != old_scrollback_budget_mb ) {
+    termi_scrollback_budget_apply();
+  }
+#if VTE_CHECK_VERSION(0,26,0)
+  if( !reload || termi.shell_pool_size != old_shell_pool_size ) {
+    termi_shell_pool_refill();
+  }
+#endif
+}
+
+void termi_conf_monitor_start(void)
+{
+  GFile *file = g_file_new_for_path(termi.cfg_file);
+  GError *gerror = NULL;
+  termi.cfg_monitor = g_file_monitor_file(file, G_FILE_MONITOR_NONE, NULL, &gerror);
+  g_object_unref(file);
+  if( termi.cfg_monitor == NULL ) {
+    termi_error("cannot watch configuration file: %s", gerror->message);
+    g_error_free(gerror);
+    return;
+  }
+  g_signal_connect(G_OBJECT(termi.cfg_monitor), "changed", G_CALLBACK(termi_conf_monitor_changed_cb), NULL);
+}
 
 void termi_conf_save(void)
 {
   g_assert( termi.cfg != NULL );
 
   // update cfg entries
-  g_key_file_set_boolean(termi.cfg, TERMI_CFGGRP_GENERAL, "SaveConfAtExit", termi.save_conf_at_exit);
-  g_key_file_set_boolean(termi.cfg, TERMI_CFGGRP_GENERAL, "ShowSingleTab", termi.show_single_tab);
-  g_key_file_set_boolean(termi.cfg, TERMI_CFGGRP_GENERAL, "ForceTabTitle", termi.force_tab_title);
-  g_key_file_set_boolean(termi.cfg, TERMI_CFGGRP_GENERAL, "AdjustTabTitleWidth", termi.adjust_tab_title_width);
-  g_key_file_set_boolean(termi.cfg, TERMI_CFGGRP_GENERAL, "AudibleBell", termi.audible_bell);
-  g_key_file_set_boolean(termi.cfg, TERMI_CFGGRP_GENERAL, "VisibleBell", termi.visible_bell);
-  g_key_file_set_boolean(termi.cfg, TERMI_CFGGRP_GENERAL, "BlinkMode", termi.blink_mode);
-  g_key_file_set_integer(termi.cfg, TERMI_CFGGRP_GENERAL, "BufferLines", termi.buffer_lines);
-  g_key_file_set_string(termi.cfg, TERMI_CFGGRP_GENERAL, "WordChars", termi.word_chars);
+  termi_conf_save_bool(TERMI_CFGGRP_GENERAL, "SaveConfAtExit", termi.save_conf_at_exit);
+  termi_conf_save_bool(TERMI_CFGGRP_GENERAL, "ShowSingleTab", termi.show_single_tab);
+  termi_conf_save_bool(TERMI_CFGGRP_GENERAL, "ForceTabTitle", termi.force_tab_title);
+  termi_conf_save_bool(TERMI_CFGGRP_GENERAL, "AdjustTabTitleWidth", termi.adjust_tab_title_width);
+  termi_conf_save_bool(TERMI_CFGGRP_GENERAL, "LazyTabs", termi.lazy_tabs_enabled);
+  termi_conf_save_bool(TERMI_CFGGRP_GENERAL, "InfiniteScrollback", termi.infinite_scrollback);
+  termi_conf_save_bool(TERMI_CFGGRP_GENERAL, "AudibleBell", termi.audible_bell);
+  termi_conf_save_bool(TERMI_CFGGRP_GENERAL, "VisibleBell", termi.visible_bell);
+  termi_conf_save_bool(TERMI_CFGGRP_GENERAL, "BlinkMode", termi.blink_mode);
+  termi_conf_save_int(TERMI_CFGGRP_GENERAL, "BufferLines", termi.buffer_lines);
+  termi_conf_save_int(TERMI_CFGGRP_GENERAL, "ScrollbackBudgetMB", termi.scrollback_budget_mb);
+  termi_conf_save_string(TERMI_CFGGRP_GENERAL, "WordChars", termi.word_chars);
 #if VTE_CHECK_VERSION(0,26,0)
-  g_key_file_set_boolean(termi.cfg, TERMI_CFGGRP_GENERAL, "SearchWrap", termi.search_wrap);
+  termi_conf_save_bool(TERMI_CFGGRP_GENERAL, "SearchWrap", termi.search_wrap);
+  termi_conf_save_int(TERMI_CFGGRP_GENERAL, "ShellPoolSize", termi.shell_pool_size);
+  termi_conf_save_int(TERMI_CFGGRP_GENERAL, "HibernateDelay", termi.hibernate_delay);
+  termi_conf_save_int(TERMI_CFGGRP_GENERAL, "BackgroundFeedRate", termi.background_feed_rate);
+  termi_conf_save_bool(TERMI_CFGGRP_GENERAL, "LatencyTrace", termi.latency_trace);
+  termi_conf_save_string(TERMI_CFGGRP_GENERAL, "LogDir", termi.log_dir ? termi.log_dir : "");
+  termi_conf_save_bool(TERMI_CFGGRP_GENERAL, "LogNewTabs", termi.log_new_tabs);
+  termi_conf_save_bool(TERMI_CFGGRP_GENERAL, "LogTimestamps", termi.log_timestamps);
+  termi_conf_save_bool(TERMI_CFGGRP_GENERAL, "LogCompress", termi.log_compress);
+  termi_conf_save_int(TERMI_CFGGRP_GENERAL, "LogRotateMB", termi.log_rotate_mb);
+  termi_conf_save_int(TERMI_CFGGRP_GENERAL, "CommandNotifyDelay", termi.command_notify_delay);
+  termi_conf_save_int(TERMI_CFGGRP_GENERAL, "SessionSaveInterval", termi.session_save_interval);
+  termi_conf_save_bool(TERMI_CFGGRP_GENERAL, "SessionScrollback", termi.session_scrollback);
 #endif
 
   if( termi.vte_font != NULL ) {
     gchar *s = pango_font_description_to_string(termi.vte_font);
-    g_key_file_set_string(termi.cfg, TERMI_CFGGRP_GENERAL, "Font", s);
+    termi_conf_save_string(TERMI_CFGGRP_GENERAL, "Font", s);
     g_free(s);
   } else {
-    g_key_file_set_string(termi.cfg, TERMI_CFGGRP_GENERAL, "Font", "");
+    termi_conf_save_string(TERMI_CFGGRP_GENERAL, "Font", "");
   }
 
   termi_conf_save_color(TERMI_CFGGRP_GENERAL, "ForegroundColor", &termi.vte_fg_color);
@@ -485,49 +1668,188 @@ void termi_conf_save(void)
 
   // key bindings are updated at loading
 
-  // save to file
+  if( !termi_conf_is_dirty() ) {
+    return;  // nothing changed
+  }
+  termi_conf_save_start();
+}
+
+gboolean termi_conf_is_dirty(void)
+{
+  gsize ngroups;
+  g_strfreev(g_key_file_get_groups(termi.cfg_dirty, &ngroups));
+  return ngroups > 0;
+}
+
+void termi_conf_save_start(void)
+{
+  if( termi.cfg_saving ) {
+    return;  // saved when the current save is done
+  }
+  GKeyFile *changes = termi.cfg_dirty;
+  termi.cfg_dirty = g_key_file_new();
+#if GLIB_CHECK_VERSION(2,36,0)
+  termi.cfg_saving = TRUE;
+  GTask *task = g_task_new(NULL, NULL, termi_conf_save_done_cb, NULL);
+  g_task_set_task_data(task, changes, (GDestroyNotify)g_key_file_free);
+  g_task_run_in_thread(task, (GTaskThreadFunc)termi_conf_save_thread);
+  g_object_unref(task);
+#else
+  GError *gerror = NULL;
+  gchar *data = termi_conf_save_merge(termi.cfg_file, changes, &gerror);
+  g_key_file_free(changes);
+  if( data == NULL ) {
+    termi_error("failed to save configuration: %s", gerror->message);
+    g_error_free(gerror);
+    return;
+  }
+  // don't reload what has just been saved
+  g_free(termi.cfg_data);
+  termi.cfg_data = data;
+#endif
+}
+
+void termi_conf_save_wait(void)
+{
+  while( termi.cfg_saving ) {
+    g_main_context_iteration(NULL, TRUE);
+  }
+}
+
+void termi_conf_merge(GKeyFile *cfg, GKeyFile *changes)
+{
+  gchar **groups = g_key_file_get_groups(changes, NULL);
+  gchar **grp;
+  for( grp=groups; *grp!=NULL; grp++ ) {
+    gchar **keys = g_key_file_get_keys(changes, *grp, NULL, NULL);
+    gchar **key;
+    for( key=keys; *key!=NULL; key++ ) {
+      gchar *val = g_key_file_get_value(changes, *grp, *key, NULL);
+      g_key_file_set_value(cfg, *grp, *key, val);
+      g_free(val);
+    }
+    g_strfreev(keys);
+  }
+  g_strfreev(groups);
+}
+
+gchar *termi_conf_save_merge(const gchar *path, GKeyFile *changes, GError **error)
+{
+  // reload the file, it may have been saved by another instance
+  GKeyFile *cfg = g_key_file_new();
+  g_key_file_load_from_file(cfg, path, G_KEY_FILE_KEEP_COMMENTS, NULL);
+  termi_conf_merge(cfg, changes);
+
+  gsize cfg_len;
+  gchar *cfg_data = g_key_file_to_data(cfg, &cfg_len, NULL);
+  g_key_file_free(cfg);
 
-  gchar *cfg_dir = g_path_get_dirname(termi.cfg_file);
+  gchar *cfg_dir = g_path_get_dirname(path);
   if( g_mkdir_with_parents(cfg_dir, 0700) != 0 ) {
-    termi_error("failed to create configuration file directory: %s", g_strerror(errno));
+    int errsv = errno;
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+                "failed to create configuration file directory: %s", g_strerror(errsv));
     g_free(cfg_dir);
-    return;
+    g_free(cfg_data);
+    return NULL;
   }
   g_free(cfg_dir);
 
-  gsize cfg_len;
-  gchar *cfg_data = g_key_file_to_data(termi.cfg, &cfg_len, NULL);
-  GError *gerror = NULL;
-  if( !g_file_set_contents(termi.cfg_file, cfg_data, cfg_len, &gerror) ) {
-    termi_error("failed to save configuration: %s", gerror->message); 
-    g_error_free(gerror);
+  if( !g_file_set_contents(path, cfg_data, cfg_len, error) ) {
     g_free(cfg_data);
-    return;
+    return NULL;
   }
-  g_free(cfg_data);
+  return cfg_data;
 }
 
-void termi_conf_load_keys(const char *name, TermiKeyBinding *kb)
+void termi_conf_load_keys(const char *name, GdkModifierType mod, guint key, void (*cb)(TermiWindow *))
 {
   gchar *s = g_key_file_get_string(termi.cfg, TERMI_CFGGRP_KEYS, name, NULL);
   if( s == NULL ) {
     // default value (only when not set at all)
     // update the configuration now
-    s = gtk_accelerator_name(kb->key, kb->mod);
-    g_key_file_set_string(termi.cfg, TERMI_CFGGRP_KEYS, name, s);
-  } else if( *s == '\0' ) {
-    // empty value: binding disabled
-    kb->mod = 0;
-    kb->key = 0;
-  } else {
-    gtk_accelerator_parse(s, &kb->key, &kb->mod);
-    if( kb->key == 0 && kb->mod == 0 ) {
+    s = gtk_accelerator_name(key, mod);
+    termi_conf_save_string(TERMI_CFGGRP_KEYS, name, s);
+  }
+  // empty value: binding disabled
+
+  GHashTable *table = termi.key_bindings;
+  TermiKeyNode *node = NULL;
+  gchar **keys = g_strsplit_set(s, " \t", 0);
+  gchar **it;
+  for( it=keys; *it!=NULL; it++ ) {
+    if( **it == '\0' ) {
+      continue;
+    }
+    if( node != NULL ) {
+      // previous key is a prefix
+      if( node->cb != NULL ) {
+        termi_error("key binding for %s conflicts with another binding: %s", name, s);
+        node = NULL;
+        break;
+      }
+      if( node->next == NULL ) {
+        node->next = termi_key_table_new();
+      }
+      table = node->next;
+    }
+    gtk_accelerator_parse(*it, &key, &mod);
+    if( key == 0 && mod == 0 ) {
       termi_error("invalid key binding for %s: %s", name, s);
+      node = NULL;
+      break;
+    }
+    if( table == termi.key_bindings && (mod & ~GDK_SHIFT_MASK) == 0 &&
+       g_unichar_isprint(gdk_keyval_to_unicode(key)) ) {
+      // see termi_winmain_key_press_event_cb()
+      termi_error("key binding for %s must not start with a printable key: %s", name, s);
+      node = NULL;
+      break;
+    }
+    gint64 id = termi_key_id(mod, key);
+    node = g_hash_table_lookup(table, &id);
+    if( node == NULL ) {
+      node = g_new0(TermiKeyNode, 1);
+      node->id = id;
+      g_hash_table_insert(table, &node->id, node);
+    }
+  }
+  g_strfreev(keys);
+
+  if( node != NULL ) {
+    if( node->cb != NULL || node->next != NULL ) {
+      termi_error("key binding for %s conflicts with another binding: %s", name, s);
+    } else {
+      node->cb = cb;
     }
   }
+  // note: prefixes left without binding (on error) are harmless
   g_free(s);
 }
 
+gint64 termi_key_id(GdkModifierType mod, guint key)
+{
+  if( key >= 'A' && key <= 'Z' ) {
+    key |= 0x20;
+  }
+  return ((gint64)mod << 32) | key;
+}
+
+GHashTable *termi_key_table_new(void)
+{
+  // keys are owned by the nodes
+  return g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                               NULL, (GDestroyNotify)termi_key_node_free);
+}
+
+void termi_key_node_free(TermiKeyNode *node)
+{
+  if( node->next != NULL ) {
+    g_hash_table_destroy(node->next);
+  }
+  g_free(node);
+}
+
 gboolean termi_conf_load_bool(const char *grp, const char *name, gboolean def)
 {
   GError *gerror = NULL;
@@ -557,13 +1879,213 @@ gboolean termi_conf_load_color(const char *grp, const char *name, GdkColor *colo
 void termi_conf_save_color(const char *grp, const char *name, const GdkColor *color)
 {
   if( color == NULL ) {
-    g_key_file_set_string(termi.cfg, grp, name, "");
-  } else {
-    gchar *s = g_strdup_printf("#%02x%02x%02x", color->red>>8, color->green>>8, color->blue>>8);
-    g_key_file_set_string(termi.cfg, grp, name, s);
+    termi_conf_save_string(grp, name, "");
+    return;
+  }
+  gchar *s = g_key_file_get_string(termi.cfg, grp, name, NULL);
+  GdkColor cur;
+  if( s == NULL || !gdk_color_parse(s, &cur) || !gdk_color_equal(&cur, color) ) {
     g_free(s);
+    s = g_strdup_printf("#%02x%02x%02x", color->red>>8, color->green>>8, color->blue>>8);
+    termi_conf_save_string(grp, name, s);
+  }
+  g_free(s);
+}
+
+void termi_conf_save_bool(const char *grp, const char *name, gboolean val)
+{
+  GError *gerror = NULL;
+  gboolean cur = g_key_file_get_boolean(termi.cfg, grp, name, &gerror);
+  if( gerror != NULL || cur != val ) {
+    g_key_file_set_boolean(termi.cfg, grp, name, val);
+    g_key_file_set_boolean(termi.cfg_dirty, grp, name, val);
+  }
+  if( gerror != NULL ) {
+    g_error_free(gerror);
+  }
+}
+
+void termi_conf_save_int(const char *grp, const char *name, gint val)
+{
+  GError *gerror = NULL;
+  gint cur = g_key_file_get_integer(termi.cfg, grp, name, &gerror);
+  if( gerror != NULL || cur != val ) {
+    g_key_file_set_integer(termi.cfg, grp, name, val);
+    g_key_file_set_integer(termi.cfg_dirty, grp, name, val);
+  }
+  if( gerror != NULL ) {
+    g_error_free(gerror);
+  }
+}
+
+void termi_conf_save_string(const char *grp, const char *name, const gchar *val)
+{
+  gchar *cur = g_key_file_get_string(termi.cfg, grp, name, NULL);
+  if( g_strcmp0(cur, val) != 0 ) {
+    g_key_file_set_string(termi.cfg, grp, name, val);
+    g_key_file_set_string(termi.cfg_dirty, grp, name, val);
+  }
+  g_free(cur);
+}
+
+void termi_conf_load_matchers(void)
+{
+  // keep the regex if unchanged, terminals don't have to update it
+  GRegex *old_regex = termi.match_regex;
+  termi.match_regex = NULL;
+  termi_matchers_free();
+  termi.matchers = g_array_new(FALSE, FALSE, sizeof(TermiMatcher));
+  GString *combined = g_string_new(NULL);
+
+  // URIs are always matched first
+  TermiMatcher uri = { g_strdup("uri"), NULL };
+  g_array_append_val(termi.matchers, uri);
+  g_string_append(combined, "(?<termi_m0>"TERMI_URI_PATTERN")");
+
+  gchar **groups = g_key_file_get_groups(termi.cfg, NULL);
+  gchar **it;
+  for( it=groups; *it!=NULL; it++ ) {
+    if( !g_str_has_prefix(*it, TERMI_CFGGRP_MATCHER_PREFIX) ) {
+      continue;
+    }
+    const gchar *name = *it + strlen(TERMI_CFGGRP_MATCHER_PREFIX);
+    gchar *pattern = termi_conf_load_regex(*it, "matcher", name);
+    if( pattern == NULL ) {
+      continue;
+    }
+    TermiMatcher matcher = { g_strdup(name), g_key_file_get_string(termi.cfg, *it, "Command", NULL) };
+    if( matcher.command != NULL && *matcher.command == '\0' ) {
+      g_free(matcher.command);
+      matcher.command = NULL;
+    }
+    g_string_append_printf(combined, "|(?<termi_m%u>%s)", termi.matchers->len, pattern);
+    g_array_append_val(termi.matchers, matcher);
+    g_free(pattern);
+  }
+  g_strfreev(groups);
+
+  if( old_regex != NULL && strcmp(g_regex_get_pattern(old_regex), combined->str) == 0 ) {
+    termi.match_regex = old_regex;
+    g_string_free(combined, TRUE);
+    return;
+  }
+  if( old_regex != NULL ) {
+    g_regex_unref(old_regex);
+  }
+  GError *gerror = NULL;
+  termi.match_regex = g_regex_new(combined->str, G_REGEX_OPTIMIZE, 0, &gerror);
+  if( gerror ) {
+    // patterns are valid alone, numbered back references are likely shifted
+    termi_error("cannot combine matchers, only URIs are matched: %s", gerror->message);
+    g_error_free(gerror);
+    g_array_set_size(termi.matchers, 1);
+    termi.match_regex = g_regex_new("(?<termi_m0>"TERMI_URI_PATTERN")", G_REGEX_OPTIMIZE, 0, NULL);
+  }
+  g_string_free(combined, TRUE);
+}
+
+gchar *termi_conf_load_regex(const char *grp, const char *kind, const char *name)
+{
+  gchar *pattern = g_key_file_get_string(termi.cfg, grp, "Regex", NULL);
+  if( pattern == NULL || *pattern == '\0' ) {
+    termi_error("no regex for %s %s", kind, name);
+    g_free(pattern);
+    return NULL;
+  }
+  // check the pattern alone, for a meaningful error
+  GError *gerror = NULL;
+  GRegex *regex = g_regex_new(pattern, 0, 0, &gerror);
+  if( gerror ) {
+    termi_error("invalid regex for %s %s: %s", kind, name, gerror->message);
+    g_error_free(gerror);
+    g_free(pattern);
+    return NULL;
+  }
+  g_regex_unref(regex);
+  return pattern;
+}
+
+void termi_matchers_free(void)
+{
+  if( termi.matchers != NULL ) {
+    guint i;
+    for( i=0; i<termi.matchers->len; i++ ) {
+      TermiMatcher *matcher = &g_array_index(termi.matchers, TermiMatcher, i);
+      g_free(matcher->name);
+      g_free(matcher->command);
+    }
+    g_array_free(termi.matchers, TRUE);
+    termi.matchers = NULL;
+  }
+  if( termi.match_regex != NULL ) {
+    g_regex_unref(termi.match_regex);
+    termi.match_regex = NULL;
+  }
+}
+
+#if VTE_CHECK_VERSION(0,26,0)
+void termi_conf_load_triggers(void)
+{
+  termi_triggers_free();
+  termi.triggers = g_array_new(FALSE, FALSE, sizeof(TermiTrigger));
+  GString *combined = g_string_new(NULL);
+
+  gchar **groups = g_key_file_get_groups(termi.cfg, NULL);
+  gchar **it;
+  for( it=groups; *it!=NULL; it++ ) {
+    if( !g_str_has_prefix(*it, TERMI_CFGGRP_TRIGGER_PREFIX) ) {
+      continue;
+    }
+    const gchar *name = *it + strlen(TERMI_CFGGRP_TRIGGER_PREFIX);
+    gchar *pattern = termi_conf_load_regex(*it, "trigger", name);
+    if( pattern == NULL ) {
+      continue;
+    }
+    GError *gerror = NULL;
+    gint rate_limit = g_key_file_get_integer(termi.cfg, *it, "RateLimit", &gerror);
+    if( gerror != NULL ) {
+      rate_limit = 10; // default
+      g_error_free(gerror);
+    }
+    TermiTrigger trigger = {
+      .name = g_strdup(name),
+      .notify = termi_conf_load_bool(*it, "Notify", TRUE),
+      .interval = (gint64)MAX(rate_limit, 0) * G_USEC_PER_SEC,
+    };
+    g_string_append_printf(combined, "%s(?<termi_t%u>%s)", combined->len ? "|" : "", termi.triggers->len, pattern);
+    g_array_append_val(termi.triggers, trigger);
+    g_free(pattern);
+  }
+  g_strfreev(groups);
+
+  if( termi.triggers->len > 0 ) {
+    // output is not always valid UTF-8, match bytes
+    GError *gerror = NULL;
+    termi.trigger_regex = g_regex_new(combined->str, G_REGEX_OPTIMIZE|G_REGEX_DUPNAMES|G_REGEX_RAW, 0, &gerror);
+    if( gerror ) {
+      termi_error("cannot combine triggers, triggers are disabled: %s", gerror->message);
+      g_error_free(gerror);
+    }
+  }
+  g_string_free(combined, TRUE);
+}
+
+void termi_triggers_free(void)
+{
+  if( termi.triggers != NULL ) {
+    guint i;
+    for( i=0; i<termi.triggers->len; i++ ) {
+      g_free(g_array_index(termi.triggers, TermiTrigger, i).name);
+    }
+    g_array_free(termi.triggers, TRUE);
+    termi.triggers = NULL;
+  }
+  if( termi.trigger_regex != NULL ) {
+    g_regex_unref(termi.trigger_regex);
+    termi.trigger_regex = NULL;
   }
 }
+#endif
 
 void termi_menu_popup(TermiTab *tab, const GdkEvent *ev, gboolean full)
 {
@@ -611,19 +2133,37 @@ void termi_menu_popup(TermiTab *tab, const GdkEvent *ev, gboolean full)
   // main menu
   menu_shell = GTK_MENU_SHELL(popup_menu);
   if( full ) {
-    if( termi.menu_uri != NULL ) {
-      g_free(termi.menu_uri);
-    }
+    g_free(termi.menu_match);
+    termi.menu_match = NULL;
     if( ev->type == GDK_BUTTON_PRESS ) {
-      termi.menu_uri = termi_get_cursor_uri(tab, &ev->button);
+      termi.menu_match = termi_get_cursor_match(tab, &ev->button, &termi.menu_matcher);
     }
-    if( termi.menu_uri != NULL ) {
-      TERMI_APPEND_IMAGE_MENU_ITEM(open_uri, "_Open URI...", GTK_STOCK_JUMP_TO);
-      TERMI_APPEND_IMAGE_MENU_ITEM(copy_uri, "_Copy URI", GTK_STOCK_COPY);
+    if( termi.menu_match != NULL ) {
+      gboolean is_uri = termi.menu_matcher == 0;
+      TERMI_APPEND_IMAGE_MENU_ITEM(open_match, is_uri ? "_Open URI..." : "_Open match...", GTK_STOCK_JUMP_TO);
+      TERMI_APPEND_IMAGE_MENU_ITEM(copy_match, is_uri ? "_Copy URI" : "_Copy match", GTK_STOCK_COPY);
     } else {
       TERMI_APPEND_IMAGE_MENU_ITEM(copy_selection, "_Copy", GTK_STOCK_COPY);
     }
     TERMI_APPEND_IMAGE_MENU_ITEM(paste, "_Paste", GTK_STOCK_PASTE);
+#if VTE_CHECK_VERSION(0,26,0)
+    TERMI_APPEND_IMAGE_MENU_ITEM(paste_file, "Paste _file...", GTK_STOCK_OPEN);
+    TERMI_APPEND_SEPARATOR();
+    GtkWidget *item = gtk_check_menu_item_new_with_mnemonic("_Broadcast input");
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item), tab->broadcast);
+    gtk_menu_shell_append(menu_shell, item);
+    g_signal_connect_swapped(G_OBJECT(item), "activate", G_CALLBACK(termi_menu_broadcast_cb), tab);
+    item = gtk_check_menu_item_new_with_mnemonic("_Log session");
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item), tab->log != NULL);
+    gtk_widget_set_sensitive(item, termi.log_dir != NULL);
+    gtk_menu_shell_append(menu_shell, item);
+    g_signal_connect_swapped(G_OBJECT(item), "activate", G_CALLBACK(termi_menu_log_cb), tab);
+    item = gtk_check_menu_item_new_with_mnemonic("_Record session");
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item), tab->cast != NULL);
+    gtk_widget_set_sensitive(item, termi.log_dir != NULL);
+    gtk_menu_shell_append(menu_shell, item);
+    g_signal_connect_swapped(G_OBJECT(item), "activate", G_CALLBACK(termi_menu_record_cb), tab);
+#endif
     TERMI_APPEND_SEPARATOR();
   }
   TERMI_APPEND_IMAGE_MENU_ITEM(set_tab_title, "Tab _title", GTK_STOCK_EDIT);
@@ -654,22 +2194,18 @@ void termi_set_vte_font(PangoFontDescription *font)
     }
     termi.vte_font = font;
   }
-  gint npages = gtk_notebook_get_n_pages(termi.notebook);
-  // get col,row before window is resized
-  gint col = -1;
-  gint row = -1;
-  if( npages > 0 ) {
-    TermiTab *tab = termi_tab_from_index(0);
-    col = tab->vte->column_count;
-    row = tab->vte->row_count;
-  }
-  gint i;
-  for( i=0; i<npages; i++ ) {
-    TermiTab *tab = termi_tab_from_index(i);
-    vte_terminal_set_font(tab->vte, font);
+  termi.font_serial++;
+  // apply once per frame, even when zooming repeatedly
+  if( termi.font_update_id == 0 ) {
+    termi.font_update_id = g_idle_add_full(GDK_PRIORITY_REDRAW - 10, termi_font_update_cb, NULL, NULL);
   }
-  if( npages > 0 ) {
-    termi_resize(col, row);
+}
+
+void termi_tab_apply_font(TermiTab *tab)
+{
+  if( tab->vte != NULL && tab->font_serial != termi.font_serial ) {
+    vte_terminal_set_font(tab->vte, termi.vte_font);
+    tab->font_serial = termi.font_serial;
   }
 }
 
@@ -684,163 +2220,474 @@ void termi_set_vte_colors(const GdkColor *fg, const GdkColor *bg, const GdkColor
     memcpy(&termi.vte_cursor_color, cursor, sizeof(*cursor));
   }
 
-  gint npages = gtk_notebook_get_n_pages(termi.notebook);
-  gint i;
-  for( i=0; i<npages; i++ ) {
-    TermiTab *tab = termi_tab_from_index(i);
-    vte_terminal_set_color_foreground(tab->vte, fg);
-    vte_terminal_set_color_background(tab->vte, bg);
-    vte_terminal_set_color_cursor(tab->vte, cursor);
+  GList *win_it;
+  for( win_it=termi.windows; win_it!=NULL; win_it=win_it->next ) {
+    TermiWindow *win = win_it->data;
+    gint npages = gtk_notebook_get_n_pages(win->notebook);
+    gint i;
+    for( i=0; i<npages; i++ ) {
+      TermiTab *tab = termi_tab_from_index(win, i);
+      if( tab->vte == NULL ) {
+        continue;
+      }
+      vte_terminal_set_color_foreground(tab->vte, fg);
+      vte_terminal_set_color_background(tab->vte, bg);
+      vte_terminal_set_color_cursor(tab->vte, cursor);
+    }
   }
 }
 
+void termi_scrollback_budget_apply(void)
+{
+  guint64 budget = (guint64)termi.scrollback_budget_mb << 20;
+  GList *it;
+  for( it=termi.tab_lru.head; it!=NULL; it=it->next ) {
+    TermiTab *tab = it->data;
+    if( tab->vte == NULL ) {
+      continue;  // not spawned, or hibernated
+    }
+    guint lines = termi.buffer_lines;
+    if( termi.scrollback_budget_mb > 0 ) {
+      guint64 line_size = (guint64)tab->vte->column_count * TERMI_SCROLLBACK_CELL_SIZE;
+      if( lines > budget / line_size ) {
+        lines = budget / line_size;
+      }
+      budget -= lines * line_size;
+    }
+    if( lines != tab->scrollback_lines ) {
+      if( lines < tab->scrollback_lines && termi.infinite_scrollback ) {
+        termi_tab_archive_update(tab);  // don't lose truncated lines
+      }
+      vte_terminal_set_scrollback_lines(tab->vte, lines);
+      tab->scrollback_lines = lines;
+    }
+  }
+}
 
-TermiTab *termi_tab_new(gchar *cmd, const gchar *cwd)
+void termi_debug_dump(void)
 {
-  TermiTab *tab = g_new0(TermiTab, 1);
-  tab->vte = VTE_TERMINAL(vte_terminal_new());
-  g_object_set_qdata(G_OBJECT(tab->vte), termi.quark, tab);
+  g_printerr(PROGRAM_NAME": scrollback budget: %u MiB\n", termi.scrollback_budget_mb);
+  gsize total = 0;
+  GList *it;
+  for( it=termi.tab_lru.head; it!=NULL; it=it->next ) {
+    TermiTab *tab = it->data;
+    const gchar *title = gtk_label_get_text(tab->lbl);
+    if( tab->vte == NULL ) {
+#if VTE_CHECK_VERSION(0,26,0)
+      if( tab->hibernated ) {
+        g_printerr("  %-20s hibernated, snapshot: %" G_GSIZE_FORMAT " bytes, pending: %u bytes\n",
+                   title, tab->spill_size, tab->drain->len);
+        continue;
+      }
+#endif
+      g_printerr("  %-20s not spawned\n", title);
+      continue;
+    }
+    glong lines;
+    gsize usage = termi_tab_scrollback_usage(tab, &lines);
+    total += usage;
+    g_printerr("  %-20s scrollback: %ld/%u lines, %" G_GSIZE_FORMAT " KiB",
+               title, lines, tab->scrollback_lines, usage >> 10);
+    if( tab->archive_fd != -1 ) {
+      g_printerr(", archive: %" G_GUINT64_FORMAT " lines", tab->archive_lines);
+    }
+#if VTE_CHECK_VERSION(0,26,0)
+    g_printerr(", output: %" G_GUINT64_FORMAT " bytes, %" G_GUINT64_FORMAT " reads, %" G_GUINT64_FORMAT " feeds",
+               tab->output_bytes, tab->output_reads, tab->output_feeds);
+    const TermiLatency *lat = tab->latency;
+    if( lat != NULL && lat->count > 0 ) {
+      g_printerr(", latency: %u keys, p50 %" G_GINT64_FORMAT " us, p99 %" G_GINT64_FORMAT " us, max %" G_GINT64_FORMAT " us"
+                 " (avg write %" G_GINT64_FORMAT " us, echo %" G_GINT64_FORMAT " us, draw %" G_GINT64_FORMAT " us)",
+                 lat->count, termi_tab_latency_percentile(tab, 50), termi_tab_latency_percentile(tab, 99), lat->max,
+                 lat->sum_write / lat->count, lat->sum_read / lat->count, lat->sum_draw / lat->count);
+    }
+#endif
+    g_printerr("\n");
+  }
+  g_printerr("  total scrollback: %" G_GSIZE_FORMAT " KiB\n", total >> 10);
+}
 
-  // add to the notebook
-  gchar *lbl_txt = g_strdup_printf("Term %u", termi.label_nb++);
-  GtkWidget *evbox = gtk_event_box_new();
-  tab->lbl = GTK_LABEL(gtk_label_new(lbl_txt));
-  g_free(lbl_txt);
-  gtk_container_add(GTK_CONTAINER(evbox), GTK_WIDGET(tab->lbl));
-  gint index = gtk_notebook_append_page(termi.notebook, GTK_WIDGET(tab->vte), evbox);
-  if( index == -1 ) {
-    termi_error("failed to create a new tab");
-    gtk_widget_destroy(GTK_WIDGET(tab->vte));
-    g_free(tab);
-    return NULL;
+
+void termi_tab_apply_conf(TermiTab *tab)
+{
+  VteTerminal *vte = tab->vte;
+  if( vte != NULL ) {
+    vte_terminal_set_audible_bell(vte, termi.audible_bell);
+    vte_terminal_set_visible_bell(vte, termi.visible_bell);
+    vte_terminal_set_cursor_blink_mode(vte, termi.blink_mode ? VTE_CURSOR_BLINK_ON : VTE_CURSOR_BLINK_OFF);
+    vte_terminal_set_word_chars(vte, termi.word_chars);
+    // matchers may have been reloaded
+    if( tab->match_regex != termi.match_regex ) {
+      if( tab->match_tag >= 0 ) {
+        vte_terminal_match_remove(vte, tab->match_tag);
+      }
+      if( tab->match_regex != NULL ) {
+        g_regex_unref(tab->match_regex);
+      }
+      tab->match_tag = vte_terminal_match_add_gregex(vte, termi.match_regex, 0);
+      tab->match_regex = g_regex_ref(termi.match_regex);
+    }
+#if VTE_CHECK_VERSION(0,26,0)
+    vte_terminal_search_set_wrap_around(vte, termi.search_wrap);
+#endif
   }
+  tab->conf_serial = termi.conf_serial;
+  termi_tab_apply_label_conf(tab);
+}
+
+void termi_tab_apply_label_conf(TermiTab *tab)
+{
   if(termi.adjust_tab_title_width) {
     gtk_label_set_ellipsize(tab->lbl, PANGO_ELLIPSIZE_END);
-    gtk_container_child_set(GTK_CONTAINER(termi.notebook), GTK_WIDGET(tab->vte), "tab-expand", TRUE, NULL);
+    gtk_container_child_set(GTK_CONTAINER(tab->win->notebook), tab->page, "tab-expand", TRUE, NULL);
+  } else {
+    gtk_label_set_ellipsize(tab->lbl, PANGO_ELLIPSIZE_NONE);
+    gtk_container_child_set(GTK_CONTAINER(tab->win->notebook), tab->page, "tab-expand", FALSE, NULL);
   }
+}
 
-  // split shell command, if any
-  GError *gerror = NULL;
-  char **argv = NULL;
-  if( cmd != NULL ) {
-    gint argc;
-    if( !g_shell_parse_argv(cmd, &argc, &argv, &gerror) ) {
-      termi_error("cannot parse command: %s", gerror->message);
-      cmd = NULL;
-      g_error_free(gerror);
-    }
-  }
+TermiTab *termi_tab_new(TermiWindow *win, gchar *cmd, const gchar *cwd, gboolean lazy)
+{
+  TermiTab *tab = g_new0(TermiTab, 1);
+  tab->win = win;
+  tab->pid = -1;
+  tab->match_tag = -1;
+  tab->cmd = g_strdup(cmd);
+  tab->archive_fd = -1;
+#if VTE_CHECK_VERSION(0,26,0)
+  tab->spill_fd = -1;
+#endif
 
   // get workding directory of the current tab, if any
-  gchar *wdir = cwd ? g_strdup(cwd) : NULL;
-  if(wdir == NULL) {
-    gint cur_index = gtk_notebook_get_current_page(termi.notebook);
+  tab->wdir = cwd ? g_strdup(cwd) : NULL;
+  if(tab->wdir == NULL) {
+    gint cur_index = gtk_notebook_get_current_page(win->notebook);
     if( cur_index != -1 ) {
-      TermiTab *cur_tab = termi_tab_from_index(cur_index);
-      g_assert( cur_tab->pid >= 0 );
-      gchar *p = g_strdup_printf("/proc/%d/cwd", cur_tab->pid);
-      if( p != NULL ) {
-        wdir = g_file_read_link(p, NULL); // ignore errors
-        g_free(p);
+      TermiTab *cur_tab = termi_tab_from_index(win, cur_index);
+      if( cur_tab->pid >= 0 ) {
+        gchar *p = g_strdup_printf("/proc/%d/cwd", cur_tab->pid);
+        if( p != NULL ) {
+          tab->wdir = g_file_read_link(p, NULL); // ignore errors
+          g_free(p);
+        }
+      } else {
+        tab->wdir = g_strdup(cur_tab->wdir);
       }
     }
   }
 
-  // run the command
-#if VTE_CHECK_VERSION(0,26,0)
-  char *argv2[2] = { NULL, NULL };
-  char *cmd_alloc = NULL;
-  if( cmd == NULL ) {
-#if VTE_CHECK_VERSION(0,28,0)
-    cmd_alloc = vte_get_user_shell();
-    cmd = cmd_alloc;
-#else
-    cmd = g_getenv("SHELL");
-#endif
-    if( cmd == NULL ) {
-      cmd = "/bin/sh";
+  // the terminal is added to the page when spawned
+  tab->page = gtk_vbox_new(FALSE, 0);
+  // tab is freed along with its page
+  g_object_set_qdata_full(G_OBJECT(tab->page), termi.quark, tab, (GDestroyNotify)termi_tab_free);
+  tab->placeholder = GTK_LABEL(gtk_label_new("Starting..."));
+  gtk_box_pack_start(GTK_BOX(tab->page), GTK_WIDGET(tab->placeholder), TRUE, TRUE, 0);
+  // moved to the head when selected
+  g_queue_push_tail(&termi.tab_lru, tab);
+  tab->lru_link = g_queue_peek_tail_link(&termi.tab_lru);
+  if( lazy ) {
+    g_queue_push_tail(&termi.lazy_tabs, tab);
+    tab->lazy_link = g_queue_peek_tail_link(&termi.lazy_tabs);
+    if( termi.lazy_tabs_id == 0 ) {
+      termi.lazy_tabs_id = g_idle_add_full(G_PRIORITY_LOW, termi_lazy_tabs_cb, NULL, NULL);
     }
-    argv2[0] = cmd;
-    argv = argv2;
   }
-  gboolean gret = vte_terminal_fork_command_full(
-      tab->vte,
-      VTE_PTY_NO_LASTLOG|VTE_PTY_NO_UTMP|VTE_PTY_NO_WTMP|VTE_PTY_NO_HELPER,
-      wdir, argv, NULL,
-      G_SPAWN_CHILD_INHERITS_STDIN|G_SPAWN_SEARCH_PATH, NULL, NULL, &tab->pid, &gerror);
-  g_free(cmd_alloc);
-#else
-  tab->pid = vte_terminal_fork_command(tab->vte, argv==NULL?NULL:argv[0], argv, NULL,
-                                       wdir, FALSE, FALSE, FALSE);
-  gboolean gret = tab->pid >= 0;
-#endif
-  g_free(wdir);
 
-  if( !gret ) {
-#if VTE_CHECK_VERSION(0,26,0)
-    termi_error("cannot run tab command: %s", gerror->message);
+  // add to the notebook
+  gchar *lbl_txt = g_strdup_printf("Term %u", termi.label_nb++);
+  GtkWidget *evbox = gtk_event_box_new();
+  tab->lbl = GTK_LABEL(gtk_label_new(lbl_txt));
+  g_free(lbl_txt);
+  gtk_container_add(GTK_CONTAINER(evbox), GTK_WIDGET(tab->lbl));
+  gint index = gtk_notebook_append_page(win->notebook, tab->page, evbox);
+  if( index == -1 ) {
+    termi_error("failed to create a new tab");
+    gtk_widget_destroy(tab->page);
+    return NULL;
+  }
+  gtk_notebook_set_tab_reorderable(win->notebook, tab->page, TRUE);
+  g_signal_connect(G_OBJECT(evbox), "button-press-event", G_CALLBACK(termi_tablbl_button_press_event_cb), tab);
+
+  // various configurable options
+  if( !termi.show_single_tab && gtk_notebook_get_n_pages(win->notebook) == 1 ) {
+    gtk_notebook_set_show_tabs(win->notebook, FALSE);
+  } else {
+    gtk_notebook_set_show_tabs(win->notebook, TRUE);
+  }
+  termi_tab_apply_conf(tab);
+
+  gtk_widget_show_all(evbox);
+  gtk_widget_show_all(tab->page);
+
+  if( lazy ) {
+    return tab;
+  }
+  if( !termi_tab_spawn(tab) ) {
+    gtk_notebook_remove_page(win->notebook, index);  // also frees the tab
+    return NULL;
+  }
+  termi_tab_focus(tab);
+
+  return tab;
+}
+
+gboolean termi_tab_spawn(TermiTab *tab)
+{
+  if( tab->vte != NULL ) {
+    return TRUE; // already spawned
+  }
+  if( tab->lazy_link != NULL ) {
+    g_queue_delete_link(&termi.lazy_tabs, tab->lazy_link);
+    tab->lazy_link = NULL;
+  }
+  tab->vte = VTE_TERMINAL(vte_terminal_new());
+  g_object_set_qdata(G_OBJECT(tab->vte), termi.quark, tab);
+
+  // split shell command, if any
+  gchar *cmd = tab->cmd;
+  GError *gerror = NULL;
+  char **argv = NULL;
+  if( cmd != NULL ) {
+    gint argc;
+    if( !g_shell_parse_argv(cmd, &argc, &argv, &gerror) ) {
+      termi_error("cannot parse command: %s", gerror->message);
+      cmd = NULL;
+      g_error_free(gerror);
+      gerror = NULL;
+    }
+  }
+  const gchar *wdir = tab->wdir;
+
+  // run the command
+#if VTE_CHECK_VERSION(0,26,0)
+  gboolean gret;
+  TermiPooledShell *shell = cmd == NULL ? termi_shell_pool_pop(wdir) : NULL;
+  if( shell != NULL ) {
+    // use a ready shell
+    tab->pty = shell->pty;
+    tab->pid = shell->pid;
+    g_free(shell->wdir);
+    g_free(shell);
+    gret = TRUE;
+  } else {
+    char *argv2[2] = { NULL, NULL };
+    if( cmd == NULL ) {
+      argv2[0] = termi_get_user_shell();
+    }
+    gret = termi_spawn(cmd == NULL ? argv2 : argv, wdir, &tab->pty, &tab->pid, &gerror);
+    g_free(argv2[0]);
+  }
+  if( gret ) {
+    // the pty is not given to the terminal: output goes through termi_tab_output()
+    termi_tab_tap_start(tab);
+    if( termi.log_new_tabs && termi.log_dir != NULL ) {
+      tab->log = termi_log_new(tab, FALSE);
+    }
+    // watch the child ourselves: the terminal would kill it when freed
+    tab->child_watch_id = g_child_watch_add(tab->pid, (GChildWatchFunc)termi_tab_child_watch_cb, tab);
+  }
+  termi_shell_pool_refill();
+#else
+  tab->pid = vte_terminal_fork_command(tab->vte, argv==NULL?NULL:argv[0], argv, NULL,
+                                       wdir, FALSE, FALSE, FALSE);
+  gboolean gret = tab->pid >= 0;
+#endif
+  g_strfreev(argv);
+
+  if( !gret ) {
+#if VTE_CHECK_VERSION(0,26,0)
+    termi_error("cannot run tab command: %s", gerror->message);
     g_error_free(gerror);
 #else
     termi_error("cannot run tab command");
 #endif
-    gtk_notebook_remove_page(termi.notebook, index);
     gtk_widget_destroy(GTK_WIDGET(tab->vte));
-    g_free(tab);
-    return NULL;
+    tab->vte = NULL;
+    tab->pid = -1;
+    gtk_label_set_text(tab->placeholder, "Cannot run tab command");
+    return FALSE;
+  }
+
+  termi_tab_attach_vte(tab);
+#if VTE_CHECK_VERSION(0,26,0)
+  if( tab->restore_file != NULL ) {
+    termi_tab_restore_scrollback(tab);
   }
+  if( tab != tab->win->cur_tab ) {
+    termi_tab_hibernate_schedule(tab);
+  }
+#endif
+  return TRUE;
+}
+
+void termi_tab_attach_vte(TermiTab *tab)
+{
+  // replace the placeholder
+  gtk_widget_destroy(GTK_WIDGET(tab->placeholder));
+  tab->placeholder = NULL;
+  gtk_box_pack_start(GTK_BOX(tab->page), GTK_WIDGET(tab->vte), TRUE, TRUE, 0);
 
-  gtk_notebook_set_tab_reorderable(termi.notebook, GTK_WIDGET(tab->vte), TRUE);
   vte_terminal_set_mouse_autohide(tab->vte, TRUE);
-  tab->uri_regex_tag = vte_terminal_match_add_gregex(tab->vte, termi.uri_regex, 0);
+  // added by termi_tab_apply_conf()
+  tab->match_tag = -1;
+  if( tab->match_regex != NULL ) {
+    g_regex_unref(tab->match_regex);
+    tab->match_regex = NULL;
+  }
 
   // setup signals
+#if VTE_CHECK_VERSION(0,26,0)
+  g_signal_connect(G_OBJECT(tab->vte), "commit", G_CALLBACK(termi_tab_commit_cb), NULL);
+  g_signal_connect_after(G_OBJECT(tab->vte), "size-allocate", G_CALLBACK(termi_tab_size_allocate_cb), NULL);
+  g_signal_connect_after(G_OBJECT(tab->vte), "expose-event", G_CALLBACK(termi_tab_expose_event_cb), NULL);
+  g_signal_connect(G_OBJECT(vte_terminal_get_adjustment(tab->vte)), "value-changed", G_CALLBACK(termi_tab_adjustment_value_changed_cb), tab);
+  termi_tab_search_hits_clear(tab);
+#else
   g_signal_connect(G_OBJECT(tab->vte), "child-exited", G_CALLBACK(termi_tab_child_exited_cb), NULL);
   g_signal_connect(G_OBJECT(tab->vte), "eof", G_CALLBACK(termi_tab_eof_cb), NULL);
+#endif
   g_signal_connect(G_OBJECT(tab->vte), "beep", G_CALLBACK(termi_tab_beep_cb), NULL);
   g_signal_connect(G_OBJECT(tab->vte), "window-title-changed", G_CALLBACK(termi_tab_window_title_changed_cb), NULL);
+  g_signal_connect(G_OBJECT(tab->vte), "contents-changed", G_CALLBACK(termi_tab_contents_changed_cb), NULL);
   g_signal_connect(G_OBJECT(tab->vte), "decrease-font-size", G_CALLBACK(termi_tab_decrease_font_size_cb), NULL);
   g_signal_connect(G_OBJECT(tab->vte), "increase-font-size", G_CALLBACK(termi_tab_increase_font_size_cb), NULL);
   g_signal_connect(G_OBJECT(tab->vte), "button-press-event", G_CALLBACK(termi_tab_button_press_event_cb), NULL);
-  g_signal_connect(G_OBJECT(evbox), "button-press-event", G_CALLBACK(termi_tablbl_button_press_event_cb), tab);
 
-  // various configurable options
-  if( !termi.show_single_tab && gtk_notebook_get_n_pages(termi.notebook) == 1 ) {
-    gtk_notebook_set_show_tabs(termi.notebook, FALSE);
-  } else {
-    gtk_notebook_set_show_tabs(termi.notebook, TRUE);
-  }
-  vte_terminal_set_audible_bell(tab->vte, termi.audible_bell);
-  vte_terminal_set_visible_bell(tab->vte, termi.visible_bell);
-  vte_terminal_set_cursor_blink_mode(tab->vte, termi.blink_mode ? VTE_CURSOR_BLINK_ON : VTE_CURSOR_BLINK_OFF);
-  vte_terminal_set_scrollback_lines(tab->vte, termi.buffer_lines);
-  vte_terminal_set_word_chars(tab->vte, termi.word_chars);
-#if VTE_CHECK_VERSION(0,26,0)
-  vte_terminal_search_set_wrap_around(tab->vte, termi.search_wrap);
-#endif
+  termi_tab_apply_conf(tab);
+  tab->scrollback_lines = 0;
+  termi_scrollback_budget_apply();
   vte_terminal_set_font(tab->vte, termi.vte_font);
+  tab->font_serial = termi.font_serial;
   vte_terminal_set_color_foreground(tab->vte, &termi.vte_fg_color);
   vte_terminal_set_color_background(tab->vte, &termi.vte_bg_color);
   if( !termi.vte_cursor_color_default ) {
     vte_terminal_set_color_cursor(tab->vte, &termi.vte_cursor_color);
   }
+#if VTE_CHECK_VERSION(0,26,0)
+  if( termi.search_regex ) {
+    vte_terminal_search_set_gregex(tab->vte, termi.search_regex);
+  }
+#endif
 
-  gtk_widget_show_all(evbox);
   gtk_widget_show_all(GTK_WIDGET(tab->vte));
+}
 
-  termi_tab_focus(tab);
-
-  return tab;
+void termi_tab_free(TermiTab *tab)
+{
+  if( tab->lazy_link != NULL ) {
+    g_queue_delete_link(&termi.lazy_tabs, tab->lazy_link);
+  }
+  g_queue_delete_link(&termi.tab_lru, tab->lru_link);
+#if VTE_CHECK_VERSION(0,26,0)
+  if( termi.bench != NULL ) {
+    termi_bench_tab_done(tab);
+  }
+  if( termi.replay != NULL && termi.replay->tab == tab ) {
+    termi.replay->tab = NULL;
+  }
+  if( tab->child_watch_id != 0 ) {
+    // the child is hung up when the pty is closed, still reap it
+    g_source_remove(tab->child_watch_id);
+    g_child_watch_add(tab->pid, termi_child_reap_cb, NULL);
+  }
+  if( tab->hibernate_id != 0 ) {
+    g_source_remove(tab->hibernate_id);
+  }
+  if( tab->tap_id != 0 ) {
+    g_source_remove(tab->tap_id);
+  }
+  if( tab->throttle_id != 0 ) {
+    g_source_remove(tab->throttle_id);
+  }
+  if( tab->throttled != NULL ) {
+    g_byte_array_free(tab->throttled, TRUE);
+  }
+  g_free(tab->latency);
+  termi_tab_search_hits_clear(tab);
+  if( tab->trigger_times != NULL ) {
+    g_hash_table_destroy(tab->trigger_times);
+  }
+  if( tab->trigger_line != NULL ) {
+    g_string_free(tab->trigger_line, TRUE);
+  }
+  if( tab->fg_check_id != 0 ) {
+    g_source_remove(tab->fg_check_id);
+  }
+  g_free(tab->fg_command);
+  g_free(tab->session_file);
+  g_free(tab->restore_file);
+  if( tab->broadcast ) {
+    g_ptr_array_remove_fast(termi.broadcast, tab);
+  }
+  if( termi.typing_tab == tab ) {
+    termi.typing_tab = NULL;
+  }
+  if( tab->log != NULL ) {
+    termi_log_close(tab->log);
+  }
+  if( tab->cast != NULL ) {
+    termi_log_close(tab->cast);
+  }
+  // don't write to the tab anymore
+  GList *tab_it;
+  for( tab_it=termi.tab_lru.head; tab_it!=NULL; tab_it=tab_it->next ) {
+    TermiTab *other = tab_it->data;
+    if( other->paste != NULL ) {
+      g_ptr_array_remove(other->paste->bracketed, tab);
+    }
+  }
+  if( tab->paste != NULL ) {
+    // progress bar is destroyed along with the page
+    if( tab->paste->id != 0 ) {
+      g_source_remove(tab->paste->id);
+    }
+    g_ptr_array_remove(tab->paste->bracketed, tab);
+    termi_paste_end(tab->paste);
+    g_object_unref(tab->paste->stream);
+    g_free(tab->paste);
+  }
+  if( tab->input_id != 0 ) {
+    g_source_remove(tab->input_id);
+  }
+  if( tab->input != NULL ) {
+    g_byte_array_free(tab->input, TRUE);
+  }
+  if( tab->drain != NULL ) {
+    g_byte_array_free(tab->drain, TRUE);
+  }
+  if( tab->spill_fd != -1 ) {
+    close(tab->spill_fd);
+  }
+  if( tab->pty != NULL ) {
+    g_object_unref(tab->pty);
+  }
+#endif
+  if( tab->archive_fd != -1 ) {
+    // closed after queued writes
+    TermiArchiveChunk *chunk = g_new0(TermiArchiveChunk, 1);
+    chunk->fd = tab->archive_fd;
+    termi_archive_push(chunk);
+    g_array_free(tab->archive_index, TRUE);
+    g_array_free(tab->archive_marks, TRUE);
+  }
+  if( tab->match_regex != NULL ) {
+    g_regex_unref(tab->match_regex);
+  }
+  g_free(tab->cmd);
+  g_free(tab->wdir);
+  g_free(tab);
 }
 
 void termi_tab_del(TermiTab *tab)
 {
-  gint index = gtk_notebook_page_num(termi.notebook, GTK_WIDGET(tab->vte));
+  TermiWindow *win = tab->win;
+  gint index = gtk_notebook_page_num(win->notebook, tab->page);
   g_assert( index != -1 );
 
   // check for running processes
   if( termi_tab_has_running_processes(tab) ) {
     GtkWidget *dlg = gtk_message_dialog_new(
-        termi.winmain, GTK_DIALOG_MODAL, GTK_MESSAGE_QUESTION, GTK_BUTTONS_NONE,
+        win->winmain, GTK_DIALOG_MODAL, GTK_MESSAGE_QUESTION, GTK_BUTTONS_NONE,
         "There are processes still running.\nClose anyway?");
     gtk_dialog_add_buttons(GTK_DIALOG(dlg),
                            GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
@@ -857,22 +2704,23 @@ void termi_tab_del(TermiTab *tab)
   // removing the page will modify cur_tab/prev_tab,
   // so memorize the next candidate now 
   TermiTab *next_tab = NULL;
-  if( termi.cur_tab == tab ) {
-    termi.cur_tab = NULL;
-    next_tab = termi.prev_tab;
+  if( win->cur_tab == tab ) {
+    win->cur_tab = NULL;
+    next_tab = win->prev_tab;
   }
-  if( termi.prev_tab == tab ) {
-    termi.prev_tab = NULL;
+  if( win->prev_tab == tab ) {
+    win->prev_tab = NULL;
   }
 
-  gtk_notebook_remove_page(termi.notebook, index);
-  if( gtk_notebook_get_n_pages(termi.notebook) == 0 ) {
-    termi_quit();
+  // note: tab is freed along with its widget
+  gtk_notebook_remove_page(win->notebook, index);
+  if( gtk_notebook_get_n_pages(win->notebook) == 0 ) {
+    termi_window_close(win);
     return;
   }
 
-  if( !termi.show_single_tab && gtk_notebook_get_n_pages(termi.notebook) == 1 ) {
-    gtk_notebook_set_show_tabs(termi.notebook, FALSE);
+  if( !termi.show_single_tab && gtk_notebook_get_n_pages(win->notebook) == 1 ) {
+    gtk_notebook_set_show_tabs(win->notebook, FALSE);
   }
 
   // focus new tab if needed
@@ -883,20 +2731,30 @@ void termi_tab_del(TermiTab *tab)
 
 void termi_tab_focus(TermiTab *tab)
 {
-  TermiTab *old_tab = termi_tab_from_index(gtk_notebook_get_current_page(termi.notebook));
+  TermiWindow *win = tab->win;
+  TermiTab *old_tab = termi_window_get_cur_tab(win);
   gint index = termi_tab_get_index(tab);
-  gtk_notebook_set_current_page(termi.notebook, index);
-  gtk_widget_grab_focus(GTK_WIDGET(tab->vte));
+  gtk_notebook_set_current_page(win->notebook, index);
+  if( tab->vte != NULL ) {
+    gtk_widget_grab_focus(GTK_WIDGET(tab->vte));
+  }
   if( old_tab != tab ) {
-    termi.prev_tab = old_tab;
+    win->prev_tab = old_tab;
   }
 }
 
-void termi_tab_focus_rel(int n)
+void termi_tab_focus_rel(TermiWindow *win, int n)
+{
+  gint new_index = ( gtk_notebook_get_current_page(win->notebook) + n )
+      % gtk_notebook_get_n_pages(win->notebook);
+  termi_tab_focus(termi_tab_from_index(win, new_index));
+}
+
+void termi_tab_focus_nth(TermiWindow *win, int n)
 {
-  gint new_index = ( gtk_notebook_get_current_page(termi.notebook) + n )
-      % gtk_notebook_get_n_pages(termi.notebook);
-  termi_tab_focus(termi_tab_from_index(new_index));
+  if( n < gtk_notebook_get_n_pages(win->notebook) ) {
+    termi_tab_focus(termi_tab_from_index(win, n));
+  }
 }
 
 gboolean termi_tab_has_running_processes(TermiTab *tab)
@@ -905,7 +2763,7 @@ gboolean termi_tab_has_running_processes(TermiTab *tab)
     return FALSE;
   }
 #if VTE_CHECK_VERSION(0,26,0)
-  int pty_fd = vte_pty_get_fd(vte_terminal_get_pty_object(tab->vte));
+  int pty_fd = vte_pty_get_fd(tab->pty);
 #else
   int pty_fd = vte_terminal_get_pty(tab->vte);
 #endif
@@ -913,727 +2771,4652 @@ gboolean termi_tab_has_running_processes(TermiTab *tab)
   return ( pgid == -1 || pgid != tab->pid );
 }
 
-void termi_tab_set_title(TermiTab *tab, const gchar *title)
-{
-  //XXX truncate title if too long?
-  gtk_label_set_text(tab->lbl, title);
-}
-
-
-gchar *termi_get_cursor_uri(const TermiTab *tab, const GdkEventButton *ev)
+#if VTE_CHECK_VERSION(0,26,0)
+void termi_tab_fg_update(TermiTab *tab)
 {
-  glong col = ev->x / vte_terminal_get_char_width(tab->vte);
-  glong row = ev->y / vte_terminal_get_char_height(tab->vte);
-  int tag = -1;
-  gchar *s = vte_terminal_match_check(tab->vte, col, row, &tag);
-  if( s == NULL || tag != tab->uri_regex_tag ) {
-    g_free(s);
-    return NULL;
+  if( tab->pty == NULL || tab->pid < 0 ) {
+    return;
   }
-  return s;
-}
-
-void termi_open_uri(gchar *uri)
-{
-  static const char *browser_exec[] = {
-    "xdg-open", "x-www-browser", "www-browser", NULL
-  };
-  gchar *browser = NULL;
-  const char **it;
-  for( it=browser_exec; *it != NULL; it++ ) {
-    browser = g_find_program_in_path(*it);
-    if( browser != NULL ) {
-      break;
+  pid_t pgid = tcgetpgrp(vte_pty_get_fd(tab->pty));
+  if( pgid == tab->fg_pgid ) {
+    return;
+  }
+  tab->fg_pgid = pgid;
+  // commands may hand over to each other (e.g. "make && make install"),
+  // they are done only when the shell is back in foreground
+  gboolean done = pgid == tab->pid || pgid <= 0;
+  if( done && tab->fg_command != NULL && termi.command_notify_delay > 0 ) {
+    gint64 duration = g_get_monotonic_time() - tab->fg_start;
+    if( duration >= (gint64)termi.command_notify_delay * G_USEC_PER_SEC ) {
+      gchar duration_s[32];
+      termi_format_duration(duration, duration_s, sizeof(duration_s));
+      gchar *summary = g_strdup_printf("%s: %s finished", gtk_label_get_text(tab->lbl), tab->fg_command);
+      gchar *body = g_strdup_printf("Ran for %s", duration_s);
+      termi_tab_alert(tab, summary, body);
+      g_free(body);
+      g_free(summary);
     }
   }
-  if( browser == NULL ) {
-    termi_error("cannot find a browser");
+  if( tab->fg_command == NULL ) {
+    tab->fg_start = g_get_monotonic_time();
   }
-  gchar *argv[] = { browser, uri, NULL };
-  GError *gerror = NULL;
-  if( !g_spawn_async(NULL, argv, NULL, 0, NULL, NULL, NULL, &gerror) ) {
-    termi_error("failed to open URI: %s", gerror->message);
+  g_free(tab->fg_command);
+  tab->fg_command = NULL;
+  if( !done ) {
+    // the group leader is the command started by the shell
+    gchar *path = g_strdup_printf("/proc/%d/comm", pgid);
+    if( g_file_get_contents(path, &tab->fg_command, NULL, NULL) ) {
+      g_strchomp(tab->fg_command);
+    } else {
+      tab->fg_command = g_strdup_printf("%d", pgid);  // already exited, or no procfs
+    }
+    g_free(path);
   }
-  g_free(browser);
+  gtk_widget_set_tooltip_text(GTK_WIDGET(tab->lbl), tab->fg_command);
 }
 
-#if VTE_CHECK_VERSION(0,26,0)
-
-gboolean termi_search_modify(void)
+gboolean termi_tab_alert(TermiTab *tab, const gchar *summary, const gchar *body)
 {
-  GtkDialog *dlg = GTK_DIALOG(gtk_dialog_new_with_buttons(
-      "Find regex", termi.winmain, GTK_DIALOG_MODAL,
-      GTK_STOCK_CANCEL, GTK_RESPONSE_REJECT,
-      GTK_STOCK_OK, GTK_RESPONSE_ACCEPT, NULL));
-  gtk_dialog_set_default_response(dlg, GTK_RESPONSE_ACCEPT);
-
-  GtkEntry *entry = GTK_ENTRY(gtk_entry_new());
-  if( termi.search_regex ) {
-    gtk_entry_set_text(entry, g_regex_get_pattern(termi.search_regex));
+  TermiWindow *win = tab->win;
+  gboolean active = gtk_window_is_active(win->winmain);
+  if( active && termi_tab_is_visible(tab) ) {
+    return FALSE;  // already under the eyes of the user
   }
-  gtk_entry_set_activates_default(entry, TRUE);
-  GtkWidget *check = gtk_check_button_new_with_label("Wrap around");
-  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(check), termi.search_wrap);
-
-  gtk_box_pack_start(GTK_BOX(dlg->vbox), GTK_WIDGET(entry), TRUE, TRUE, 5);
-  gtk_box_pack_start(GTK_BOX(dlg->vbox), check, FALSE, FALSE, 5);
-  gtk_widget_show_all(dlg->vbox);
-
-  g_signal_connect(G_OBJECT(entry), "changed", G_CALLBACK(termi_dlgfind_entry_changed_cb), dlg);
-
-  gboolean ret = gtk_dialog_run(dlg) == GTK_RESPONSE_ACCEPT;
-  if( ret ) {
-    if( termi.search_regex ) {
-      g_regex_unref(termi.search_regex);
-    }
-    termi.search_regex = NULL;
-    const gchar *txt = gtk_entry_get_text(entry);
-    if( *txt != '\0' ) {
-      // should not fail: checked in termi_dlgfind_entry_changed_cb()
-      termi.search_regex = g_regex_new(txt, 0, 0, NULL);
-    }
-    termi.search_wrap = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(check));
-
-    gint npages = gtk_notebook_get_n_pages(termi.notebook);
-    gint i;
-    for( i=0; i<npages; i++ ) {
-      TermiTab *tab = termi_tab_from_index(i);
-      vte_terminal_search_set_gregex(tab->vte, termi.search_regex);
-    }
+  if( !active ) {
+    gtk_window_set_urgency_hint(win->winmain, TRUE);
   }
-  gtk_widget_destroy(GTK_WIDGET(dlg));
-  return ret;
+  if( body == NULL ) {
+    return TRUE;
+  }
+  gchar *notifier = g_find_program_in_path("notify-send");
+  if( notifier == NULL ) {
+    return TRUE;  // not an error, the urgency hint is enough
+  }
+  // servers may interpret markup, titles and commands are arbitrary text
+  gchar *summary_markup = g_markup_escape_text(summary, -1);
+  gchar *markup = g_markup_escape_text(body, -1);
+  gchar *argv[] = { notifier, "-a", PROGRAM_NAME, "-i", TERMI_ICON_NAME, summary_markup, markup, NULL };
+  GError *gerror = NULL;
+  if( !g_spawn_async(NULL, argv, NULL, 0, NULL, NULL, NULL, &gerror) ) {
+    termi_error("failed to show notification: %s", gerror->message);
+    g_error_free(gerror);
+  }
+  g_free(markup);
+  g_free(summary_markup);
+  g_free(notifier);
+  return TRUE;
 }
 
-void termi_search_find(const TermiTab *tab, int way)
+void termi_format_duration(gint64 duration, gchar *buf, gsize size)
 {
-  if( way > 0 ) {
-    vte_terminal_search_find_next(tab->vte);
-  } else if( way < 0 ) {
-    vte_terminal_search_find_previous(tab->vte);
+  gint64 sec = duration / G_USEC_PER_SEC;
+  if( sec >= 3600 ) {
+    g_snprintf(buf, size, "%dh%02dm", (int)(sec / 3600), (int)(sec / 60 % 60));
+  } else if( sec >= 60 ) {
+    g_snprintf(buf, size, "%dm%02ds", (int)(sec / 60), (int)(sec % 60));
   } else {
-    g_assert(FALSE);
+    g_snprintf(buf, size, "%ds", (int)sec);
   }
 }
-
 #endif
 
-
-void termi_winmain_destroy_cb(GtkWindow *winmain, void *data)
+void termi_tab_set_title(TermiTab *tab, const gchar *title)
 {
-  termi_quit();
+  //XXX truncate title if too long?
+  gtk_label_set_text(tab->lbl, title);
 }
 
-gboolean termi_winmain_delete_event_cb(GtkWindow *winmain, GdkEvent *ev, void *data)
+gsize termi_tab_scrollback_usage(TermiTab *tab, glong *lines)
 {
-  // check for running processes
-  gint npages = gtk_notebook_get_n_pages(termi.notebook);
-  gint i;
-  for( i=0; i<npages; i++ ) {
-    TermiTab *tab = termi_tab_from_index(i);
-    if( termi_tab_has_running_processes(tab) ) {
-      GtkWidget *dlg = gtk_message_dialog_new(
-          winmain, GTK_DIALOG_MODAL, GTK_MESSAGE_QUESTION, GTK_BUTTONS_NONE,
-          "There are processes still running.\nQuit anyway?");
-      gtk_dialog_add_buttons(GTK_DIALOG(dlg),
-                             GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
-                             GTK_STOCK_QUIT, GTK_RESPONSE_ACCEPT,
-                             NULL);
-      gtk_dialog_set_default_response(GTK_DIALOG(dlg), GTK_RESPONSE_ACCEPT);
-      gint response = gtk_dialog_run(GTK_DIALOG(dlg));
-      gtk_widget_destroy(dlg);
-      if( response == GTK_RESPONSE_ACCEPT ) {
-        return FALSE;
-      } else {
-        return TRUE;
-      }
-    }
+  GtkAdjustment *adj = vte_terminal_get_adjustment(tab->vte);
+  glong n = gtk_adjustment_get_upper(adj) - gtk_adjustment_get_lower(adj) - tab->vte->row_count;
+  if( n < 0 ) {
+    n = 0;
   }
-  return FALSE; // quit
+  if( lines != NULL ) {
+    *lines = n;
+  }
+  return (gsize)n * tab->vte->column_count * TERMI_SCROLLBACK_CELL_SIZE;
 }
 
-gboolean termi_winmain_key_press_event_cb(GtkWindow *winmain, GdkEventKey *ev, void *data)
+void termi_tab_archive_update(TermiTab *tab)
 {
-  if( ev->type != GDK_KEY_PRESS ) {
-    return FALSE; // should not happen
+  VteTerminal *vte = tab->vte;
+  GtkAdjustment *adj = vte_terminal_get_adjustment(vte);
+  glong first_row = gtk_adjustment_get_lower(adj);
+  glong end_row = gtk_adjustment_get_upper(adj) - vte->row_count;
+  if( tab->archive_row < first_row ) {
+    // rows dropped by the terminal before being archived
+    tab->archive_row = first_row;
   }
-  TermiKeyBinding kb = { ev->state & gtk_accelerator_get_default_mod_mask(), ev->keyval };
-  if( kb.key >= 'A' && kb.key <= 'Z' ) {
-    kb.key |= 0x20;
-  }
-#define TERMI_CHECK_KB(n,k,dm,dk) \
-  if( kb.mod == termi.kb_##n.mod && kb.key == termi.kb_##n.key ) { \
-    termi_kb_##n##_cb(); \
-  } else
-  TERMI_KEY_BINDINGS_APPLY(TERMI_CHECK_KB)
-#undef TERMI_CHECK_KB
-  if( kb.mod == 0 && kb.key == GDK_Menu ) {  // note: par of a "else if"
-    TermiTab *tab = termi_tab_from_index(gtk_notebook_get_current_page(termi.notebook));
-    termi_menu_popup(tab, (GdkEvent *)ev, TRUE);
-  } else { // follow a "else"
-    return FALSE;
+  if( end_row <= tab->archive_row ) {
+    return;
   }
-  return TRUE; // handled
-}
 
-gboolean termi_winmain_focus_in_event_cb(GtkWindow *winmain, GdkEvent *ev, void *data)
-{
-  gtk_window_set_urgency_hint(winmain, FALSE);
-  return FALSE;
-}
+  if( tab->archive_fd == -1 ) {
+    gchar *archive_path = NULL;
+    GError *gerror = NULL;
+    tab->archive_fd = g_file_open_tmp(PROGRAM_NAME"-XXXXXX", &archive_path, &gerror);
+    if( tab->archive_fd == -1 ) {
+      termi_error("cannot create scrollback archive: %s", gerror->message);
+      g_error_free(gerror);
+      tab->archive_row = end_row;
+      return;
+    }
+    unlink(archive_path);
+    g_free(archive_path);
+    tab->archive_size = 0;
+    tab->archive_lines = 0;
+    tab->archive_index = g_array_new(FALSE, FALSE, sizeof(guint64));
+    g_array_append_val(tab->archive_index, tab->archive_size);
+    tab->archive_marks = g_array_new(FALSE, FALSE, sizeof(TermiArchiveMark));
+    if( termi.archive_pool == NULL ) {
+      termi.archive_pool = g_thread_pool_new((GFunc)termi_archive_write_cb, NULL, 1, FALSE, NULL);
+#if GLIB_CHECK_VERSION(2,32,0)
+      // statically allocated, no need to initialize them
+      termi.archive_mutex = &termi.archive_mutex_data;
+      termi.archive_cond = &termi.archive_cond_data;
+#else
+      termi.archive_mutex = g_mutex_new();
+      termi.archive_cond = g_cond_new();
+#endif
+    }
+  }
 
-void termi_notebook_switch_page_cb(GtkNotebook *notebook, gpointer ptr, gint index, void *data)
-{
-  TermiTab *tab = termi_tab_from_index(index);
-  if( tab == termi.cur_tab ) {
+  gchar *text = vte_terminal_get_text_range(vte, tab->archive_row, 0, end_row - 1, vte->column_count - 1,
+                                            NULL, NULL, NULL);
+  if( text == NULL ) {
     return;
   }
-  termi.prev_tab = termi.cur_tab;
-  termi.cur_tab = tab;
-}
+  gsize len = strlen(text);
+
+  TermiArchiveMark mark = { tab->archive_row, tab->archive_size };
+  g_array_append_val(tab->archive_marks, mark);
+  const gchar *eol;
+  for( eol=memchr(text, '\n', len); eol!=NULL; eol=memchr(eol+1, '\n', text+len-eol-1) ) {
+    if( ++tab->archive_lines % TERMI_ARCHIVE_INDEX_STEP == 0 ) {
+      guint64 offset = tab->archive_size + (eol - text) + 1;
+      g_array_append_val(tab->archive_index, offset);
+    }
+  }
 
+  // the text is written by the writer thread, don't block the main loop on disk
+  TermiArchiveChunk *chunk = g_new(TermiArchiveChunk, 1);
+  chunk->fd = tab->archive_fd;
+  chunk->offset = tab->archive_size;
+  chunk->text = text;
+  chunk->len = len;
+  termi_archive_push(chunk);
+  tab->archive_size += len;
+  tab->archive_row = end_row;
+
+  // forget marks of rows dropped by the terminal, keep the one just before
+  guint n = 0;
+  while( n+1 < tab->archive_marks->len &&
+        g_array_index(tab->archive_marks, TermiArchiveMark, n+1).row <= first_row ) {
+    n++;
+  }
+  g_array_remove_range(tab->archive_marks, 0, n);
+}
 
-void termi_menu_open_uri_cb(TermiTab *tab, GtkMenuItem *item)
+void termi_archive_write_cb(TermiArchiveChunk *chunk, void *data)
 {
-  if( termi.menu_uri != NULL ) { // should always be true
-    termi_open_uri(termi.menu_uri);
+  if( chunk->text == NULL ) {
+    close(chunk->fd);
+  } else {
+    gsize pos = 0;
+    while( pos < chunk->len ) {
+      ssize_t n = pwrite(chunk->fd, chunk->text + pos, chunk->len - pos, chunk->offset + pos);
+      if( n == -1 && errno != EINTR ) {
+        termi_error("cannot write scrollback archive: %s", g_strerror(errno));
+        break;
+      } else if( n > 0 ) {
+        pos += n;
+      }
+    }
+    g_free(chunk->text);
   }
+  g_free(chunk);
+  g_mutex_lock(termi.archive_mutex);
+  if( --termi.archive_pending == 0 ) {
+    g_cond_broadcast(termi.archive_cond);
+  }
+  g_mutex_unlock(termi.archive_mutex);
 }
 
-void termi_menu_copy_uri_cb(TermiTab *tab, GtkMenuItem *item)
+void termi_archive_push(TermiArchiveChunk *chunk)
 {
-  if( termi.menu_uri != NULL ) { // should always be true
-    gtk_clipboard_set_text(gtk_clipboard_get(GDK_SELECTION_CLIPBOARD), termi.menu_uri, -1);
-  }
+  g_mutex_lock(termi.archive_mutex);
+  termi.archive_pending++;
+  g_mutex_unlock(termi.archive_mutex);
+  g_thread_pool_push(termi.archive_pool, chunk, NULL);
 }
 
-void termi_menu_copy_selection_cb(TermiTab *tab, GtkMenuItem *item)
+void termi_archive_flush(void)
 {
-  if( vte_terminal_get_has_selection(tab->vte) ) {
-    vte_terminal_copy_clipboard(tab->vte);
+  if( termi.archive_mutex == NULL ) {
+    return;
   }
+  g_mutex_lock(termi.archive_mutex);
+  while( termi.archive_pending > 0 ) {
+    g_cond_wait(termi.archive_cond, termi.archive_mutex);
+  }
+  g_mutex_unlock(termi.archive_mutex);
 }
 
-void termi_menu_paste_cb(TermiTab *tab, GtkMenuItem *item)
+void termi_tab_archive_show(TermiTab *tab, guint64 line)
 {
-  vte_terminal_paste_clipboard(tab->vte);
+  termi_archive_flush();
+  gchar *path = g_strdup_printf("/proc/%d/fd/%d", getpid(), tab->archive_fd);
+  gchar *cmd;
+  if( line == 0 ) {
+    cmd = g_strdup_printf("less +G %s", path);
+  } else {
+    cmd = g_strdup_printf("less +%" G_GUINT64_FORMAT " %s", line, path);
+  }
+  termi_tab_new(tab->win, cmd, NULL, FALSE);
+  g_free(cmd);
+  g_free(path);
 }
 
-void termi_menu_set_tab_title_cb(TermiTab *tab, GtkMenuItem *item)
+#if VTE_CHECK_VERSION(0,26,0)
+gboolean termi_tab_archive_find(TermiTab *tab, const GRegex *regex)
 {
-  GtkDialog *dlg = GTK_DIALOG(gtk_dialog_new_with_buttons(
-      "Set tab title", termi.winmain, GTK_DIALOG_MODAL,
-      GTK_STOCK_CANCEL, GTK_RESPONSE_REJECT,
-      GTK_STOCK_OK, GTK_RESPONSE_ACCEPT, NULL));
-  gtk_dialog_set_default_response(dlg, GTK_RESPONSE_ACCEPT);
+  if( tab->archive_fd == -1 || regex == NULL ) {
+    return FALSE;
+  }
+  termi_tab_archive_update(tab);
+
+  // stop at the first row still in the terminal (or just after)
+  GtkAdjustment *adj = vte_terminal_get_adjustment(tab->vte);
+  glong first_row = gtk_adjustment_get_lower(adj);
+  guint64 end = tab->archive_size;
+  guint i;
+  for( i=0; i<tab->archive_marks->len; i++ ) {
+    TermiArchiveMark *mark = &g_array_index(tab->archive_marks, TermiArchiveMark, i);
+    if( mark->row >= first_row ) {
+      end = mark->offset;
+      break;
+    }
+  }
+  if( end == 0 ) {
+    return FALSE;
+  }
 
-  GtkEntry *entry = GTK_ENTRY(gtk_entry_new());
-  gtk_entry_set_text(entry, gtk_label_get_text(tab->lbl));
-  gtk_entry_set_activates_default(entry, TRUE);
-  GtkWidget *check = gtk_check_button_new_with_label("Allow terminal to change tab title");
-  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(check), !termi.force_tab_title);
+  termi_archive_flush();
+  const gchar *data = mmap(NULL, end, PROT_READ, MAP_SHARED, tab->archive_fd, 0);
+  if( data == MAP_FAILED ) {
+    termi_error("cannot map scrollback archive: %s", g_strerror(errno));
+    return FALSE;
+  }
+  // lines are matched one by one, most recent first
+  gboolean found = FALSE;
+  guint64 eol = end;
+  if( data[eol-1] == '\n' ) {
+    eol--;
+  }
+  guint64 bol;
+  for(;;) {
+    for( bol=eol; bol>0 && data[bol-1]!='\n'; bol-- ) ;
+    if( g_regex_match_full(regex, data + bol, eol - bol, 0, 0, NULL, NULL) ) {
+      found = TRUE;
+      break;
+    }
+    if( bol == 0 ) {
+      break;
+    }
+    eol = bol - 1;
+  }
 
-  gtk_box_pack_start(GTK_BOX(dlg->vbox), GTK_WIDGET(entry), TRUE, TRUE, 5);
-  gtk_box_pack_start(GTK_BOX(dlg->vbox), check, FALSE, FALSE, 5);
-  gtk_widget_show_all(dlg->vbox);
+  if( found ) {
+    // get the line number from the closest index entry
+    guint lo = 0;
+    guint hi = tab->archive_index->len;
+    while( hi - lo > 1 ) {
+      guint mid = (lo + hi) / 2;
+      if( g_array_index(tab->archive_index, guint64, mid) <= bol ) {
+        lo = mid;
+      } else {
+        hi = mid;
+      }
+    }
+    guint64 line = (guint64)lo * TERMI_ARCHIVE_INDEX_STEP + 1;
+    guint64 pos;
+    for( pos=g_array_index(tab->archive_index, guint64, lo); pos<bol; pos++ ) {
+      if( data[pos] == '\n' ) {
+        line++;
+      }
+    }
+    termi_tab_archive_show(tab, line);
+  }
+  munmap((void *)data, end);
+  return found;
+}
+#endif
 
-  g_signal_connect(G_OBJECT(entry), "changed", G_CALLBACK(termi_dlgtitle_entry_changed_cb), dlg);
 
-  if( gtk_dialog_run(dlg) == GTK_RESPONSE_ACCEPT ) {
-    termi_tab_set_title(tab, gtk_entry_get_text(entry));
-    //TODO make this option local to the tab
-    termi.force_tab_title = !gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(check));
+#if VTE_CHECK_VERSION(0,26,0)
+
+gchar *termi_get_user_shell(void)
+{
+#if VTE_CHECK_VERSION(0,28,0)
+  gchar *shell = vte_get_user_shell();
+#else
+  gchar *shell = g_strdup(g_getenv("SHELL"));
+#endif
+  if( shell == NULL ) {
+    shell = g_strdup("/bin/sh");
   }
+  return shell;
+}
 
-  gtk_widget_destroy(GTK_WIDGET(dlg));
+void termi_shell_pool_refill(void)
+{
+  while( g_queue_get_length(&termi.shell_pool) > termi.shell_pool_size ) {
+    termi_shell_pool_kill(g_queue_peek_tail(&termi.shell_pool));
+  }
+  if( termi.shell_pool_refill_id == 0 && termi.shell_pool_size > 0 &&
+      (g_queue_get_length(&termi.shell_pool) < termi.shell_pool_size || !termi_shell_pool_has_wdir()) ) {
+    termi.shell_pool_refill_id = g_idle_add_full(G_PRIORITY_LOW, termi_shell_pool_refill_cb, NULL, NULL);
+  }
 }
 
-void termi_menu_new_tab_cb(TermiTab *tab, GtkMenuItem *item)
+TermiPooledShell *termi_shell_pool_pop(const gchar *wdir)
 {
-  termi_tab_new(NULL, NULL);
+  if( g_strcmp0(wdir, termi.shell_pool_wdir) != 0 ) {
+    // next tabs will likely be opened in the same directory
+    g_free(termi.shell_pool_wdir);
+    termi.shell_pool_wdir = g_strdup(wdir);
+  }
+  GList *l;
+  for( l=termi.shell_pool.head; l!=NULL; l=l->next ) {
+    TermiPooledShell *shell = l->data;
+    if( g_strcmp0(shell->wdir, wdir) == 0 ) {
+      g_queue_delete_link(&termi.shell_pool, l);
+      // the terminal will watch the child
+      g_source_remove(shell->watch_id);
+      return shell;
+    }
+  }
+  return NULL;
 }
 
-void termi_menu_close_tab_cb(TermiTab *tab, GtkMenuItem *item)
+gboolean termi_shell_pool_has_wdir(void)
 {
-  termi_tab_del(tab);
+  GList *l;
+  for( l=termi.shell_pool.head; l!=NULL; l=l->next ) {
+    if( g_strcmp0(((TermiPooledShell *)l->data)->wdir, termi.shell_pool_wdir) == 0 ) {
+      return TRUE;
+    }
+  }
+  return FALSE;
 }
 
-void termi_menu_select_font_cb(TermiTab *tab, GtkMenuItem *item)
+void termi_shell_pool_kill(TermiPooledShell *shell)
 {
-  GtkWidget *dlg = gtk_font_selection_dialog_new("Select terminal font");
-  if( termi.vte_font != NULL ) {
-    gtk_font_selection_dialog_set_font_name(GTK_FONT_SELECTION_DIALOG(dlg),
-                                            pango_font_description_to_string(termi.vte_font));
+  g_queue_remove(&termi.shell_pool, shell);
+  kill(shell->pid, SIGHUP);
+  g_object_unref(shell->pty);
+  shell->pty = NULL;
+}
+
+gboolean termi_spawn(char **argv, const gchar *wdir, VtePty **pty, GPid *pid, GError **error)
+{
+  VtePty *new_pty = vte_pty_new(VTE_PTY_NO_LASTLOG|VTE_PTY_NO_UTMP|VTE_PTY_NO_WTMP|VTE_PTY_NO_HELPER, error);
+  if( new_pty == NULL ) {
+    return FALSE;
   }
-  if( gtk_dialog_run(GTK_DIALOG(dlg)) == GTK_RESPONSE_OK ) {
-    gchar *s = gtk_font_selection_dialog_get_font_name(GTK_FONT_SELECTION_DIALOG(dlg));
-    if( s != NULL ) {
-      termi_set_vte_font( pango_font_description_from_string(s) );
-      g_free(s);
+  vte_pty_set_term(new_pty, "xterm");
+  vte_pty_set_size(new_pty, 24, 80, NULL);
+  gchar **envp = termi_spawn_environ();
+  gboolean ret = g_spawn_async(wdir, argv, envp,
+                               G_SPAWN_DO_NOT_REAP_CHILD|G_SPAWN_SEARCH_PATH|G_SPAWN_CHILD_INHERITS_STDIN,
+                               (GSpawnChildSetupFunc)vte_pty_child_setup, new_pty, pid, error);
+  g_strfreev(envp);
+  if( !ret ) {
+    g_object_unref(new_pty);
+    return FALSE;
+  }
+  // child output is read by termi_tab_tap_cb()
+  int fd = vte_pty_get_fd(new_pty);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  *pty = new_pty;
+  return TRUE;
+}
+
+gchar **termi_spawn_environ(void)
+{
+  // variables set by the terminal
+  GPtrArray *env = g_ptr_array_new();
+  g_ptr_array_add(env, g_strdup("TERM=xterm"));
+#if VTE_CHECK_VERSION(0,34,0)
+  g_ptr_array_add(env, g_strdup_printf("VTE_VERSION=%u",
+                                       VTE_MAJOR_VERSION * 10000 + VTE_MINOR_VERSION * 100 + VTE_MICRO_VERSION));
+#endif
+#if VTE_CHECK_VERSION(0,36,0)
+  g_ptr_array_add(env, g_strdup("COLORTERM=truecolor"));
+#endif
+  guint nset = env->len;
+
+  gchar **names = g_listenv();
+  gchar **it;
+  for( it=names; *it!=NULL; it++ ) {
+    gsize len = strlen(*it);
+    guint i;
+    for( i=0; i<nset; i++ ) {
+      const gchar *var = g_ptr_array_index(env, i);
+      if( strncmp(var, *it, len) == 0 && var[len] == '=' ) {
+        break;
+      }
+    }
+    if( i == nset ) {
+      g_ptr_array_add(env, g_strdup_printf("%s=%s", *it, g_getenv(*it)));
     }
   }
-  gtk_widget_destroy(dlg);
+  g_strfreev(names);
+  g_ptr_array_add(env, NULL);
+  return (gchar **)g_ptr_array_free(env, FALSE);
 }
 
-void termi_menu_select_colors_cb(TermiTab *tab, GtkMenuItem *item)
+gboolean termi_convert(GConverter *conv, const guint8 *data, gsize len, GByteArray *out)
 {
-  GtkDialog *dlg = GTK_DIALOG(gtk_dialog_new_with_buttons(
-      "Select terminal colors", termi.winmain, GTK_DIALOG_MODAL,
-      GTK_STOCK_CANCEL, GTK_RESPONSE_REJECT,
-      GTK_STOCK_OK, GTK_RESPONSE_ACCEPT, NULL));
-  gtk_dialog_set_default_response(dlg, GTK_RESPONSE_ACCEPT);
+  guint8 buf[16384];
+  for(;;) {
+    gsize nread = 0;
+    gsize nwritten = 0;
+    GError *gerror = NULL;
+    GConverterResult res = g_converter_convert(conv, data, len, buf, sizeof(buf),
+                                               G_CONVERTER_INPUT_AT_END, &nread, &nwritten, &gerror);
+    if( res == G_CONVERTER_ERROR ) {
+      termi_error("cannot convert scrollback: %s", gerror->message);
+      g_error_free(gerror);
+      return FALSE;
+    }
+    data += nread;
+    len -= nread;
+    g_byte_array_append(out, buf, nwritten);
+    if( res == G_CONVERTER_FINISHED ) {
+      return TRUE;
+    }
+  }
+}
 
-  GtkWidget *button_fg = gtk_color_button_new_with_color(&termi.vte_fg_color);
-  GtkWidget *button_bg = gtk_color_button_new_with_color(&termi.vte_bg_color);
-  GtkWidget *toggle_cursor = gtk_toggle_button_new_with_label("Default");
-  GtkWidget *button_cursor = gtk_color_button_new();
-  if( termi.vte_cursor_color_default ) {
-    gtk_color_button_set_color(GTK_COLOR_BUTTON(button_cursor), &termi.vte_fg_color);
-    gtk_widget_set_sensitive(button_cursor, FALSE);
-    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(toggle_cursor), TRUE);
-  } else {
-    gtk_color_button_set_color(GTK_COLOR_BUTTON(button_cursor), &termi.vte_cursor_color);
-    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(toggle_cursor), FALSE);
+void termi_tab_hibernate_schedule(TermiTab *tab)
+{
+  if( termi.hibernate_delay == 0 || termi.bench != NULL || tab->hibernate_id != 0 || tab->vte == NULL || tab->pty == NULL ) {
+    return;
   }
-  g_signal_connect(G_OBJECT(toggle_cursor), "toggled", G_CALLBACK(termi_dlgcolor_cursor_toggled_cb), button_cursor);
+  tab->hibernate_id = g_timeout_add_seconds(termi.hibernate_delay, (GSourceFunc)termi_tab_hibernate_cb, tab);
+}
 
-  GtkTable *table = GTK_TABLE(gtk_table_new(3, 3, FALSE));
-  GtkWidget *lbl;
-  lbl = gtk_label_new("Foreground color:"); gtk_misc_set_alignment(GTK_MISC(lbl), 0,0);
-  gtk_table_attach(table, lbl, 0,1,0,1, GTK_FILL,0, 5,2);
-  lbl = gtk_label_new("Background color:"); gtk_misc_set_alignment(GTK_MISC(lbl), 0,0);
-  gtk_table_attach(table, lbl, 0,1,1,2, GTK_FILL,0, 5,2);
-  lbl = gtk_label_new("Cursor color:");    gtk_misc_set_alignment(GTK_MISC(lbl), 0,0);
-  gtk_table_attach(table, lbl, 0,1,2,3, GTK_FILL,0, 5,2);
-  gtk_table_attach(table, button_fg,     1,2,0,1, 0,0, 5,2);
-  gtk_table_attach(table, button_bg,     1,2,1,2, 0,0, 5,2);
-  gtk_table_attach(table, button_cursor, 1,2,2,3, 0,0, 5,2);
-  gtk_table_attach(table, toggle_cursor, 2,3,2,3, 0,0, 5,2);
+gboolean termi_tab_hibernate(TermiTab *tab)
+{
+  VteTerminal *vte = tab->vte;
+  g_assert( vte != NULL && !tab->hibernated );
 
-  gtk_box_pack_start(GTK_BOX(dlg->vbox), GTK_WIDGET(table), FALSE, FALSE, 10);
-  gtk_widget_show_all(dlg->vbox);
+  termi_tab_throttle_flush(tab);
+  if( termi.infinite_scrollback ) {
+    termi_tab_archive_update(tab);
+  }
 
-  if( gtk_dialog_run(dlg) == GTK_RESPONSE_ACCEPT ) {
-    GdkColor fg, bg;
-    gtk_color_button_get_color(GTK_COLOR_BUTTON(button_fg), &fg);
-    gtk_color_button_get_color(GTK_COLOR_BUTTON(button_bg), &bg);
-    if( gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(toggle_cursor)) ) {
-      termi_set_vte_colors(&fg, &bg, NULL);
+  GtkAdjustment *adj = vte_terminal_get_adjustment(vte);
+  glong first_row = gtk_adjustment_get_lower(adj);
+  glong last_row = gtk_adjustment_get_upper(adj) - 1;
+  GString *dump = termi_tab_dump(tab);
+  if( dump == NULL ) {
+    return FALSE;
+  }
+
+  // compress to an unlinked temporary file
+  GConverter *conv = G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW, 1));
+  GByteArray *packed = g_byte_array_new();
+  gboolean ok = termi_convert(conv, (guint8 *)dump->str, dump->len, packed);
+  g_object_unref(conv);
+  g_string_free(dump, TRUE);
+  int fd = -1;
+  if( ok ) {
+    gchar *spill_path = NULL;
+    GError *gerror = NULL;
+    fd = g_file_open_tmp(PROGRAM_NAME"-XXXXXX", &spill_path, &gerror);
+    if( fd == -1 ) {
+      termi_error("cannot create spill file: %s", gerror->message);
+      g_error_free(gerror);
+      ok = FALSE;
     } else {
-      GdkColor cursor;
-      gtk_color_button_get_color(GTK_COLOR_BUTTON(button_cursor), &cursor);
-      termi_set_vte_colors(&fg, &bg, &cursor);
+      unlink(spill_path);
+      g_free(spill_path);
+    }
+  }
+  gsize pos = 0;
+  while( ok && pos < packed->len ) {
+    ssize_t n = write(fd, packed->data + pos, packed->len - pos);
+    if( n == -1 && errno != EINTR ) {
+      termi_error("cannot write spill file: %s", g_strerror(errno));
+      ok = FALSE;
+    } else if( n > 0 ) {
+      pos += n;
+    }
+  }
+  if( !ok ) {
+    if( fd != -1 ) {
+      close(fd);
+    }
+    g_byte_array_free(packed, TRUE);
+    return FALSE;
+  }
+  tab->spill_fd = fd;
+  tab->spill_size = packed->len;
+  g_byte_array_free(packed, TRUE);
+
+  // remember the geometry, cursor row is relative to the screen
+  tab->columns = vte->column_count;
+  tab->rows = vte->row_count;
+  vte_terminal_get_cursor_position(vte, &tab->cursor_col, &tab->cursor_row);
+  tab->cursor_row -= last_row + 1 - vte->row_count;
+  if( tab->cursor_row < 0 ) {
+    tab->cursor_row = 0;
+  }
+  // the restored terminal will start at row 0
+  tab->archive_row -= first_row;
+  if( tab->archive_fd != -1 ) {
+    guint i;
+    for( i=0; i<tab->archive_marks->len; i++ ) {
+      g_array_index(tab->archive_marks, TermiArchiveMark, i).row -= first_row;
     }
   }
 
-  gtk_widget_destroy(GTK_WIDGET(dlg));
+  // free the terminal, output is kept until wake up
+  tab->drain = g_byte_array_new();
+  tab->placeholder = GTK_LABEL(gtk_label_new("Hibernated"));
+  gtk_box_pack_start(GTK_BOX(tab->page), GTK_WIDGET(tab->placeholder), TRUE, TRUE, 0);
+  gtk_widget_show(GTK_WIDGET(tab->placeholder));
+  gtk_widget_destroy(GTK_WIDGET(vte));
+  tab->vte = NULL;
+  tab->hibernated = TRUE;
+  return TRUE;
 }
 
-void termi_menu_conf_reload_cb(TermiTab *tab, GtkMenuItem *item)
+GString *termi_tab_dump(TermiTab *tab)
 {
-  termi_conf_load();
+  VteTerminal *vte = tab->vte;
+  GtkAdjustment *adj = vte_terminal_get_adjustment(vte);
+  glong first_row = gtk_adjustment_get_lower(adj);
+  glong last_row = gtk_adjustment_get_upper(adj) - 1;
+  gchar *text = vte_terminal_get_text_range(vte, first_row, 0, last_row, vte->column_count - 1,
+                                            NULL, NULL, NULL);
+  if( text == NULL ) {
+    return NULL;
+  }
+  GString *dump = g_string_sized_new(strlen(text) + last_row - first_row + 1);
+  const gchar *line = text;
+  for(;;) {
+    const gchar *eol = strchr(line, '\n');
+    if( eol == NULL ) {
+      g_string_append(dump, line);
+      break;
+    }
+    g_string_append_len(dump, line, eol - line);
+    if( eol[1] == '\0' ) {
+      break;  // don't scroll after the last row
+    }
+    g_string_append(dump, "\r\n");
+    line = eol + 1;
+  }
+  g_free(text);
+  return dump;
 }
 
-void termi_menu_conf_save_cb(TermiTab *tab, GtkMenuItem *item)
+void termi_tab_wake(TermiTab *tab)
 {
-  termi_conf_save();
+  if( tab->hibernate_id != 0 ) {
+    g_source_remove(tab->hibernate_id);
+    tab->hibernate_id = 0;
+  }
+  if( !tab->hibernated ) {
+    return;
+  }
+  tab->hibernated = FALSE;
+
+  // read back the scrollback
+  GByteArray *packed = g_byte_array_sized_new(tab->spill_size);
+  g_byte_array_set_size(packed, tab->spill_size);
+  gboolean ok = TRUE;
+  gsize pos = 0;
+  while( ok && pos < tab->spill_size ) {
+    ssize_t n = pread(tab->spill_fd, packed->data + pos, tab->spill_size - pos, pos);
+    if( n == 0 || (n == -1 && errno != EINTR) ) {
+      termi_error("cannot read spill file: %s", n == 0 ? "unexpected end of file" : g_strerror(errno));
+      ok = FALSE;
+    } else if( n > 0 ) {
+      pos += n;
+    }
+  }
+  close(tab->spill_fd);
+  tab->spill_fd = -1;
+  GByteArray *dump = g_byte_array_new();
+  if( ok ) {
+    GConverter *conv = G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW));
+    ok = termi_convert(conv, packed->data, packed->len, dump);
+    g_object_unref(conv);
+  }
+  g_byte_array_free(packed, TRUE);
+
+  // recreate the terminal, replay scrollback then pending output
+  tab->vte = VTE_TERMINAL(vte_terminal_new());
+  g_object_set_qdata(G_OBJECT(tab->vte), termi.quark, tab);
+  termi_tab_attach_vte(tab);
+  vte_terminal_set_size(tab->vte, tab->columns, tab->rows);
+  if( ok ) {
+    vte_terminal_feed(tab->vte, (gchar *)dump->data, dump->len);
+    gchar *s = g_strdup_printf("\033[%ld;%ldH", tab->cursor_row + 1, tab->cursor_col + 1);
+    vte_terminal_feed(tab->vte, s, -1);
+    g_free(s);
+  }
+  g_byte_array_free(dump, TRUE);
+  vte_terminal_feed(tab->vte, (gchar *)tab->drain->data, tab->drain->len);
+  g_byte_array_free(tab->drain, TRUE);
+  tab->drain = NULL;
 }
 
-void termi_menu_save_conf_at_exit_cb(TermiTab *tab, GtkCheckMenuItem *item)
+void termi_tab_tap_start(TermiTab *tab)
 {
-  termi.save_conf_at_exit = gtk_check_menu_item_get_active(item);
+  GIOChannel *channel = g_io_channel_unix_new(vte_pty_get_fd(tab->pty));
+  tab->tap_id = g_io_add_watch(channel, G_IO_IN|G_IO_HUP|G_IO_ERR, (GIOFunc)termi_tab_tap_cb, tab);
+  g_io_channel_unref(channel);
 }
 
+void termi_tab_output(TermiTab *tab, const gchar *data, gsize len)
+{
+  if( tab->launch_time != 0 ) {
+    g_printerr(PROGRAM_NAME": %s start, first output after %" G_GINT64_FORMAT " us\n",
+               termi.daemon ? "warm" : "cold", g_get_monotonic_time() - tab->launch_time);
+    tab->launch_time = 0;
+  }
+  if( tab->latency != NULL && tab->latency->write_time != 0 && tab->latency->read_time == 0 ) {
+    tab->latency->read_time = g_get_monotonic_time();
+  }
+  const TermiOutputStage *stage;
+  for( stage=termi_output_stages; *stage!=NULL; stage++ ) {
+    (*stage)(tab, data, len);
+  }
 
-void termi_tab_child_exited_cb(VteTerminal *vte, void *data)
+  // benchmarks measure the output pipeline, not the throttling
+  if( tab->vte != NULL && termi.background_feed_rate > 0 && termi.bench == NULL && !termi_tab_is_visible(tab) ) {
+    if( tab->throttled == NULL ) {
+      tab->throttled = g_byte_array_new();
+    }
+    g_byte_array_append(tab->throttled, (const guint8 *)data, len);
+    if( tab->throttle_id == 0 ) {
+      tab->throttle_id = g_timeout_add_full(G_PRIORITY_LOW, 1000 / termi.background_feed_rate,
+                                            (GSourceFunc)termi_tab_throttle_cb, tab, NULL);
+    }
+    if( tab->throttled->len > TERMI_THROTTLE_MAX_SIZE ) {
+      // keep reading, skip the oldest output, up to a line end
+      guint8 *cut = tab->throttled->data + tab->throttled->len - TERMI_THROTTLE_MAX_SIZE;
+      guint8 *eol = memchr(cut, '\n', tab->throttled->data + tab->throttled->len - cut);
+      guint skip = (eol != NULL ? eol + 1 : cut) - tab->throttled->data;
+      g_byte_array_remove_range(tab->throttled, 0, skip);
+      tab->throttle_skipped += skip;
+    }
+  } else if( tab->vte != NULL ) {
+    if( tab->throttled != NULL && tab->throttled->len > 0 ) {
+      termi_tab_throttle_flush(tab);  // keep output order
+    }
+    vte_terminal_feed(tab->vte, data, len);
+    tab->output_feeds++;
+  } else if( tab->drain != NULL ) {
+    g_byte_array_append(tab->drain, (const guint8 *)data, len);
+    // keep the most recent output
+    if( tab->drain->len > TERMI_HIBERNATE_DRAIN_SIZE ) {
+      g_byte_array_remove_range(tab->drain, 0, tab->drain->len - TERMI_HIBERNATE_DRAIN_SIZE);
+    }
+  }
+}
+
+void termi_tab_write(TermiTab *tab, const gchar *data, gsize len)
 {
-  TermiTab *tab = termi_tab_from_vte(vte);
-  tab->pid = -1; // avoid check for running processes
-  termi_tab_del(tab);
+  if( tab->pty == NULL ) {
+    return;  // replayed tab
+  }
+  if( tab->latency != NULL && tab->latency->key_time != 0 && tab->latency->write_time == 0 ) {
+    tab->latency->write_time = g_get_monotonic_time();
+  }
+  if( tab->fg_check_id == 0 && memchr(data, '\r', len) != NULL ) {
+    // a command may start after its echo has been read, check again later
+    tab->fg_check_id = g_timeout_add(TERMI_FG_CHECK_DELAY_MS, (GSourceFunc)termi_tab_fg_check_cb, tab);
+  }
+  if( tab->input_id == 0 ) {
+    // nothing pending, try to write now
+    ssize_t n = write(vte_pty_get_fd(tab->pty), data, len);
+    if( n > 0 ) {
+      data += n;
+      len -= n;
+    } else if( n == -1 && errno != EAGAIN && errno != EINTR ) {
+      return;  // child is gone
+    }
+  }
+  if( len == 0 ) {
+    return;
+  }
+  if( tab->input == NULL ) {
+    tab->input = g_byte_array_new();
+  }
+  g_byte_array_append(tab->input, (const guint8 *)data, len);
+  if( tab->input_id == 0 ) {
+    GIOChannel *channel = g_io_channel_unix_new(vte_pty_get_fd(tab->pty));
+    tab->input_id = g_io_add_watch(channel, G_IO_OUT|G_IO_ERR|G_IO_HUP, (GIOFunc)termi_tab_input_cb, tab);
+    g_io_channel_unref(channel);
+  }
 }
 
-void termi_tab_eof_cb(VteTerminal *vte, void *data)
+void termi_tab_send(TermiTab *tab, const gchar *data, gsize len)
 {
-  TermiTab *tab = termi_tab_from_vte(vte);
-  tab->pid = -1; // avoid check for running processes
-  termi_tab_del(tab);
+  // current tab first, others must not delay it
+  termi_tab_write(tab, data, len);
+  if( tab->broadcast ) {
+    guint i;
+    for( i=0; i<termi.broadcast->len; i++ ) {
+      TermiTab *member = g_ptr_array_index(termi.broadcast, i);
+      // note: data is copied only if a pty is full
+      if( member != tab && member->pty != NULL ) {
+        termi_tab_write(member, data, len);
+      }
+    }
+  }
 }
 
-void termi_resize(gint col, gint row)
+void termi_tab_set_broadcast(TermiTab *tab, gboolean broadcast)
 {
-  TermiTab *tab = termi_tab_from_index(gtk_notebook_get_current_page(termi.notebook));
-  VteTerminal *vte = tab->vte;
-  if( col < 0 ) {
-    col = vte->column_count;
+  if( tab->broadcast == broadcast ) {
+    return;
   }
-  if( row < 0 ) {
-    row = vte->row_count;
+  tab->broadcast = broadcast;
+  if( termi.broadcast == NULL ) {
+    termi.broadcast = g_ptr_array_new();
   }
-
-  // Update geometry hints of a tab.
-  GtkBorder *border = NULL;
-  gtk_widget_style_get(GTK_WIDGET(vte), "inner-border", &border, NULL);
-  gint pad_x = 0;
-  gint pad_y = 0;
-  if( border != NULL ) {
-    pad_x = border->left + border->right;
-    pad_y = border->top + border->bottom;
-    gtk_border_free(border);
+  // members are shown with a bold label
+  PangoAttrList *attrs = NULL;
+  if( broadcast ) {
+    g_ptr_array_add(termi.broadcast, tab);
+    attrs = pango_attr_list_new();
+    pango_attr_list_insert(attrs, pango_attr_weight_new(PANGO_WEIGHT_BOLD));
+  } else {
+    g_ptr_array_remove_fast(termi.broadcast, tab);
   }
-  glong char_x = vte_terminal_get_char_width(vte);
-  glong char_y = vte_terminal_get_char_height(vte);
-
-  GdkGeometry geom = {
-    .min_width = pad_x + char_x,
-    .min_height = pad_y + char_y,
-    .base_width = pad_x,
-    .base_height = pad_y,
-    .width_inc = char_x,
-    .height_inc = char_y,
-  };
-  gtk_window_set_geometry_hints(
-      termi.winmain, GTK_WIDGET(vte), &geom,
-      GDK_HINT_RESIZE_INC|GDK_HINT_MIN_SIZE|GDK_HINT_BASE_SIZE);
-
-  // not the first tab: resize window too
-  if( gtk_widget_get_realized(GTK_WIDGET(termi.winmain)) ) {
-    GtkRequisition req;
-    gtk_widget_size_request(GTK_WIDGET(termi.winmain), &req);
-    gint win_width  = req.width;
-    gint win_height = req.height;
-    gtk_widget_size_request(GTK_WIDGET(termi.notebook), &req);
-    win_width  -= req.width;
-    win_height -= req.height;
-    win_width  += pad_x + col * char_x;
-    win_height += pad_y + row * char_y;
-    gtk_window_resize(termi.winmain, win_width, win_height);
+  gtk_label_set_attributes(tab->lbl, attrs);
+  if( attrs != NULL ) {
+    pango_attr_list_unref(attrs);
   }
 }
 
-void termi_tab_decrease_font_size_cb(VteTerminal *vte, void *data)
+TermiLog *termi_log_new(TermiTab *tab, gboolean cast)
 {
-  gint size = pango_font_description_get_size(termi.vte_font);
-  size -= PANGO_SCALE;
-  pango_font_description_set_size(termi.vte_font, size);
+  TermiLog *log = g_new0(TermiLog, 1);
+  log->ring = g_malloc(TERMI_LOG_RING_SIZE);
+#if GLIB_CHECK_VERSION(2,32,0)
+  log->mutex = &log->mutex_data;
+  log->cond = &log->cond_data;
+  g_mutex_init(log->mutex);
+  g_cond_init(log->cond);
+#else
+  log->mutex = g_mutex_new();
+  log->cond = g_cond_new();
+#endif
+  GDateTime *now = g_date_time_new_now_local();
+  gchar *date = g_date_time_format(now, "%Y%m%d-%H%M%S");
+  gchar *name = g_strdup_printf(PROGRAM_NAME"-%s-%d", date, tab->pid);
+  log->path = g_build_filename(termi.log_dir, name, NULL);
+  g_free(name);
+  g_free(date);
+  g_date_time_unref(now);
+  if( cast ) {
+    // players expect a single, plain file
+    log->cast = TRUE;
+    log->start_time = g_get_monotonic_time();
+    log->columns = tab->vte->column_count;
+    log->rows = tab->vte->row_count;
+  } else {
+    log->timestamps = termi.log_timestamps;
+    log->compress = termi.log_compress;
+    log->rotate_size = (guint64)termi.log_rotate_mb * 1024 * 1024;
+    log->line_start = TRUE;
+  }
+  // files are created by the thread: the log directory may be slow
+#if GLIB_CHECK_VERSION(2,32,0)
+  log->thread = g_thread_new(PROGRAM_NAME"-log", (GThreadFunc)termi_log_thread, log);
+#else
+  log->thread = g_thread_create((GThreadFunc)termi_log_thread, log, TRUE, NULL);
+#endif
+  return log;
+}
+
+void termi_log_close(TermiLog *log)
+{
+  g_atomic_int_set(&log->stop, 1);
+  g_mutex_lock(log->mutex);
+  g_cond_signal(log->cond);
+  g_mutex_unlock(log->mutex);
+  // don't wait for remaining data to be written, until exit
+  if( termi.log_threads == NULL ) {
+    termi.log_threads = g_ptr_array_new();
+  }
+  g_ptr_array_add(termi.log_threads, log->thread);
+}
+
+void termi_log_join_all(void)
+{
+  if( termi.log_threads == NULL ) {
+    return;
+  }
+  guint i;
+  for( i=0; i<termi.log_threads->len; i++ ) {
+    g_thread_join(g_ptr_array_index(termi.log_threads, i));
+  }
+  g_ptr_array_free(termi.log_threads, TRUE);
+  termi.log_threads = NULL;
+}
+
+void termi_log_push(TermiLog *log, gconstpointer hdr, gsize hlen, const gchar *data, gsize len)
+{
+  guint head = log->head;
+  guint tail = g_atomic_int_get(&log->tail);
+  if( hlen + len > TERMI_LOG_RING_SIZE - (head - tail) ) {
+    // never wait for the writer thread
+    g_atomic_int_add(&log->dropped, hlen + len);
+    return;
+  }
+  const gchar *parts[2] = { hdr, data };
+  gsize sizes[2] = { hlen, len };
+  guint i;
+  for( i=0; i<2; i++ ) {
+    if( sizes[i] == 0 ) {
+      continue;  // hdr may be NULL
+    }
+    guint pos = head & (TERMI_LOG_RING_SIZE-1);
+    gsize n = MIN(sizes[i], TERMI_LOG_RING_SIZE - pos);
+    memcpy(log->ring + pos, parts[i], n);
+    memcpy(log->ring, parts[i] + n, sizes[i] - n);
+    head += sizes[i];
+  }
+  g_atomic_int_set(&log->head, head);
+}
+
+void termi_log_wake(TermiLog *log)
+{
+  if( g_atomic_int_get(&log->sleeping) ) {
+    g_mutex_lock(log->mutex);
+    g_cond_signal(log->cond);
+    g_mutex_unlock(log->mutex);
+  }
+}
+
+void termi_log_read(TermiLog *log, guint pos, gpointer buf, gsize len)
+{
+  pos &= TERMI_LOG_RING_SIZE-1;
+  gsize n = MIN(len, TERMI_LOG_RING_SIZE - pos);
+  memcpy(buf, log->ring + pos, n);
+  memcpy((gchar *)buf + n, log->ring, len - n);
+}
+
+gboolean termi_log_write_cast(TermiLog *log, GOutputStream *out, guint tail, guint len,
+                              GByteArray *pending, GError **error)
+{
+  GString *lines = g_string_new(NULL);
+  while( len > 0 ) {
+    TermiCastRecord rec;
+    termi_log_read(log, tail, &rec, sizeof(rec));
+    tail += sizeof(rec);
+    gchar s_time[G_ASCII_DTOSTR_BUF_SIZE];
+    g_ascii_formatd(s_time, sizeof(s_time), "%.6f", (rec.time - log->start_time) / 1e6);
+    if( rec.type != 'o' && pending->len > 0 ) {
+      // incomplete character of previous output, it won't be completed
+      g_string_append_printf(lines, "[%s, \"o\", \"\\ufffd\"]\n", s_time);
+      g_byte_array_set_size(pending, 0);
+    }
+    // only output may continue in the next event
+    guint plen = pending->len;
+    g_byte_array_set_size(pending, plen + rec.len);
+    termi_log_read(log, tail, pending->data + plen, rec.len);
+    tail += rec.len;
+    len -= sizeof(rec) + rec.len;
+
+    g_string_append_printf(lines, "[%s, \"%c\", \"", s_time, rec.type);
+    gsize n = termi_json_escape(lines, (const gchar *)pending->data, pending->len);
+    g_byte_array_remove_range(pending, 0, rec.type == 'o' ? n : pending->len);
+    g_string_append(lines, "\"]\n");
+  }
+  gboolean ret = g_output_stream_write_all(out, lines->str, lines->len, NULL, NULL, error);
+  g_string_free(lines, TRUE);
+  return ret;
+}
+
+gsize termi_json_escape(GString *out, const gchar *data, gsize len)
+{
+  const gchar *p = data;
+  const gchar *end = data + len;
+  while( p < end ) {
+    const gchar *valid_end;
+    g_utf8_validate(p, end-p, &valid_end);
+    for( ; p<valid_end; p++ ) {
+      guchar c = *p;
+      if( c == '"' || c == '\\' ) {
+        g_string_append_c(out, '\\');
+        g_string_append_c(out, c);
+      } else if( c < 0x20 || c == 0x7f ) {
+        g_string_append_printf(out, "\\u%04x", c);
+      } else {
+        g_string_append_c(out, c);
+      }
+    }
+    if( p == end ) {
+      break;
+    } else if( *p == '\0' ) {
+      // not valid for g_utf8_validate()
+      g_string_append(out, "\\u0000");
+    } else if( g_utf8_get_char_validated(p, end-p) == (gunichar)-2 ) {
+      break;  // incomplete sequence
+    } else {
+      g_string_append(out, "\\ufffd");
+    }
+    p++;
+  }
+  return p - data;
+}
+
+gboolean termi_json_unescape(const gchar **p, GString *out)
+{
+  const gchar *s = *p;
+  if( *s++ != '"' ) {
+    return FALSE;
+  }
+  for( ; *s != '"'; s++ ) {
+    if( *s == '\0' ) {
+      return FALSE;
+    } else if( *s != '\\' ) {
+      g_string_append_c(out, *s);
+      continue;
+    }
+    s++;
+    switch( *s ) {
+      case 'b': g_string_append_c(out, '\b'); break;
+      case 'f': g_string_append_c(out, '\f'); break;
+      case 'n': g_string_append_c(out, '\n'); break;
+      case 'r': g_string_append_c(out, '\r'); break;
+      case 't': g_string_append_c(out, '\t'); break;
+      case 'u': {
+        gunichar c = 0;
+        gint i;
+        for( i=1; i<=4; i++ ) {
+          if( !g_ascii_isxdigit(s[i]) ) {
+            return FALSE;
+          }
+          c = c << 4 | g_ascii_xdigit_value(s[i]);
+        }
+        s += 4;
+        if( c >= 0xd800 && c < 0xdc00 && s[1] == '\\' && s[2] == 'u' ) {
+          // surrogate pair
+          gunichar c2 = 0;
+          for( i=3; i<=6 && g_ascii_isxdigit(s[i]); i++ ) {
+            c2 = c2 << 4 | g_ascii_xdigit_value(s[i]);
+          }
+          if( i == 7 && c2 >= 0xdc00 && c2 < 0xe000 ) {
+            c = 0x10000 + ((c - 0xd800) << 10) + (c2 - 0xdc00);
+            s += 6;
+          }
+        }
+        g_string_append_unichar(out, c);
+        break;
+      }
+      case '\0':
+        return FALSE;
+      default:  // '"', '\\' and '/'
+        g_string_append_c(out, *s);
+    }
+  }
+  *p = s + 1;
+  return TRUE;
+}
+
+GOutputStream *termi_log_open(TermiLog *log, guint part)
+{
+  gchar *dir = g_path_get_dirname(log->path);
+  g_mkdir_with_parents(dir, 0700);
+  g_free(dir);
+  gchar *path;
+  if( log->cast ) {
+    path = g_strconcat(log->path, ".cast", NULL);
+  } else if( part == 0 ) {
+    path = g_strconcat(log->path, log->compress ? ".log.gz" : ".log", NULL);
+  } else {
+    gchar *suffix = g_strdup_printf(".%u%s", part, log->compress ? ".log.gz" : ".log");
+    path = g_strconcat(log->path, suffix, NULL);
+    g_free(suffix);
+  }
+  GFile *file = g_file_new_for_path(path);
+  GError *gerror = NULL;
+  GOutputStream *out = G_OUTPUT_STREAM(g_file_create(file, G_FILE_CREATE_PRIVATE, NULL, &gerror));
+  g_object_unref(file);
+  if( out == NULL ) {
+    termi_error("cannot create log file %s: %s", path, gerror->message);
+    g_error_free(gerror);
+  } else if( log->compress ) {
+    GConverter *compressor = G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+    GOutputStream *base = out;
+    out = g_converter_output_stream_new(base, compressor);
+    g_object_unref(compressor);
+    g_object_unref(base);
+  } else if( log->cast ) {
+    gchar *header = g_strdup_printf("{\"version\": 2, \"width\": %ld, \"height\": %ld, \"timestamp\": %ld}\n",
+                                    log->columns, log->rows, (long)time(NULL));
+    g_output_stream_write_all(out, header, strlen(header), NULL, NULL, NULL);
+    g_free(header);
+  }
+  g_free(path);
+  return out;
+}
+
+void termi_tab_paste_start(TermiTab *tab, GInputStream *stream, goffset size)
+{
+  if( tab->pty == NULL ) {
+    g_object_unref(stream);
+    return;  // replayed tab
+  }
+  if( tab->paste != NULL ) {
+    termi_tab_paste_stop(tab);
+  }
+  TermiPaste *paste = g_new0(TermiPaste, 1);
+  paste->stream = stream;
+  paste->size = size;
+  // bracketed paste mode is set by each child, check each destination
+  paste->bracketed = g_ptr_array_new();
+  if( tab->bracketed_paste ) {
+    g_ptr_array_add(paste->bracketed, tab);
+  }
+  if( tab->broadcast ) {
+    guint i;
+    for( i=0; i<termi.broadcast->len; i++ ) {
+      TermiTab *member = g_ptr_array_index(termi.broadcast, i);
+      if( member != tab && member->pty != NULL && member->bracketed_paste ) {
+        g_ptr_array_add(paste->bracketed, member);
+      }
+    }
+  }
+  guint i;
+  for( i=0; i<paste->bracketed->len; i++ ) {
+    termi_tab_write(g_ptr_array_index(paste->bracketed, i), "\033[200~", 6);
+  }
+  tab->paste = paste;
+  termi_tab_paste_watch(tab);
+
+  paste->bar = GTK_PROGRESS_BAR(gtk_progress_bar_new());
+  gtk_progress_bar_set_text(paste->bar, "Pasting (Escape to cancel)");
+  gtk_box_pack_end(GTK_BOX(tab->page), GTK_WIDGET(paste->bar), FALSE, FALSE, 0);
+  gtk_widget_show(GTK_WIDGET(paste->bar));
+}
+
+void termi_tab_paste_watch(TermiTab *tab)
+{
+  // low priority: keep the UI responsive
+  GIOChannel *channel = g_io_channel_unix_new(vte_pty_get_fd(tab->pty));
+  tab->paste->id = g_io_add_watch_full(channel, G_PRIORITY_LOW, G_IO_OUT|G_IO_ERR|G_IO_HUP,
+                                       (GIOFunc)termi_tab_paste_cb, tab, NULL);
+  g_io_channel_unref(channel);
+}
+
+void termi_paste_filter(TermiPaste *paste, const gchar *data, gsize len, GString *out)
+{
+  static const char seq[] = "\033[201~";
+  const gchar *end = data + len;
+  const gchar *p;
+  for( p=data; p<end; p++ ) {
+    if( *p == seq[paste->end_match] ) {
+      if( ++paste->end_match == sizeof(seq)-1 ) {
+        paste->end_match = 0;  // drop the sequence
+      }
+      continue;
+    }
+    // not the sequence, send what has been held
+    g_string_append_len(out, seq, paste->end_match);
+    paste->end_match = *p == '\033';
+    if( paste->end_match == 0 ) {
+      g_string_append_c(out, *p);
+    }
+  }
+}
+
+void termi_paste_write(TermiPaste *paste, TermiTab *dest, const gchar *data, gsize len,
+                       const GString *filtered)
+{
+  guint i;
+  for( i=0; i<paste->bracketed->len; i++ ) {
+    if( g_ptr_array_index(paste->bracketed, i) == dest ) {
+      termi_tab_write(dest, filtered->str, filtered->len);
+      return;
+    }
+  }
+  termi_tab_write(dest, data, len);
+}
+
+void termi_paste_end(TermiPaste *paste)
+{
+  guint i;
+  for( i=0; i<paste->bracketed->len; i++ ) {
+    TermiTab *dest = g_ptr_array_index(paste->bracketed, i);
+    // incomplete sequence at the end is pasted data
+    termi_tab_write(dest, "\033[201~", paste->end_match);
+    // even when canceled, to leave paste mode
+    termi_tab_write(dest, "\033[201~", 6);
+  }
+  g_ptr_array_free(paste->bracketed, TRUE);
+}
+
+void termi_tab_paste_stop(TermiTab *tab)
+{
+  TermiPaste *paste = tab->paste;
+  if( paste->id != 0 ) {
+    g_source_remove(paste->id);
+  }
+  termi_paste_end(paste);
+  g_object_unref(paste->stream);
+  gtk_widget_destroy(GTK_WIDGET(paste->bar));
+  g_free(paste);
+  tab->paste = NULL;
+}
+
+void termi_tab_paste_clipboard(TermiTab *tab)
+{
+  // the page is kept alive until text is received
+  GtkClipboard *clipboard = gtk_widget_get_clipboard(tab->page, GDK_SELECTION_CLIPBOARD);
+  gtk_clipboard_request_text(clipboard, (GtkClipboardTextReceivedFunc)termi_tab_paste_clipboard_cb,
+                             g_object_ref(tab->page));
+}
+
+gboolean termi_tab_is_visible(TermiTab *tab)
+{
+  return tab == tab->win->cur_tab && gtk_window_is_active(tab->win->winmain);
+}
+
+void termi_tab_throttle_flush(TermiTab *tab)
+{
+  if( tab->throttle_id != 0 ) {
+    g_source_remove(tab->throttle_id);
+    tab->throttle_id = 0;
+  }
+  if( tab->throttled != NULL && tab->throttled->len > 0 ) {
+    termi_tab_throttle_feed(tab);
+  }
+}
+
+void termi_tab_throttle_feed(TermiTab *tab)
+{
+  if( tab->throttle_skipped > 0 ) {
+    gchar *marker = g_strdup_printf("\r\n\033[0m["PROGRAM_NAME": %" G_GUINT64_FORMAT " bytes of output skipped]\r\n",
+                                    tab->throttle_skipped);
+    vte_terminal_feed(tab->vte, marker, -1);
+    g_free(marker);
+    tab->throttle_skipped = 0;
+  }
+  vte_terminal_feed(tab->vte, (gchar *)tab->throttled->data, tab->throttled->len);
+  tab->output_feeds++;
+  g_byte_array_set_size(tab->throttled, 0);
+}
+
+void termi_tab_latency_key(TermiTab *tab)
+{
+  if( tab->latency == NULL ) {
+    tab->latency = g_new0(TermiLatency, 1);
+  }
+  TermiLatency *lat = tab->latency;
+  gint64 now = g_get_monotonic_time();
+  // keys not sent to the child (bindings) and lost traces are restarted
+  if( lat->write_time == 0 || now - lat->key_time > G_USEC_PER_SEC ) {
+    lat->key_time = now;
+    lat->write_time = 0;
+    lat->read_time = 0;
+  }
+}
+
+void termi_tab_latency_draw(TermiTab *tab)
+{
+  TermiLatency *lat = tab->latency;
+  if( lat == NULL || lat->read_time == 0 ) {
+    return;
+  }
+  gint64 now = g_get_monotonic_time();
+  gint64 latency = now - lat->key_time;
+  lat->count++;
+  lat->max = MAX(lat->max, latency);
+  lat->sum_write += lat->write_time - lat->key_time;
+  lat->sum_read += lat->read_time - lat->write_time;
+  lat->sum_draw += now - lat->read_time;
+  lat->histogram[MIN(latency / TERMI_LATENCY_BUCKET_US, TERMI_LATENCY_BUCKETS)]++;
+  lat->key_time = 0;
+  lat->write_time = 0;
+  lat->read_time = 0;
+}
+
+gint64 termi_tab_latency_percentile(const TermiTab *tab, guint percent)
+{
+  const TermiLatency *lat = tab->latency;
+  guint rank = (lat->count * percent + 99) / 100;
+  guint n = 0;
+  guint i;
+  for( i=0; i<TERMI_LATENCY_BUCKETS; i++ ) {
+    n += lat->histogram[i];
+    if( n >= rank ) {
+      return (gint64)(i + 1) * TERMI_LATENCY_BUCKET_US;  // upper bound of the bucket
+    }
+  }
+  return lat->max;
+}
+
+void termi_stage_stats(TermiTab *tab, const gchar *data, gsize len)
+{
+  tab->output_bytes += len;
+  const gchar *end = data + len;
+  const gchar *p;
+  for( p=memchr(data, '\n', len); p!=NULL; p=memchr(p+1, '\n', end-p-1) ) {
+    tab->output_lines++;
+  }
+}
+
+void termi_stage_log(TermiTab *tab, const gchar *data, gsize len)
+{
+  if( tab->cast != NULL ) {
+    TermiCastRecord rec = { g_get_monotonic_time(), len, 'o' };
+    termi_log_push(tab->cast, &rec, sizeof(rec), data, len);
+    termi_log_wake(tab->cast);
+  }
+  TermiLog *log = tab->log;
+  if( log == NULL ) {
+    return;
+  }
+  if( !log->timestamps ) {
+    termi_log_push(log, NULL, 0, data, len);
+  } else {
+    gchar stamp[32];
+    time_t now = time(NULL);
+    struct tm tm;
+    strftime(stamp, sizeof(stamp), "[%Y-%m-%d %H:%M:%S] ", localtime_r(&now, &tm));
+    gsize stamp_len = strlen(stamp);
+    const gchar *end = data + len;
+    while( data < end ) {
+      const gchar *p = memchr(data, '\n', end-data);
+      p = p == NULL ? end : p+1;
+      if( log->line_start ) {
+        termi_log_push(log, stamp, stamp_len, data, p-data);
+      } else {
+        termi_log_push(log, NULL, 0, data, p-data);
+      }
+      log->line_start = p[-1] == '\n';
+      data = p;
+    }
+  }
+  termi_log_wake(log);
+}
+
+void termi_stage_triggers(TermiTab *tab, const gchar *data, gsize len)
+{
+  if( termi.trigger_regex == NULL ) {
+    return;
+  }
+  if( tab->trigger_line == NULL ) {
+    tab->trigger_line = g_string_sized_new(256);
+  }
+  // only complete lines are matched, each of them once
+  GString *line = tab->trigger_line;
+  const gchar *end = data + len;
+  while( data < end ) {
+    const gchar *p = memchr(data, '\n', end-data);
+    const gchar *line_end = p == NULL ? end : p;
+    gsize n = MIN((gsize)(line_end - data), TERMI_TRIGGER_LINE_MAX - line->len);
+    g_string_append_len(line, data, n);
+    if( p == NULL ) {
+      break;
+    }
+    termi_tab_triggers_scan(tab, line->str, line->len);
+    g_string_truncate(line, 0);
+    data = p + 1;
+  }
+}
+
+void termi_tab_triggers_scan(TermiTab *tab, gchar *line, gsize len)
+{
+  // strip escape sequences and control characters
+  gchar *out = line;
+  gsize i = 0;
+  while( i < len ) {
+    gchar c = line[i++];
+    if( c == '\033' && i < len ) {
+      c = line[i++];
+      if( c == '[' ) {  // CSI: parameters, then a final byte
+        while( i < len && !(line[i] >= 0x40 && line[i] <= 0x7e) ) {
+          i++;
+        }
+        i++;
+      } else if( c == ']' ) {  // OSC: ends with BEL or ST
+        while( i < len && line[i] != '\007' && line[i] != '\033' ) {
+          i++;
+        }
+        i += i < len && line[i] == '\033' ? 2 : 1;
+      } else if( c >= 0x20 && c <= 0x2f ) {  // nF (e.g. charset): intermediate bytes, then a final byte
+        while( i < len && line[i] >= 0x20 && line[i] <= 0x2f ) {
+          i++;
+        }
+        i++;
+      }
+    } else if( (guchar)c >= 0x20 || c == '\t' ) {
+      *out++ = c;
+    }
+  }
+  len = out - line;
+  if( len == 0 ) {
+    return;
+  }
+  *out = '\0';  // stripped in place, the GString nul is still after
+
+  GMatchInfo *info = NULL;
+  g_regex_match_full(termi.trigger_regex, line, len, 0, 0, &info, NULL);
+  while( g_match_info_matches(info) ) {
+    guint j;
+    for( j=0; j<termi.triggers->len; j++ ) {
+      gchar name[32];
+      g_snprintf(name, sizeof(name), "termi_t%u", j);
+      gint start = -1, end = -1;
+      if( g_match_info_fetch_named_pos(info, name, &start, &end) && start >= 0 ) {
+        termi_tab_trigger_fire(tab, &g_array_index(termi.triggers, TermiTrigger, j), line);
+        break;
+      }
+    }
+    g_match_info_next(info, NULL);
+  }
+  g_match_info_free(info);
+}
+
+void termi_tab_trigger_fire(TermiTab *tab, TermiTrigger *trigger, const gchar *line)
+{
+  // rate limited per tab, a noisy tab must not hide alerts of others
+  gint64 now = g_get_monotonic_time();
+  if( tab->trigger_times == NULL ) {
+    tab->trigger_times = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  }
+  gint64 *last_time = g_hash_table_lookup(tab->trigger_times, trigger->name);
+  if( last_time != NULL && now - *last_time < trigger->interval ) {
+    return;
+  }
+  gchar *summary = g_strdup_printf("%s: %s", gtk_label_get_text(tab->lbl), trigger->name);
+  gchar *body = !trigger->notify ? NULL : g_utf8_validate(line, -1, NULL) ? g_strdup(line) : g_strdup("");
+  if( termi_tab_alert(tab, summary, body) ) {
+    if( last_time == NULL ) {
+      last_time = g_new(gint64, 1);
+      g_hash_table_insert(tab->trigger_times, g_strdup(trigger->name), last_time);
+    }
+    *last_time = now;
+  }
+  g_free(body);
+  g_free(summary);
+}
+
+void termi_stage_modes(TermiTab *tab, const gchar *data, gsize len)
+{
+  // parse "ESC [ ? Pm h" and "ESC [ ? Pm l", which may be split between chunks
+  enum { MODE_NONE, MODE_ESC, MODE_CSI, MODE_PARAMS };
+  const gchar *end = data + len;
+  const gchar *p;
+  for( p=data; p<end; p++ ) {
+    switch( tab->mode_state ) {
+      case MODE_NONE:
+        p = memchr(p, '\033', end-p);
+        if( p == NULL ) {
+          return;
+        }
+        tab->mode_state = MODE_ESC;
+        break;
+      case MODE_ESC:
+        tab->mode_state = *p == '[' ? MODE_CSI : *p == '\033' ? MODE_ESC : MODE_NONE;
+        break;
+      case MODE_CSI:
+        if( *p == '?' ) {
+          tab->mode_state = MODE_PARAMS;
+          tab->mode_param = 0;
+          tab->mode_paste = FALSE;
+        } else {
+          tab->mode_state = *p == '\033' ? MODE_ESC : MODE_NONE;
+        }
+        break;
+      case MODE_PARAMS:
+        if( g_ascii_isdigit(*p) ) {
+          tab->mode_param = MIN(tab->mode_param * 10 + (*p - '0'), 100000);
+        } else if( *p == ';' ) {
+          tab->mode_paste = tab->mode_paste || tab->mode_param == 2004;
+          tab->mode_param = 0;
+        } else {
+          if( (*p == 'h' || *p == 'l') && (tab->mode_paste || tab->mode_param == 2004) ) {
+            tab->bracketed_paste = *p == 'h';
+          }
+          tab->mode_state = *p == '\033' ? MODE_ESC : MODE_NONE;
+        }
+        break;
+    }
+  }
+}
+
+#endif
+
+gchar *termi_get_cursor_match(const TermiTab *tab, const GdkEventButton *ev, guint *matcher)
+{
+  glong col = ev->x / vte_terminal_get_char_width(tab->vte);
+  glong row = ev->y / vte_terminal_get_char_height(tab->vte);
+  int tag = -1;
+  gchar *s = vte_terminal_match_check(tab->vte, col, row, &tag);
+  if( s == NULL || tag != tab->match_tag ) {
+    g_free(s);
+    return NULL;
+  }
+  if( matcher != NULL ) {
+    // VTE does not tell which alternative matched: match the row again, to
+    // get the same alternative as VTE (lookarounds see the same context)
+    *matcher = 0;
+    GtkAdjustment *adj = vte_terminal_get_adjustment(tab->vte);
+    glong abs_row = row + (glong)gtk_adjustment_get_value(adj);
+    gchar *line = vte_terminal_get_text_range(tab->vte, abs_row, 0, abs_row, tab->vte->column_count - 1,
+                                              NULL, NULL, NULL);
+    GMatchInfo *info = NULL;
+    gboolean found = FALSE;
+    if( line != NULL ) {
+      g_regex_match(termi.match_regex, line, 0, &info);
+      while( !found && g_match_info_matches(info) ) {
+        gint start = -1, end = -1;
+        g_match_info_fetch_pos(info, 0, &start, &end);
+        glong start_col = g_utf8_pointer_to_offset(line, line + start);
+        glong end_col = g_utf8_pointer_to_offset(line, line + end);
+        found = start_col <= col && col < end_col &&
+            (gsize)(end - start) == strlen(s) && strncmp(line + start, s, end - start) == 0;
+        if( !found ) {
+          g_match_info_next(info, NULL);
+        }
+      }
+    }
+    if( !found ) {
+      // match on several rows (or wide characters before it): use the match alone
+      if( info != NULL ) {
+        g_match_info_free(info);
+      }
+      g_regex_match(termi.match_regex, s, G_REGEX_MATCH_ANCHORED, &info);
+    }
+    if( g_match_info_matches(info) ) {
+      guint i;
+      for( i=0; i<termi.matchers->len; i++ ) {
+        gchar name[32];
+        g_snprintf(name, sizeof(name), "termi_m%u", i);
+        gint start = -1, end = -1;
+        if( g_match_info_fetch_named_pos(info, name, &start, &end) && start >= 0 ) {
+          *matcher = i;
+          break;
+        }
+      }
+    }
+    g_match_info_free(info);
+    g_free(line);
+  }
+  return s;
+}
+
+void termi_match_open(guint matcher, gchar *match)
+{
+  const gchar *command = NULL;
+  if( matcher < termi.matchers->len ) {
+    command = g_array_index(termi.matchers, TermiMatcher, matcher).command;
+  }
+  if( command == NULL ) {
+    termi_open_uri(match);
+    return;
+  }
+
+  gint argc;
+  gchar **argv = NULL;
+  GError *gerror = NULL;
+  if( !g_shell_parse_argv(command, &argc, &argv, &gerror) ) {
+    termi_error("invalid matcher command: %s", gerror->message);
+    g_error_free(gerror);
+    return;
+  }
+  gint i;
+  for( i=0; i<argc; i++ ) {
+    if( strstr(argv[i], "%s") != NULL ) {
+      gchar **parts = g_strsplit(argv[i], "%s", -1);
+      g_free(argv[i]);
+      argv[i] = g_strjoinv(match, parts);
+      g_strfreev(parts);
+    }
+  }
+  if( !g_spawn_async(NULL, argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, &gerror) ) {
+    termi_error("failed to run matcher command: %s", gerror->message);
+    g_error_free(gerror);
+  }
+  g_strfreev(argv);
+}
+
+void termi_open_uri(gchar *uri)
+{
+  static const char *browser_exec[] = {
+    "xdg-open", "x-www-browser", "www-browser", NULL
+  };
+  gchar *browser = NULL;
+  const char **it;
+  for( it=browser_exec; *it != NULL; it++ ) {
+    browser = g_find_program_in_path(*it);
+    if( browser != NULL ) {
+      break;
+    }
+  }
+  if( browser == NULL ) {
+    termi_error("cannot find a browser");
+  }
+  gchar *argv[] = { browser, uri, NULL };
+  GError *gerror = NULL;
+  if( !g_spawn_async(NULL, argv, NULL, 0, NULL, NULL, NULL, &gerror) ) {
+    termi_error("failed to open URI: %s", gerror->message);
+  }
+  g_free(browser);
+}
+
+#if VTE_CHECK_VERSION(0,26,0)
+
+GtkWidget *termi_search_bar_new(TermiWindow *win)
+{
+  GtkWidget *hbox = gtk_hbox_new(FALSE, 5);
+  gtk_container_set_border_width(GTK_CONTAINER(hbox), 2);
+
+  GtkWidget *close = gtk_button_new();
+  gtk_button_set_relief(GTK_BUTTON(close), GTK_RELIEF_NONE);
+  gtk_button_set_focus_on_click(GTK_BUTTON(close), FALSE);
+  gtk_container_add(GTK_CONTAINER(close), gtk_image_new_from_stock(GTK_STOCK_CLOSE, GTK_ICON_SIZE_MENU));
+  win->search_entry = GTK_ENTRY(gtk_entry_new());
+  win->search_wrap = GTK_TOGGLE_BUTTON(gtk_check_button_new_with_label("Wrap around"));
+  gtk_button_set_focus_on_click(GTK_BUTTON(win->search_wrap), FALSE);
+  win->search_status = GTK_LABEL(gtk_label_new(NULL));
+  gtk_misc_set_alignment(GTK_MISC(win->search_status), 0, 0.5);
+  gtk_label_set_ellipsize(win->search_status, PANGO_ELLIPSIZE_END);
+
+  gtk_box_pack_start(GTK_BOX(hbox), close, FALSE, FALSE, 0);
+  gtk_box_pack_start(GTK_BOX(hbox), gtk_label_new("Find:"), FALSE, FALSE, 0);
+  gtk_box_pack_start(GTK_BOX(hbox), GTK_WIDGET(win->search_entry), FALSE, FALSE, 0);
+  gtk_box_pack_start(GTK_BOX(hbox), GTK_WIDGET(win->search_wrap), FALSE, FALSE, 0);
+  gtk_box_pack_start(GTK_BOX(hbox), GTK_WIDGET(win->search_status), TRUE, TRUE, 0);
+  gtk_widget_show_all(hbox);
+  // only shown on request, not by gtk_widget_show_all() on the window
+  gtk_widget_hide(hbox);
+  gtk_widget_set_no_show_all(hbox, TRUE);
+
+  g_signal_connect(G_OBJECT(win->search_entry), "changed", G_CALLBACK(termi_searchbar_entry_changed_cb), win);
+  g_signal_connect(G_OBJECT(win->search_entry), "key-press-event", G_CALLBACK(termi_searchbar_key_press_event_cb), win);
+  g_signal_connect(G_OBJECT(win->search_wrap), "toggled", G_CALLBACK(termi_searchbar_wrap_toggled_cb), win);
+  g_signal_connect(G_OBJECT(close), "clicked", G_CALLBACK(termi_searchbar_close_clicked_cb), win);
+  return hbox;
+}
+
+void termi_search_bar_show(TermiWindow *win)
+{
+  // the regex may have been changed from another window
+  g_signal_handlers_block_by_func(G_OBJECT(win->search_entry), G_CALLBACK(termi_searchbar_entry_changed_cb), win);
+  gtk_entry_set_text(win->search_entry, termi.search_regex ? g_regex_get_pattern(termi.search_regex) : "");
+  g_signal_handlers_unblock_by_func(G_OBJECT(win->search_entry), G_CALLBACK(termi_searchbar_entry_changed_cb), win);
+  gtk_toggle_button_set_active(win->search_wrap, termi.search_wrap);
+  gtk_label_set_text(win->search_status, "");
+
+  gtk_widget_show(win->search_bar);
+  gtk_widget_grab_focus(GTK_WIDGET(win->search_entry));
+  gtk_editable_select_region(GTK_EDITABLE(win->search_entry), 0, -1);
+  // show matches of the current regex
+  TermiTab *tab = termi_window_get_cur_tab(win);
+  if( tab->vte != NULL ) {
+    gtk_widget_queue_draw(GTK_WIDGET(tab->vte));
+  }
+}
+
+void termi_search_bar_hide(TermiWindow *win)
+{
+  if( win->search_compile_id != 0 ) {
+    // apply what has been typed, for find next/previous
+    g_source_remove(win->search_compile_id);
+    termi_searchbar_compile_cb(win);
+  }
+  gtk_widget_hide(win->search_bar);
+  TermiTab *tab = termi_window_get_cur_tab(win);
+  if( tab->vte != NULL ) {
+    gtk_widget_grab_focus(GTK_WIDGET(tab->vte));
+    gtk_widget_queue_draw(GTK_WIDGET(tab->vte));
+  }
+}
+
+void termi_search_set_regex(GRegex *regex)
+{
+  if( termi.search_regex ) {
+    g_regex_unref(termi.search_regex);
+  }
+  termi.search_regex = regex;
+
+  GList *win_it;
+  for( win_it=termi.windows; win_it!=NULL; win_it=win_it->next ) {
+    TermiWindow *win = win_it->data;
+    gint npages = gtk_notebook_get_n_pages(win->notebook);
+    gint i;
+    for( i=0; i<npages; i++ ) {
+      TermiTab *tab = termi_tab_from_index(win, i);
+      if( tab->vte != NULL ) {
+        vte_terminal_search_set_gregex(tab->vte, termi.search_regex);
+        termi_tab_search_hits_clear(tab);
+        gtk_widget_queue_draw(GTK_WIDGET(tab->vte));
+      }
+    }
+  }
+}
+
+gboolean termi_search_incremental(TermiTab *tab)
+{
+  if( tab->vte == NULL ) {
+    return FALSE;
+  }
+  // search from the bottom, the selected match would be skipped otherwise
+  vte_terminal_select_none(tab->vte);
+  // don't fall back to the archive: it is slow and would be read on each key
+  return vte_terminal_search_find_previous(tab->vte);
+}
+
+void termi_tab_search_hits_clear(TermiTab *tab)
+{
+  if( tab->search_hits != NULL ) {
+    g_array_free(tab->search_hits, TRUE);
+    tab->search_hits = NULL;
+  }
+}
+
+void termi_tab_search_hits_draw(TermiTab *tab, GdkEventExpose *ev)
+{
+  VteTerminal *vte = tab->vte;
+  if( termi.search_regex == NULL || !gtk_widget_get_visible(tab->win->search_bar) ) {
+    return;
+  }
+  glong top = gtk_adjustment_get_value(vte_terminal_get_adjustment(vte));
+
+  if( tab->search_hits == NULL ) {
+    // match the screen only, rows may span several bytes (one attribute per byte)
+    tab->search_hits = g_array_new(FALSE, FALSE, sizeof(TermiSearchHit));
+    GArray *attrs = g_array_new(FALSE, FALSE, sizeof(VteCharAttributes));
+    gchar *text = vte_terminal_get_text_range(vte, top, 0, top + vte->row_count - 1, vte->column_count - 1,
+                                              NULL, NULL, attrs);
+    if( text != NULL ) {
+      GMatchInfo *info = NULL;
+      g_regex_match(termi.search_regex, text, 0, &info);
+      while( g_match_info_matches(info) ) {
+        gint start, end;
+        g_match_info_fetch_pos(info, 0, &start, &end);
+        TermiSearchHit hit = { -1, 0, 0 };
+        gint i;
+        for( i=start; i<end && i<(gint)attrs->len; i++ ) {
+          if( text[i] == '\n' ) {
+            continue;
+          }
+          const VteCharAttributes *attr = &g_array_index(attrs, VteCharAttributes, i);
+          if( attr->row != hit.row ) {
+            if( hit.row >= 0 ) {
+              g_array_append_val(tab->search_hits, hit);
+            }
+            hit.row = attr->row;
+            hit.col = attr->column;
+          }
+          hit.ncols = attr->column - hit.col + 1;
+        }
+        if( hit.row >= 0 ) {
+          g_array_append_val(tab->search_hits, hit);
+        }
+        g_match_info_next(info, NULL);
+      }
+      g_match_info_free(info);
+      g_free(text);
+    }
+    g_array_free(attrs, TRUE);
+  }
+  if( tab->search_hits->len == 0 ) {
+    return;
+  }
+
+  GtkBorder *border = NULL;
+  gtk_widget_style_get(GTK_WIDGET(vte), "inner-border", &border, NULL);
+  gint pad_x = 0;
+  gint pad_y = 0;
+  if( border != NULL ) {
+    pad_x = border->left;
+    pad_y = border->top;
+    gtk_border_free(border);
+  }
+  glong char_x = vte_terminal_get_char_width(vte);
+  glong char_y = vte_terminal_get_char_height(vte);
+
+  cairo_t *cr = gdk_cairo_create(ev->window);
+  gdk_cairo_region(cr, ev->region);
+  cairo_clip(cr);
+  cairo_set_source_rgba(cr, 1.0, 0.8, 0.0, 0.35);
+  guint i;
+  for( i=0; i<tab->search_hits->len; i++ ) {
+    const TermiSearchHit *hit = &g_array_index(tab->search_hits, TermiSearchHit, i);
+    cairo_rectangle(cr, pad_x + hit->col * char_x, pad_y + (hit->row - top) * char_y,
+                    hit->ncols * char_x, char_y);
+  }
+  cairo_fill(cr);
+  cairo_destroy(cr);
+}
+
+void termi_search_find(TermiTab *tab, int way)
+{
+  if( way > 0 ) {
+    vte_terminal_search_find_next(tab->vte);
+  } else if( way < 0 ) {
+    if( !vte_terminal_search_find_previous(tab->vte) && termi.infinite_scrollback ) {
+      // not in the terminal, look further back
+      termi_tab_archive_find(tab, termi.search_regex);
+    }
+  } else {
+    g_assert(FALSE);
+  }
+}
+
+/// Columns of the result list of termi_find_all_start().
+enum {
+  TERMI_FIND_ALL_COL_TITLE,
+  TERMI_FIND_ALL_COL_ROW,
+  TERMI_FIND_ALL_COL_EXCERPT,
+  TERMI_FIND_ALL_COL_TAB,
+  TERMI_FIND_ALL_NCOLS
+};
+
+void termi_find_all_start(TermiWindow *win)
+{
+  if( termi.search_regex == NULL ) {
+    termi_search_bar_show(win);
+    return;
+  }
+  TermiFindAll *find = g_new0(TermiFindAll, 1);
+  find->ref = 1;
+  find->regex = g_regex_ref(termi.search_regex);
+  find->pool = g_thread_pool_new((GFunc)termi_find_all_search_cb, find, TERMI_FIND_ALL_THREADS, FALSE, NULL);
+  // most recently used tabs first
+  GList *it;
+  for( it=termi.tab_lru.head; it!=NULL; it=it->next ) {
+    g_queue_push_tail(&find->tabs, it->data);
+  }
+
+  find->dlg = GTK_DIALOG(gtk_dialog_new_with_buttons(
+      "Find in all tabs", win->winmain, GTK_DIALOG_DESTROY_WITH_PARENT,
+      GTK_STOCK_CLOSE, GTK_RESPONSE_CLOSE, NULL));
+  gtk_window_set_default_size(GTK_WINDOW(find->dlg), 640, 320);
+  find->store = gtk_list_store_new(TERMI_FIND_ALL_NCOLS, G_TYPE_STRING, G_TYPE_LONG, G_TYPE_STRING, G_TYPE_POINTER);
+  GtkTreeView *view = GTK_TREE_VIEW(gtk_tree_view_new_with_model(GTK_TREE_MODEL(find->store)));
+  g_object_unref(find->store);
+  GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
+  gtk_tree_view_insert_column_with_attributes(view, -1, "Tab", renderer, "text", TERMI_FIND_ALL_COL_TITLE, NULL);
+  gtk_tree_view_insert_column_with_attributes(view, -1, "Line", renderer, "text", TERMI_FIND_ALL_COL_ROW, NULL);
+  gtk_tree_view_insert_column_with_attributes(view, -1, "Text", renderer, "text", TERMI_FIND_ALL_COL_EXCERPT, NULL);
+  GtkWidget *scrolled = gtk_scrolled_window_new(NULL, NULL);
+  gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+  gtk_container_add(GTK_CONTAINER(scrolled), GTK_WIDGET(view));
+  gtk_box_pack_start(GTK_BOX(find->dlg->vbox), scrolled, TRUE, TRUE, 5);
+
+  g_signal_connect(G_OBJECT(find->dlg), "response", G_CALLBACK(gtk_widget_destroy), NULL);
+  g_signal_connect(G_OBJECT(find->dlg), "destroy", G_CALLBACK(termi_find_all_destroy_cb), find);
+  g_signal_connect(G_OBJECT(view), "row-activated", G_CALLBACK(termi_find_all_row_activated_cb), find);
+  gtk_widget_show_all(GTK_WIDGET(find->dlg));
+
+  find->snapshot_id = g_idle_add((GSourceFunc)termi_find_all_snapshot_cb, find);
+}
+
+void termi_find_all_unref(TermiFindAll *find)
+{
+  if( !g_atomic_int_dec_and_test(&find->ref) ) {
+    return;
+  }
+  // last reference is never released by a pool thread
+  g_thread_pool_free(find->pool, FALSE, FALSE);
+  g_regex_unref(find->regex);
+  g_queue_clear(&find->tabs);
+  g_free(find);
+}
+
+gboolean termi_tab_exists(TermiTab *tab)
+{
+  return g_queue_find(&termi.tab_lru, tab) != NULL;
+}
+
+#endif
+
+
+void termi_winmain_destroy_cb(GtkWindow *winmain, TermiWindow *win)
+{
+  // pages are removed after this handler, don't track them
+  g_signal_handlers_disconnect_by_func(G_OBJECT(win->notebook), G_CALLBACK(termi_notebook_switch_page_cb), win);
+#if VTE_CHECK_VERSION(0,26,0)
+  // last window: save the session while its tabs are still there
+  if( termi.session_enabled && !termi.quitting && !termi.daemon && termi.windows->next == NULL ) {
+    termi_session_save_now();
+  }
+#endif
+  termi.windows = g_list_remove(termi.windows, win);
+#if VTE_CHECK_VERSION(0,26,0)
+  if( win->search_compile_id != 0 ) {
+    g_source_remove(win->search_compile_id);
+  }
+#endif
+  g_free(win);
+  gboolean keep_running = termi.daemon;
+#if VTE_CHECK_VERSION(0,26,0)
+  keep_running = keep_running || termi.bench != NULL;  // next benchmark opens a new window
+#endif
+  if( termi.windows == NULL && !keep_running ) {
+    termi_quit();
+  }
+}
+
+gboolean termi_winmain_delete_event_cb(GtkWindow *winmain, GdkEvent *ev, TermiWindow *win)
+{
+  // check for running processes
+  GString *running = NULL;
+  gint npages = gtk_notebook_get_n_pages(win->notebook);
+  gint i;
+  for( i=0; i<npages; i++ ) {
+    TermiTab *tab = termi_tab_from_index(win, i);
+    if( !termi_tab_has_running_processes(tab) ) {
+      continue;
+    }
+    if( running == NULL ) {
+      running = g_string_new("There are processes still running.");
+    }
+#if VTE_CHECK_VERSION(0,26,0)
+    // don't update: commands finishing now would be notified
+    if( tab->fg_command != NULL ) {
+      gchar duration[32];
+      termi_format_duration(g_get_monotonic_time() - tab->fg_start, duration, sizeof(duration));
+      g_string_append_printf(running, "\n    %s: %s (%s)", gtk_label_get_text(tab->lbl), tab->fg_command, duration);
+    }
+#endif
+  }
+  if( running == NULL ) {
+    return FALSE; // quit
+  }
+  g_string_append(running, "\nQuit anyway?");
+  GtkWidget *dlg = gtk_message_dialog_new(
+      winmain, GTK_DIALOG_MODAL, GTK_MESSAGE_QUESTION, GTK_BUTTONS_NONE,
+      "%s", running->str);
+  g_string_free(running, TRUE);
+  gtk_dialog_add_buttons(GTK_DIALOG(dlg),
+                         GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+                         GTK_STOCK_QUIT, GTK_RESPONSE_ACCEPT,
+                         NULL);
+  gtk_dialog_set_default_response(GTK_DIALOG(dlg), GTK_RESPONSE_ACCEPT);
+  gint response = gtk_dialog_run(GTK_DIALOG(dlg));
+  gtk_widget_destroy(dlg);
+  if( response == GTK_RESPONSE_ACCEPT ) {
+    return FALSE;
+  } else {
+    return TRUE;
+  }
+}
+
+gboolean termi_winmain_key_press_event_cb(GtkWindow *winmain, GdkEventKey *ev, TermiWindow *win)
+{
+  if( ev->type != GDK_KEY_PRESS ) {
+    return FALSE; // should not happen
+  }
+#if VTE_CHECK_VERSION(0,26,0)
+  if( termi.latency_trace && win->cur_tab != NULL && win->cur_tab->vte != NULL ) {
+    termi_tab_latency_key(win->cur_tab);
+  }
+#endif
+  GdkModifierType mod = ev->state & gtk_accelerator_get_default_mod_mask();
+#if VTE_CHECK_VERSION(0,26,0)
+  if( mod == 0 && ev->keyval == GDK_Escape && win->cur_tab != NULL && win->cur_tab->paste != NULL ) {
+    termi_tab_paste_stop(win->cur_tab);
+    return TRUE;
+  }
+#endif
+  GHashTable *table = win->key_prefix;
+  if( table == NULL ) {
+    // ordinary typing: bindings never start with a printable key
+    if( (mod & ~GDK_SHIFT_MASK) == 0 && g_unichar_isprint(gdk_keyval_to_unicode(ev->keyval)) ) {
+      return termi_window_type_key(win);
+    }
+    table = termi.key_bindings;
+  } else if( ev->is_modifier ) {
+    return TRUE; // wait for the next key of the sequence
+  }
+  win->key_prefix = NULL;
+
+  gint64 id = termi_key_id(mod, ev->keyval);
+  TermiKeyNode *node = g_hash_table_lookup(table, &id);
+  if( node != NULL ) {
+    if( node->next != NULL ) {
+      win->key_prefix = node->next;
+    } else {
+      node->cb(win);
+    }
+  } else if( table != termi.key_bindings ) {
+    // unbound sequence: drop it
+  } else if( mod == 0 && ev->keyval == GDK_Menu ) {
+    TermiTab *tab = termi_window_get_cur_tab(win);
+    termi_menu_popup(tab, (GdkEvent *)ev, tab->vte != NULL);
+  } else {
+    return termi_window_type_key(win);
+  }
+  return TRUE; // handled
+}
+
+gboolean termi_winmain_key_release_event_cb(GtkWindow *winmain, GdkEventKey *ev, TermiWindow *win)
+{
+#if VTE_CHECK_VERSION(0,26,0)
+  termi.typing_tab = NULL;
+#endif
+  return FALSE;
+}
+
+gboolean termi_winmain_focus_in_event_cb(GtkWindow *winmain, GdkEvent *ev, TermiWindow *win)
+{
+  gtk_window_set_urgency_hint(winmain, FALSE);
+  // keep the most recently focused window first
+  termi.windows = g_list_remove(termi.windows, win);
+  termi.windows = g_list_prepend(termi.windows, win);
+#if VTE_CHECK_VERSION(0,26,0)
+  // output of the visible tab is no longer throttled
+  if( win->cur_tab != NULL && win->cur_tab->vte != NULL ) {
+    termi_tab_throttle_flush(win->cur_tab);
+  }
+#endif
+  return FALSE;
+}
+
+void termi_notebook_switch_page_cb(GtkNotebook *notebook, gpointer ptr, gint index, TermiWindow *win)
+{
+  TermiTab *tab = termi_tab_from_index(win, index);
+  if( tab->lru_link != termi.tab_lru.head ) {
+    g_queue_unlink(&termi.tab_lru, tab->lru_link);
+    g_queue_push_head_link(&termi.tab_lru, tab->lru_link);
+  }
+  if( tab->lazy_link != NULL ) {
+    termi_tab_spawn(tab);
+  }
+#if VTE_CHECK_VERSION(0,26,0)
+  termi_tab_wake(tab);
+#endif
+  if( tab->conf_serial != termi.conf_serial ) {
+    termi_tab_apply_conf(tab);  // changed while hidden
+  }
+  termi_tab_apply_font(tab);
+  termi_scrollback_budget_apply();
+  if( tab == win->cur_tab ) {
+    return;
+  }
+  win->prev_tab = win->cur_tab;
+  win->cur_tab = tab;
+#if VTE_CHECK_VERSION(0,26,0)
+  if( tab->vte != NULL ) {
+    termi_tab_throttle_flush(tab);
+  }
+#endif
+#if VTE_CHECK_VERSION(0,26,0)
+  if( win->prev_tab != NULL ) {
+    termi_tab_hibernate_schedule(win->prev_tab);
+  }
+#endif
+}
+
+
+void termi_menu_open_match_cb(TermiTab *tab, GtkMenuItem *item)
+{
+  if( termi.menu_match != NULL ) { // should always be true
+    termi_match_open(termi.menu_matcher, termi.menu_match);
+  }
+}
+
+void termi_menu_copy_match_cb(TermiTab *tab, GtkMenuItem *item)
+{
+  if( termi.menu_match != NULL ) { // should always be true
+    gtk_clipboard_set_text(gtk_clipboard_get(GDK_SELECTION_CLIPBOARD), termi.menu_match, -1);
+  }
+}
+
+void termi_menu_copy_selection_cb(TermiTab *tab, GtkMenuItem *item)
+{
+  if( vte_terminal_get_has_selection(tab->vte) ) {
+    vte_terminal_copy_clipboard(tab->vte);
+  }
+}
+
+void termi_menu_paste_cb(TermiTab *tab, GtkMenuItem *item)
+{
+#if VTE_CHECK_VERSION(0,26,0)
+  termi_tab_paste_clipboard(tab);
+#else
+  vte_terminal_paste_clipboard(tab->vte);
+#endif
+}
+
+#if VTE_CHECK_VERSION(0,26,0)
+void termi_menu_log_cb(TermiTab *tab, GtkCheckMenuItem *item)
+{
+  if( gtk_check_menu_item_get_active(item) ) {
+    if( tab->log == NULL ) {
+      tab->log = termi_log_new(tab, FALSE);
+    }
+  } else if( tab->log != NULL ) {
+    termi_log_close(tab->log);
+    tab->log = NULL;
+  }
+}
+
+void termi_menu_record_cb(TermiTab *tab, GtkCheckMenuItem *item)
+{
+  if( gtk_check_menu_item_get_active(item) ) {
+    if( tab->cast == NULL ) {
+      tab->cast = termi_log_new(tab, TRUE);
+    }
+  } else if( tab->cast != NULL ) {
+    termi_log_close(tab->cast);
+    tab->cast = NULL;
+  }
+}
+
+void termi_menu_broadcast_cb(TermiTab *tab, GtkCheckMenuItem *item)
+{
+  termi_tab_set_broadcast(tab, gtk_check_menu_item_get_active(item));
+}
+
+void termi_menu_paste_file_cb(TermiTab *tab, GtkMenuItem *item)
+{
+  GtkWidget *dlg = gtk_file_chooser_dialog_new(
+      "Paste file", tab->win->winmain, GTK_FILE_CHOOSER_ACTION_OPEN,
+      GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+      GTK_STOCK_PASTE, GTK_RESPONSE_ACCEPT,
+      NULL);
+  gtk_dialog_set_default_response(GTK_DIALOG(dlg), GTK_RESPONSE_ACCEPT);
+  if( tab->wdir != NULL ) {
+    gtk_file_chooser_set_current_folder(GTK_FILE_CHOOSER(dlg), tab->wdir);
+  }
+  if( gtk_dialog_run(GTK_DIALOG(dlg)) == GTK_RESPONSE_ACCEPT ) {
+    // streamed from disk, never loaded at once
+    GFile *file = gtk_file_chooser_get_file(GTK_FILE_CHOOSER(dlg));
+    GError *gerror = NULL;
+    GFileInputStream *stream = g_file_read(file, NULL, &gerror);
+    if( stream == NULL ) {
+      termi_error("cannot paste file: %s", gerror->message);
+      g_error_free(gerror);
+    } else {
+      goffset size = 0;
+      GFileInfo *info = g_file_input_stream_query_info(stream, G_FILE_ATTRIBUTE_STANDARD_SIZE, NULL, NULL);
+      if( info != NULL ) {
+        size = g_file_info_get_size(info);
+        g_object_unref(info);
+      }
+      termi_tab_paste_start(tab, G_INPUT_STREAM(stream), size);
+    }
+    g_object_unref(file);
+  }
+  gtk_widget_destroy(dlg);
+}
+#endif
+
+void termi_menu_set_tab_title_cb(TermiTab *tab, GtkMenuItem *item)
+{
+  GtkDialog *dlg = GTK_DIALOG(gtk_dialog_new_with_buttons(
+      "Set tab title", tab->win->winmain, GTK_DIALOG_MODAL,
+      GTK_STOCK_CANCEL, GTK_RESPONSE_REJECT,
+      GTK_STOCK_OK, GTK_RESPONSE_ACCEPT, NULL));
+  gtk_dialog_set_default_response(dlg, GTK_RESPONSE_ACCEPT);
+
+  GtkEntry *entry = GTK_ENTRY(gtk_entry_new());
+  gtk_entry_set_text(entry, gtk_label_get_text(tab->lbl));
+  gtk_entry_set_activates_default(entry, TRUE);
+  GtkWidget *check = gtk_check_button_new_with_label("Allow terminal to change tab title");
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(check), !termi.force_tab_title);
+
+  gtk_box_pack_start(GTK_BOX(dlg->vbox), GTK_WIDGET(entry), TRUE, TRUE, 5);
+  gtk_box_pack_start(GTK_BOX(dlg->vbox), check, FALSE, FALSE, 5);
+  gtk_widget_show_all(dlg->vbox);
+
+  g_signal_connect(G_OBJECT(entry), "changed", G_CALLBACK(termi_dlgtitle_entry_changed_cb), dlg);
+
+  if( gtk_dialog_run(dlg) == GTK_RESPONSE_ACCEPT ) {
+    termi_tab_set_title(tab, gtk_entry_get_text(entry));
+    //TODO make this option local to the tab
+    termi.force_tab_title = !gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(check));
+  }
+
+  gtk_widget_destroy(GTK_WIDGET(dlg));
+}
+
+void termi_menu_new_tab_cb(TermiTab *tab, GtkMenuItem *item)
+{
+  termi_tab_new(tab->win, NULL, NULL, FALSE);
+}
+
+void termi_menu_close_tab_cb(TermiTab *tab, GtkMenuItem *item)
+{
+  termi_tab_del(tab);
+}
+
+void termi_menu_select_font_cb(TermiTab *tab, GtkMenuItem *item)
+{
+  GtkWidget *dlg = gtk_font_selection_dialog_new("Select terminal font");
+  if( termi.vte_font != NULL ) {
+    gtk_font_selection_dialog_set_font_name(GTK_FONT_SELECTION_DIALOG(dlg),
+                                            pango_font_description_to_string(termi.vte_font));
+  }
+  if( gtk_dialog_run(GTK_DIALOG(dlg)) == GTK_RESPONSE_OK ) {
+    gchar *s = gtk_font_selection_dialog_get_font_name(GTK_FONT_SELECTION_DIALOG(dlg));
+    if( s != NULL ) {
+      termi_set_vte_font( pango_font_description_from_string(s) );
+      g_free(s);
+    }
+  }
+  gtk_widget_destroy(dlg);
+}
+
+void termi_menu_select_colors_cb(TermiTab *tab, GtkMenuItem *item)
+{
+  GtkDialog *dlg = GTK_DIALOG(gtk_dialog_new_with_buttons(
+      "Select terminal colors", tab->win->winmain, GTK_DIALOG_MODAL,
+      GTK_STOCK_CANCEL, GTK_RESPONSE_REJECT,
+      GTK_STOCK_OK, GTK_RESPONSE_ACCEPT, NULL));
+  gtk_dialog_set_default_response(dlg, GTK_RESPONSE_ACCEPT);
+
+  GtkWidget *button_fg = gtk_color_button_new_with_color(&termi.vte_fg_color);
+  GtkWidget *button_bg = gtk_color_button_new_with_color(&termi.vte_bg_color);
+  GtkWidget *toggle_cursor = gtk_toggle_button_new_with_label("Default");
+  GtkWidget *button_cursor = gtk_color_button_new();
+  if( termi.vte_cursor_color_default ) {
+    gtk_color_button_set_color(GTK_COLOR_BUTTON(button_cursor), &termi.vte_fg_color);
+    gtk_widget_set_sensitive(button_cursor, FALSE);
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(toggle_cursor), TRUE);
+  } else {
+    gtk_color_button_set_color(GTK_COLOR_BUTTON(button_cursor), &termi.vte_cursor_color);
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(toggle_cursor), FALSE);
+  }
+  g_signal_connect(G_OBJECT(toggle_cursor), "toggled", G_CALLBACK(termi_dlgcolor_cursor_toggled_cb), button_cursor);
+
+  GtkTable *table = GTK_TABLE(gtk_table_new(3, 3, FALSE));
+  GtkWidget *lbl;
+  lbl = gtk_label_new("Foreground color:"); gtk_misc_set_alignment(GTK_MISC(lbl), 0,0);
+  gtk_table_attach(table, lbl, 0,1,0,1, GTK_FILL,0, 5,2);
+  lbl = gtk_label_new("Background color:"); gtk_misc_set_alignment(GTK_MISC(lbl), 0,0);
+  gtk_table_attach(table, lbl, 0,1,1,2, GTK_FILL,0, 5,2);
+  lbl = gtk_label_new("Cursor color:");    gtk_misc_set_alignment(GTK_MISC(lbl), 0,0);
+  gtk_table_attach(table, lbl, 0,1,2,3, GTK_FILL,0, 5,2);
+  gtk_table_attach(table, button_fg,     1,2,0,1, 0,0, 5,2);
+  gtk_table_attach(table, button_bg,     1,2,1,2, 0,0, 5,2);
+  gtk_table_attach(table, button_cursor, 1,2,2,3, 0,0, 5,2);
+  gtk_table_attach(table, toggle_cursor, 2,3,2,3, 0,0, 5,2);
+
+  gtk_box_pack_start(GTK_BOX(dlg->vbox), GTK_WIDGET(table), FALSE, FALSE, 10);
+  gtk_widget_show_all(dlg->vbox);
+
+  if( gtk_dialog_run(dlg) == GTK_RESPONSE_ACCEPT ) {
+    GdkColor fg, bg;
+    gtk_color_button_get_color(GTK_COLOR_BUTTON(button_fg), &fg);
+    gtk_color_button_get_color(GTK_COLOR_BUTTON(button_bg), &bg);
+    if( gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(toggle_cursor)) ) {
+      termi_set_vte_colors(&fg, &bg, NULL);
+    } else {
+      GdkColor cursor;
+      gtk_color_button_get_color(GTK_COLOR_BUTTON(button_cursor), &cursor);
+      termi_set_vte_colors(&fg, &bg, &cursor);
+    }
+  }
+
+  gtk_widget_destroy(GTK_WIDGET(dlg));
+}
+
+void termi_menu_conf_reload_cb(TermiTab *tab, GtkMenuItem *item)
+{
+  termi_conf_load();
+}
+
+void termi_conf_monitor_changed_cb(GFileMonitor *monitor, GFile *file, GFile *other, GFileMonitorEvent event, void *data)
+{
+  if( event != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT && event != G_FILE_MONITOR_EVENT_CREATED ) {
+    return;
+  }
+  // editors may write in several steps, wait for the last one
+  if( termi.cfg_reload_id != 0 ) {
+    g_source_remove(termi.cfg_reload_id);
+  }
+  termi.cfg_reload_id = g_timeout_add(TERMI_CONF_RELOAD_DELAY_MS, termi_conf_reload_cb, NULL);
+}
+
+#if GLIB_CHECK_VERSION(2,36,0)
+void termi_conf_save_thread(GTask *task, gpointer source, GKeyFile *changes, GCancellable *cancellable)
+{
+  GError *gerror = NULL;
+  gchar *data = termi_conf_save_merge(termi.cfg_file, changes, &gerror);
+  if( data == NULL ) {
+    g_task_return_error(task, gerror);
+  } else {
+    g_task_return_pointer(task, data, g_free);
+  }
+}
+
+void termi_conf_save_done_cb(GObject *source, GAsyncResult *res, void *data)
+{
+  termi.cfg_saving = FALSE;
+  GError *gerror = NULL;
+  gchar *cfg_data = g_task_propagate_pointer(G_TASK(res), &gerror);
+  if( cfg_data == NULL ) {
+    termi_error("failed to save configuration: %s", gerror->message);
+    g_error_free(gerror);
+  } else {
+    // don't reload what has just been saved
+    g_free(termi.cfg_data);
+    termi.cfg_data = cfg_data;
+  }
+  if( termi_conf_is_dirty() ) {
+    termi_conf_save_start();  // modified during the save
+  }
+}
+#endif
+
+gboolean termi_conf_reload_cb(void *data)
+{
+  termi.cfg_reload_id = 0;
+  gchar *cfg_data = NULL;
+  if( !g_file_get_contents(termi.cfg_file, &cfg_data, NULL, NULL) ) {
+    return FALSE;  // removed, or being replaced
+  }
+  if( g_strcmp0(cfg_data, termi.cfg_data) != 0 ) {
+    termi_conf_load();
+  }
+  g_free(cfg_data);
+  return FALSE;
+}
+
+void termi_menu_conf_save_cb(TermiTab *tab, GtkMenuItem *item)
+{
+  termi_conf_save();
+}
+
+void termi_menu_save_conf_at_exit_cb(TermiTab *tab, GtkCheckMenuItem *item)
+{
+  termi.save_conf_at_exit = gtk_check_menu_item_get_active(item);
+}
+
+
+#if VTE_CHECK_VERSION(0,26,0)
+void termi_tab_child_watch_cb(GPid pid, gint status, TermiTab *tab)
+{
+  g_spawn_close_pid(pid);
+  tab->child_watch_id = 0;
+  tab->pid = -1; // avoid check for running processes
+  termi_tab_del(tab);
+}
+
+void termi_child_reap_cb(GPid pid, gint status, void *data)
+{
+  g_spawn_close_pid(pid);
+}
+
+gboolean termi_tab_hibernate_cb(TermiTab *tab)
+{
+  // only hibernate idle shells: running programs may redraw the screen or
+  // produce more output than the drain buffer can keep
+  if( termi_tab_has_running_processes(tab) ) {
+    return TRUE;  // retry later
+  }
+  tab->hibernate_id = 0;
+  termi_tab_hibernate(tab);
+  return FALSE;
+}
+
+gboolean termi_tab_tap_cb(GIOChannel *channel, GIOCondition cond, TermiTab *tab)
+{
+  // read everything available, to feed the terminal with large chunks
+  static gchar buf[TERMI_TAP_BATCH_SIZE];
+  int fd = g_io_channel_unix_get_fd(channel);
+  gsize len = 0;
+  gboolean eof = FALSE;
+  while( len < sizeof(buf) ) {
+    ssize_t n = read(fd, buf + len, sizeof(buf) - len);
+    if( n > 0 ) {
+      len += n;
+      tab->output_reads++;
+    } else if( n == -1 && errno == EINTR ) {
+      continue;
+    } else {
+      // EIO when the child side is closed
+      eof = n == 0 || errno != EAGAIN;
+      break;
+    }
+  }
+  if( len > 0 ) {
+    termi_tab_output(tab, buf, len);
+    // commands usually start and end with output (echo, prompt)
+    termi_tab_fg_update(tab);
+  }
+  if( eof ) {
+    tab->tap_id = 0;
+    tab->pid = -1; // avoid check for running processes
+    termi_tab_del(tab);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+gboolean termi_tab_fg_check_cb(TermiTab *tab)
+{
+  tab->fg_check_id = 0;
+  termi_tab_fg_update(tab);
+  return FALSE;
+}
+
+gboolean termi_tab_throttle_cb(TermiTab *tab)
+{
+  // output received since the last tick is fed at once, and rendered once
+  tab->throttle_id = 0;
+  termi_tab_throttle_feed(tab);
+  return FALSE;
+}
+
+gboolean termi_tab_input_cb(GIOChannel *channel, GIOCondition cond, TermiTab *tab)
+{
+  ssize_t n = write(g_io_channel_unix_get_fd(channel), tab->input->data, tab->input->len);
+  if( n > 0 ) {
+    g_byte_array_remove_range(tab->input, 0, n);
+  } else if( n == -1 && errno != EAGAIN && errno != EINTR ) {
+    g_byte_array_set_size(tab->input, 0);  // child is gone
+  }
+  if( tab->input->len == 0 ) {
+    tab->input_id = 0;
+    return FALSE;
+  }
+  return TRUE;
+}
+
+gboolean termi_tab_paste_cb(GIOChannel *channel, GIOCondition cond, TermiTab *tab)
+{
+  TermiPaste *paste = tab->paste;
+  if( cond & (G_IO_ERR|G_IO_HUP) ) {
+    paste->id = 0;
+    termi_tab_paste_stop(tab);
+    return FALSE;
+  }
+  if( tab->input_id != 0 ) {
+    return TRUE;  // previous chunk not written yet
+  }
+  if( tab->broadcast ) {
+    // wait for slow members too, their pending input would grow without limit
+    guint i;
+    for( i=0; i<termi.broadcast->len; i++ ) {
+      TermiTab *member = g_ptr_array_index(termi.broadcast, i);
+      if( member->input_id != 0 ) {
+        paste->id = g_timeout_add(TERMI_PASTE_RETRY_MS, (GSourceFunc)termi_tab_paste_retry_cb, tab);
+        return FALSE;
+      }
+    }
+  }
+
+  gchar buf[TERMI_PASTE_CHUNK_SIZE];
+  GError *gerror = NULL;
+  gssize n = g_input_stream_read(paste->stream, buf, sizeof(buf), NULL, &gerror);
+  if( n <= 0 ) {
+    if( n < 0 ) {
+      termi_error("paste failed: %s", gerror->message);
+      g_error_free(gerror);
+    }
+    paste->id = 0;
+    termi_tab_paste_stop(tab);
+    return FALSE;
+  }
+  // newlines are sent as carriage returns, as typed
+  gchar *p;
+  for( p=memchr(buf, '\n', n); p!=NULL; p=memchr(p+1, '\n', buf+n-p-1) ) {
+    *p = '\r';
+  }
+  GString *filtered = g_string_sized_new(n);
+  termi_paste_filter(paste, buf, n, filtered);
+  // current tab first, as termi_tab_send()
+  termi_paste_write(paste, tab, buf, n, filtered);
+  if( tab->broadcast ) {
+    guint i;
+    for( i=0; i<termi.broadcast->len; i++ ) {
+      TermiTab *member = g_ptr_array_index(termi.broadcast, i);
+      if( member != tab && member->pty != NULL ) {
+        termi_paste_write(paste, member, buf, n, filtered);
+      }
+    }
+  }
+  g_string_free(filtered, TRUE);
+  paste->done += n;
+  if( paste->size > 0 ) {
+    gtk_progress_bar_set_fraction(paste->bar, MIN(1.0, (gdouble)paste->done / paste->size));
+  } else {
+    gtk_progress_bar_pulse(paste->bar);
+  }
+  return TRUE;
+}
+
+gboolean termi_tab_paste_retry_cb(TermiTab *tab)
+{
+  termi_tab_paste_watch(tab);
+  return FALSE;
+}
+
+gpointer termi_log_thread(TermiLog *log)
+{
+  GOutputStream *out = NULL;
+  gboolean failed = FALSE;  // don't retry to open the file
+  guint part = 0;
+  guint64 size = 0;  // output written to the current file
+  gboolean dirty = FALSE;  // written data not flushed yet
+  GByteArray *pending = log->cast ? g_byte_array_new() : NULL;
+
+  for(;;) {
+    if( out == NULL && !failed ) {
+      out = termi_log_open(log, part++);
+      failed = out == NULL;
+    }
+    guint head = g_atomic_int_get(&log->head);
+    guint tail = log->tail;
+    if( head != tail ) {
+      // write all available data at once
+      guint pos = tail & (TERMI_LOG_RING_SIZE-1);
+      guint len = head - tail;
+      guint n = MIN(len, TERMI_LOG_RING_SIZE - pos);
+      if( out != NULL ) {
+        GError *gerror = NULL;
+        gboolean ok;
+        if( log->cast ) {
+          ok = termi_log_write_cast(log, out, tail, len, pending, &gerror);
+        } else {
+          ok = g_output_stream_write_all(out, log->ring + pos, n, NULL, NULL, &gerror) &&
+              g_output_stream_write_all(out, log->ring, len - n, NULL, NULL, &gerror);
+        }
+        if( !ok ) {
+          termi_error("cannot write log: %s", gerror->message);
+          g_error_free(gerror);
+          g_object_unref(out);
+          out = NULL;
+          failed = TRUE;
+        }
+      }
+      g_atomic_int_set(&log->tail, head);
+      size += len;
+      dirty = TRUE;
+      if( log->rotate_size > 0 && size >= log->rotate_size && out != NULL ) {
+        g_output_stream_close(out, NULL, NULL);
+        g_object_unref(out);
+        out = NULL;
+        size = 0;
+        dirty = FALSE;
+      }
+      continue;
+    }
+    gint dropped = g_atomic_int_get(&log->dropped);
+    if( dropped != 0 ) {
+      g_atomic_int_add(&log->dropped, -dropped);
+      if( out != NULL && !log->cast ) {
+        gchar *s = g_strdup_printf("\n["PROGRAM_NAME": %d bytes dropped]\n", dropped);
+        g_output_stream_write_all(out, s, strlen(s), NULL, NULL, NULL);
+        g_free(s);
+      }
+      continue;
+    }
+    if( g_atomic_int_get(&log->stop) ) {
+      break;
+    }
+
+    // wait for data, flush when idle
+    gboolean idle = FALSE;
+    g_mutex_lock(log->mutex);
+    g_atomic_int_set(&log->sleeping, 1);
+    if( (guint)g_atomic_int_get(&log->head) == head && !g_atomic_int_get(&log->stop) ) {
+#if GLIB_CHECK_VERSION(2,32,0)
+      idle = !g_cond_wait_until(log->cond, log->mutex, g_get_monotonic_time() + G_TIME_SPAN_SECOND);
+#else
+      GTimeVal end_time;
+      g_get_current_time(&end_time);
+      g_time_val_add(&end_time, G_USEC_PER_SEC);
+      idle = !g_cond_timed_wait(log->cond, log->mutex, &end_time);
+#endif
+    }
+    g_atomic_int_set(&log->sleeping, 0);
+    g_mutex_unlock(log->mutex);
+    if( idle && dirty && out != NULL ) {
+      g_output_stream_flush(out, NULL, NULL);
+      dirty = FALSE;
+    }
+  }
+
+  if( out != NULL ) {
+    g_output_stream_close(out, NULL, NULL);
+    g_object_unref(out);
+  }
+  if( pending != NULL ) {
+    g_byte_array_free(pending, TRUE);
+  }
+#if GLIB_CHECK_VERSION(2,32,0)
+  g_mutex_clear(log->mutex);
+  g_cond_clear(log->cond);
+#else
+  g_mutex_free(log->mutex);
+  g_cond_free(log->cond);
+#endif
+  g_free(log->ring);
+  g_free(log->path);
+  g_free(log);
+  return NULL;
+}
+
+void termi_tab_paste_clipboard_cb(GtkClipboard *clipboard, const gchar *text, GtkWidget *page)
+{
+  TermiTab *tab = g_object_get_qdata(G_OBJECT(page), termi.quark);
+  // tab may have been closed meanwhile
+  if( text != NULL && *text != '\0' && gtk_widget_get_parent(page) != NULL ) {
+    gsize len = strlen(text);
+#if GLIB_CHECK_VERSION(2,68,0)
+    GInputStream *stream = g_memory_input_stream_new_from_data(g_memdup2(text, len), len, g_free);
+#else
+    GInputStream *stream = g_memory_input_stream_new_from_data(g_memdup(text, len), len, g_free);
+#endif
+    termi_tab_paste_start(tab, stream, len);
+  }
+  g_object_unref(page);
+}
+
+void termi_tab_commit_cb(VteTerminal *vte, gchar *text, guint size, void *data)
+{
+  TermiTab *tab = termi_tab_from_vte(vte);
+  if( tab == termi.typing_tab ) {
+    termi_tab_send(tab, text, size);
+  } else {
+    termi_tab_write(tab, text, size);  // not typed, don't broadcast
+  }
+}
+
+gboolean termi_tab_expose_event_cb(GtkWidget *widget, GdkEventExpose *ev, void *data)
+{
+  if( termi.bench != NULL ) {
+    termi.bench->frames++;
+  }
+  if( termi.replay != NULL ) {
+    termi.replay->frames++;
+  }
+  TermiTab *tab = termi_tab_from_vte(VTE_TERMINAL(widget));
+  termi_tab_search_hits_draw(tab, ev);
+  termi_tab_latency_draw(tab);
+  return FALSE;
+}
+
+void termi_tab_size_allocate_cb(GtkWidget *widget, GtkAllocation *alloc, void *data)
+{
+  VteTerminal *vte = VTE_TERMINAL(widget);
+  TermiTab *tab = termi_tab_from_vte(vte);
+  if( tab->cast != NULL && (vte->column_count != tab->cast->columns || vte->row_count != tab->cast->rows) ) {
+    gchar size[32];
+    g_snprintf(size, sizeof(size), "%ldx%ld", vte->column_count, vte->row_count);
+    TermiCastRecord rec = { g_get_monotonic_time(), strlen(size), 'r' };
+    termi_log_push(tab->cast, &rec, sizeof(rec), size, rec.len);
+    termi_log_wake(tab->cast);
+    tab->cast->columns = vte->column_count;
+    tab->cast->rows = vte->row_count;
+  }
+  if( tab->pty == NULL ) {
+    return;  // replayed tab
+  }
+  int rows, cols;
+  if( !vte_pty_get_size(tab->pty, &rows, &cols, NULL) ||
+     rows != vte->row_count || cols != vte->column_count ) {
+    vte_pty_set_size(tab->pty, vte->row_count, vte->column_count, NULL);
+  }
+}
+#else
+void termi_tab_child_exited_cb(VteTerminal *vte, void *data)
+{
+  TermiTab *tab = termi_tab_from_vte(vte);
+  tab->pid = -1; // avoid check for running processes
+  termi_tab_del(tab);
+}
+
+void termi_tab_eof_cb(VteTerminal *vte, void *data)
+{
+  TermiTab *tab = termi_tab_from_vte(vte);
+  tab->pid = -1; // avoid check for running processes
+  termi_tab_del(tab);
+}
+#endif
+
+void termi_resize(TermiWindow *win, gint col, gint row)
+{
+  TermiTab *tab = termi_window_get_cur_tab(win);
+  VteTerminal *vte = tab->vte;
+  if( vte == NULL ) {
+    return;
+  }
+  if( col < 0 ) {
+    col = vte->column_count;
+  }
+  if( row < 0 ) {
+    row = vte->row_count;
+  }
+
+  // Update geometry hints of a tab.
+  GtkBorder *border = NULL;
+  gtk_widget_style_get(GTK_WIDGET(vte), "inner-border", &border, NULL);
+  gint pad_x = 0;
+  gint pad_y = 0;
+  if( border != NULL ) {
+    pad_x = border->left + border->right;
+    pad_y = border->top + border->bottom;
+    gtk_border_free(border);
+  }
+  glong char_x = vte_terminal_get_char_width(vte);
+  glong char_y = vte_terminal_get_char_height(vte);
+
+  GdkGeometry geom = {
+    .min_width = pad_x + char_x,
+    .min_height = pad_y + char_y,
+    .base_width = pad_x,
+    .base_height = pad_y,
+    .width_inc = char_x,
+    .height_inc = char_y,
+  };
+  gtk_window_set_geometry_hints(
+      win->winmain, GTK_WIDGET(vte), &geom,
+      GDK_HINT_RESIZE_INC|GDK_HINT_MIN_SIZE|GDK_HINT_BASE_SIZE);
+
+  // not the first tab: resize window too
+  if( gtk_widget_get_realized(GTK_WIDGET(win->winmain)) ) {
+    GtkRequisition req;
+    gtk_widget_size_request(GTK_WIDGET(win->winmain), &req);
+    gint win_width  = req.width;
+    gint win_height = req.height;
+    gtk_widget_size_request(GTK_WIDGET(win->notebook), &req);
+    win_width  -= req.width;
+    win_height -= req.height;
+    win_width  += pad_x + col * char_x;
+    win_height += pad_y + row * char_y;
+    gtk_window_resize(win->winmain, win_width, win_height);
+  }
+}
+
+void termi_tab_decrease_font_size_cb(VteTerminal *vte, void *data)
+{
+  if( termi.vte_font == NULL ) {
+    termi.vte_font = pango_font_description_copy(vte_terminal_get_font(vte));
+  }
+  gint size = pango_font_description_get_size(termi.vte_font);
+  if( size > PANGO_SCALE ) {
+    size -= PANGO_SCALE;
+  }
+  pango_font_description_set_size(termi.vte_font, size);
+  termi_set_vte_font(termi.vte_font);
+}
+
+void termi_tab_increase_font_size_cb(VteTerminal *vte, void *data)
+{
+  if( termi.vte_font == NULL ) {
+    termi.vte_font = pango_font_description_copy(vte_terminal_get_font(vte));
+  }
+  gint size = pango_font_description_get_size(termi.vte_font);
+  size += PANGO_SCALE;
+  pango_font_description_set_size(termi.vte_font, size);
   termi_set_vte_font(termi.vte_font);
 }
 
-void termi_tab_increase_font_size_cb(VteTerminal *vte, void *data)
+gboolean termi_font_update_cb(void *data)
+{
+  termi.font_update_id = 0;
+  GList *win_it;
+  for( win_it=termi.windows; win_it!=NULL; win_it=win_it->next ) {
+    TermiWindow *win = win_it->data;
+    if( gtk_notebook_get_n_pages(win->notebook) == 0 ) {
+      continue;
+    }
+    TermiTab *tab = termi_window_get_cur_tab(win);
+    if( tab->vte == NULL || tab->font_serial == termi.font_serial ) {
+      continue;
+    }
+    // get col,row before window is resized
+    gint col = tab->vte->column_count;
+    gint row = tab->vte->row_count;
+    termi_tab_apply_font(tab);
+    termi_resize(win, col, row);
+  }
+  return FALSE;
+}
+
+void termi_tab_window_title_changed_cb(VteTerminal *vte, void *data)
+{
+  if( !termi.force_tab_title ) {
+    TermiTab *tab = termi_tab_from_vte(vte);
+    termi_tab_set_title(tab, vte->window_title);
+  }
+}
+
+void termi_tab_contents_changed_cb(VteTerminal *vte, void *data)
+{
+  TermiTab *tab = termi_tab_from_vte(vte);
+  if( termi.infinite_scrollback ) {
+    termi_tab_archive_update(tab);
+  }
+#if VTE_CHECK_VERSION(0,26,0)
+  termi_tab_search_hits_clear(tab);
+#endif
+}
+
+void termi_tab_beep_cb(VteTerminal *vte, void *data)
+{
+  TermiWindow *win = termi_tab_from_vte(vte)->win;
+  if( !gtk_window_is_active(win->winmain) ) {
+    gtk_window_set_urgency_hint(win->winmain, TRUE);
+  }
+}
+
+gboolean termi_tab_button_press_event_cb(VteTerminal *vte, GdkEventButton *ev, void *data)
+{
+  if( ev->button == 3 ) {  // right click
+    TermiTab *tab = termi_tab_from_vte(vte);
+    termi_menu_popup(tab, (GdkEvent *)ev, TRUE);
+  } else if( ev->button == 2 ) {  // middle click
+    TermiTab *tab = termi_tab_from_vte(vte);
+    // open match under the cursor, if any
+    guint matcher;
+    gchar *match = termi_get_cursor_match(tab, ev, &matcher);
+    if( match == NULL ) {
+      return FALSE;
+    }
+    termi_match_open(matcher, match);
+    g_free(match);
+  } else {
+    return FALSE;
+  }
+  return TRUE; // handled
+}
+
+gboolean termi_tablbl_button_press_event_cb(GtkWidget *lbl, GdkEventButton *ev, TermiTab *tab)
+{
+  if( ev->button == 3 ) {  // right click
+    termi_menu_popup(tab, (GdkEvent *)ev, FALSE);
+  } else if( ev->button == 2 ) {  // middle click
+    termi_tab_del(tab);
+  } else {
+    return FALSE;
+  }
+  return TRUE; // handled
+}
+
+#if VTE_CHECK_VERSION(0,26,0)
+gboolean termi_shell_pool_refill_cb(void *data)
+{
+  if( g_queue_get_length(&termi.shell_pool) >= termi.shell_pool_size ) {
+    if( termi.shell_pool_size == 0 || termi_shell_pool_has_wdir() ) {
+      termi.shell_pool_refill_id = 0;
+      return FALSE;
+    }
+    // replace the oldest shell, running elsewhere
+    termi_shell_pool_kill(g_queue_peek_head(&termi.shell_pool));
+  }
+
+  // spawn a single shell per call to keep the UI responsive
+  GError *gerror = NULL;
+  gchar *argv[2] = { termi_get_user_shell(), NULL };
+  VtePty *pty;
+  GPid pid;
+  gboolean gret = termi_spawn(argv, termi.shell_pool_wdir, &pty, &pid, &gerror);
+  g_free(argv[0]);
+  if( !gret ) {
+    termi_error("cannot spawn shell for pool: %s", gerror->message);
+    g_error_free(gerror);
+    termi.shell_pool_refill_id = 0;
+    return FALSE;
+  }
+
+  TermiPooledShell *shell = g_new0(TermiPooledShell, 1);
+  shell->pty = pty;
+  shell->pid = pid;
+  shell->wdir = g_strdup(termi.shell_pool_wdir);
+  shell->watch_id = g_child_watch_add(pid, (GChildWatchFunc)termi_shell_pool_child_exited_cb, shell);
+  g_queue_push_tail(&termi.shell_pool, shell);
+  return TRUE;
+}
+
+void termi_shell_pool_child_exited_cb(GPid pid, gint status, TermiPooledShell *shell)
+{
+  // killed, or exited while waiting in the pool
+  g_queue_remove(&termi.shell_pool, shell);
+  if( shell->pty != NULL ) {
+    g_object_unref(shell->pty);
+  }
+  g_spawn_close_pid(pid);
+  g_free(shell->wdir);
+  g_free(shell);
+}
+#endif
+
+#if GLIB_CHECK_VERSION(2,36,0)
+gboolean termi_sigusr1_cb(void *data)
+{
+  termi_debug_dump();
+  return TRUE;
+}
+#endif
+
+gboolean termi_lazy_tabs_cb(void *data)
+{
+  // spawn a single tab per call to keep the UI responsive
+  TermiTab *tab = g_queue_peek_head(&termi.lazy_tabs);
+  if( tab != NULL ) {
+    termi_tab_spawn(tab);
+  }
+  if( g_queue_is_empty(&termi.lazy_tabs) ) {
+    termi.lazy_tabs_id = 0;
+    return FALSE;
+  }
+  return TRUE;
+}
+
+void termi_dlgcolor_cursor_toggled_cb(GtkToggleButton *toggle, GtkWidget *button)
+{
+  gtk_widget_set_sensitive(button, !gtk_toggle_button_get_active(toggle));
+}
+
+void termi_dlgtitle_entry_changed_cb(GtkEntry *entry, GtkDialog *dlg)
+{
+  gtk_dialog_set_response_sensitive(dlg, GTK_RESPONSE_ACCEPT, *gtk_entry_get_text(entry) != '\0');
+}
+
+#if VTE_CHECK_VERSION(0,26,0)
+void termi_searchbar_entry_changed_cb(GtkEntry *entry, TermiWindow *win)
+{
+  // compile once typing pauses
+  if( win->search_compile_id != 0 ) {
+    g_source_remove(win->search_compile_id);
+  }
+  win->search_compile_id = g_timeout_add(TERMI_SEARCH_DEBOUNCE_MS, (GSourceFunc)termi_searchbar_compile_cb, win);
+}
+
+gboolean termi_searchbar_compile_cb(TermiWindow *win)
+{
+  win->search_compile_id = 0;
+  const gchar *txt = gtk_entry_get_text(win->search_entry);
+  if( termi.search_regex && strcmp(txt, g_regex_get_pattern(termi.search_regex)) == 0 ) {
+    return FALSE;  // unchanged
+  }
+  GRegex *regex = NULL;
+  if( *txt != '\0' ) {
+    GError *gerror = NULL;
+    regex = g_regex_new(txt, G_REGEX_OPTIMIZE, 0, &gerror);
+    if( gerror ) {
+      // keep the previous regex, likely a prefix of the pattern being typed
+      gtk_label_set_text(win->search_status, gerror->message);
+      g_error_free(gerror);
+      return FALSE;
+    }
+  }
+  termi_search_set_regex(regex);
+  if( regex != NULL && !termi_search_incremental(termi_window_get_cur_tab(win)) ) {
+    gtk_label_set_text(win->search_status, "Not found");
+  } else {
+    gtk_label_set_text(win->search_status, "");
+  }
+  return FALSE;
+}
+
+gboolean termi_searchbar_key_press_event_cb(GtkWidget *widget, GdkEventKey *ev, TermiWindow *win)
+{
+  if( ev->keyval == GDK_Escape ) {
+    termi_search_bar_hide(win);
+    return TRUE;
+  } else if( ev->keyval == GDK_Return || ev->keyval == GDK_KP_Enter ) {
+    if( win->search_compile_id != 0 ) {
+      g_source_remove(win->search_compile_id);
+      termi_searchbar_compile_cb(win);
+    }
+    if( termi.search_regex ) {
+      // the last match is already selected by the incremental search
+      termi_search_find(termi_window_get_cur_tab(win), (ev->state & GDK_SHIFT_MASK) ? +1 : -1);
+    }
+    return TRUE;
+  }
+  return FALSE;
+}
+
+void termi_searchbar_wrap_toggled_cb(GtkToggleButton *toggle, TermiWindow *win)
+{
+  termi.search_wrap = gtk_toggle_button_get_active(toggle);
+  GList *win_it;
+  for( win_it=termi.windows; win_it!=NULL; win_it=win_it->next ) {
+    TermiWindow *win2 = win_it->data;
+    gint npages = gtk_notebook_get_n_pages(win2->notebook);
+    gint i;
+    for( i=0; i<npages; i++ ) {
+      TermiTab *tab = termi_tab_from_index(win2, i);
+      if( tab->vte != NULL ) {
+        vte_terminal_search_set_wrap_around(tab->vte, termi.search_wrap);
+      }
+    }
+  }
+}
+
+void termi_searchbar_close_clicked_cb(GtkButton *button, TermiWindow *win)
+{
+  termi_search_bar_hide(win);
+}
+
+void termi_tab_adjustment_value_changed_cb(GtkAdjustment *adj, TermiTab *tab)
+{
+  termi_tab_search_hits_clear(tab);
+}
+
+gboolean termi_find_all_snapshot_cb(TermiFindAll *find)
+{
+  // the tab may have been closed or hibernated since the previous call
+  if( find->tab != NULL && (!termi_tab_exists(find->tab) || find->tab->vte == NULL) ) {
+    find->tab = NULL;
+  }
+  // snapshot a bounded number of rows per call to keep the UI responsive
+  while( find->tab == NULL ) {
+    find->tab = g_queue_pop_head(&find->tabs);
+    if( find->tab == NULL ) {
+      find->snapshot_id = 0;
+      return FALSE;  // done
+    }
+    if( !termi_tab_exists(find->tab) || find->tab->vte == NULL ) {
+      find->tab = NULL;
+    } else {
+      find->row = gtk_adjustment_get_lower(vte_terminal_get_adjustment(find->tab->vte));
+    }
+  }
+
+  VteTerminal *vte = find->tab->vte;
+  glong end_row = gtk_adjustment_get_upper(vte_terminal_get_adjustment(vte));
+  glong last_row = MIN(find->row + TERMI_FIND_ALL_ROWS, end_row) - 1;
+  gchar *text = vte_terminal_get_text_range(vte, find->row, 0, last_row, vte->column_count - 1,
+                                            NULL, NULL, NULL);
+  if( text != NULL ) {
+    TermiFindAllChunk *chunk = g_new0(TermiFindAllChunk, 1);
+    chunk->find = find;
+    chunk->tab = find->tab;
+    chunk->row = find->row;
+    chunk->text = text;
+    g_atomic_int_inc(&find->ref);
+    find->pending++;
+    g_thread_pool_push(find->pool, chunk, NULL);
+  }
+  find->row = last_row + 1;
+  if( find->row >= end_row ) {
+    find->tab = NULL;
+  }
+  return TRUE;
+}
+
+void termi_find_all_search_cb(TermiFindAllChunk *chunk, TermiFindAll *find)
+{
+  chunk->hits = g_array_new(FALSE, FALSE, sizeof(glong));
+  chunk->excerpts = g_ptr_array_new_with_free_func(g_free);
+  if( !g_atomic_int_get(&find->canceled) ) {
+    // rows are counted from newlines, soft-wrapped lines count as one
+    const gchar *text = chunk->text;
+    const gchar *line = text;
+    glong row = chunk->row;
+    GMatchInfo *info;
+    g_regex_match(find->regex, text, 0, &info);
+    while( g_match_info_matches(info) ) {
+      gint start, end;
+      g_match_info_fetch_pos(info, 0, &start, &end);
+      const gchar *p;
+      for( p=line; (p=strchr(p, '\n')) != NULL && p < text+start; p++ ) {
+        row++;
+        line = p + 1;
+      }
+      const gchar *eol = strchr(line, '\n');
+      gsize len = eol == NULL ? strlen(line) : (gsize)(eol - line);
+      const gchar *cut = g_utf8_offset_to_pointer(line, MIN(g_utf8_strlen(line, len), TERMI_FIND_ALL_EXCERPT));
+      g_array_append_val(chunk->hits, row);
+      g_ptr_array_add(chunk->excerpts, g_strndup(line, cut - line));
+      if( eol == NULL ) {
+        break;
+      }
+      // a single result per line
+      g_match_info_free(info);
+      row++;
+      line = eol + 1;
+      g_regex_match(find->regex, line, 0, &info);
+      text = line;
+    }
+    g_match_info_free(info);
+  }
+  g_idle_add((GSourceFunc)termi_find_all_result_cb, chunk);
+}
+
+gboolean termi_find_all_result_cb(TermiFindAllChunk *chunk)
+{
+  TermiFindAll *find = chunk->find;
+  find->pending--;
+  if( !find->canceled && termi_tab_exists(chunk->tab) ) {
+    const gchar *title = gtk_label_get_text(chunk->tab->lbl);
+    guint i;
+    for( i=0; i<chunk->hits->len; i++ ) {
+      GtkTreeIter iter;
+      gtk_list_store_append(find->store, &iter);
+      gtk_list_store_set(find->store, &iter,
+                         TERMI_FIND_ALL_COL_TITLE, title,
+                         TERMI_FIND_ALL_COL_ROW, g_array_index(chunk->hits, glong, i),
+                         TERMI_FIND_ALL_COL_EXCERPT, g_ptr_array_index(chunk->excerpts, i),
+                         TERMI_FIND_ALL_COL_TAB, chunk->tab,
+                         -1);
+    }
+    find->nresults += chunk->hits->len;
+  }
+  if( !find->canceled ) {
+    gboolean done = find->pending == 0 && find->snapshot_id == 0;
+    gchar *title = g_strdup_printf("Find in all tabs: %u results%s", find->nresults, done ? "" : "...");
+    gtk_window_set_title(GTK_WINDOW(find->dlg), title);
+    g_free(title);
+  }
+  g_free(chunk->text);
+  g_array_free(chunk->hits, TRUE);
+  g_ptr_array_free(chunk->excerpts, TRUE);
+  g_free(chunk);
+  termi_find_all_unref(find);
+  return FALSE;
+}
+
+void termi_find_all_destroy_cb(GtkDialog *dlg, TermiFindAll *find)
+{
+  // remaining chunks are skipped by the pool, then released
+  g_atomic_int_set(&find->canceled, 1);
+  if( find->snapshot_id != 0 ) {
+    g_source_remove(find->snapshot_id);
+    find->snapshot_id = 0;
+  }
+  termi_find_all_unref(find);
+}
+
+void termi_find_all_row_activated_cb(GtkTreeView *view, GtkTreePath *path, GtkTreeViewColumn *col, TermiFindAll *find)
+{
+  GtkTreeIter iter;
+  if( !gtk_tree_model_get_iter(GTK_TREE_MODEL(find->store), &iter, path) ) {
+    return;
+  }
+  TermiTab *tab;
+  glong row;
+  gtk_tree_model_get(GTK_TREE_MODEL(find->store), &iter,
+                     TERMI_FIND_ALL_COL_ROW, &row, TERMI_FIND_ALL_COL_TAB, &tab, -1);
+  if( !termi_tab_exists(tab) ) {
+    return;  // tab closed since
+  }
+  termi_tab_focus(tab);
+  gtk_window_present(tab->win->winmain);
+  if( tab->vte != NULL ) {
+    // show the line at the top, scrollback may have moved since
+    GtkAdjustment *adj = vte_terminal_get_adjustment(tab->vte);
+    gdouble max = gtk_adjustment_get_upper(adj) - gtk_adjustment_get_page_size(adj);
+    gtk_adjustment_set_value(adj, CLAMP(row, gtk_adjustment_get_lower(adj), max));
+  }
+}
+#endif
+
+
+
+void termi_kb_new_tab_cb(TermiWindow *win)   { termi_tab_new(win, NULL, NULL, FALSE); }
+void termi_kb_left_tab_cb(TermiWindow *win)  { termi_tab_focus_rel(win, -1); }
+void termi_kb_right_tab_cb(TermiWindow *win) { termi_tab_focus_rel(win, +1); }
+void termi_kb_prev_tab_cb(TermiWindow *win)  { if( win->prev_tab ) termi_tab_focus(win->prev_tab); }
+void termi_kb_tab_1_cb(TermiWindow *win) { termi_tab_focus_nth(win, 0); }
+void termi_kb_tab_2_cb(TermiWindow *win) { termi_tab_focus_nth(win, 1); }
+void termi_kb_tab_3_cb(TermiWindow *win) { termi_tab_focus_nth(win, 2); }
+void termi_kb_tab_4_cb(TermiWindow *win) { termi_tab_focus_nth(win, 3); }
+void termi_kb_tab_5_cb(TermiWindow *win) { termi_tab_focus_nth(win, 4); }
+void termi_kb_tab_6_cb(TermiWindow *win) { termi_tab_focus_nth(win, 5); }
+void termi_kb_tab_7_cb(TermiWindow *win) { termi_tab_focus_nth(win, 6); }
+void termi_kb_tab_8_cb(TermiWindow *win) { termi_tab_focus_nth(win, 7); }
+void termi_kb_tab_9_cb(TermiWindow *win) { termi_tab_focus_nth(win, 8); }
+void termi_kb_copy_cb(TermiWindow *win)
+{
+  TermiTab *tab = termi_window_get_cur_tab(win);
+  if( tab->vte != NULL && vte_terminal_get_has_selection(tab->vte) ) {
+    vte_terminal_copy_clipboard(tab->vte);
+  }
+}
+void termi_kb_paste_cb(TermiWindow *win)
+{
+  TermiTab *tab = termi_window_get_cur_tab(win);
+  if( tab->vte != NULL ) {
+#if VTE_CHECK_VERSION(0,26,0)
+    termi_tab_paste_clipboard(tab);
+#else
+    vte_terminal_paste_clipboard(tab->vte);
+#endif
+  }
+}
+void termi_kb_history_cb(TermiWindow *win)
+{
+  TermiTab *tab = termi_window_get_cur_tab(win);
+  if( tab->vte != NULL && termi.infinite_scrollback ) {
+    termi_tab_archive_update(tab);
+  }
+  if( tab->archive_fd != -1 ) {
+    termi_tab_archive_show(tab, 0);
+  }
+}
+
+#if VTE_CHECK_VERSION(0,26,0)
+void termi_kb_find_cb(TermiWindow *win)
+{
+  termi_search_bar_show(win);
+}
+void termi_kb_find_next_cb(TermiWindow *win)
+{
+  if( termi.search_regex ) {
+    TermiTab *tab = termi_window_get_cur_tab(win);
+    termi_search_find(tab, +1);
+  } else {
+    termi_search_bar_show(win);
+  }
+}
+void termi_kb_find_prev_cb(TermiWindow *win)
+{
+  if( termi.search_regex ) {
+    TermiTab *tab = termi_window_get_cur_tab(win);
+    termi_search_find(tab, -1);
+  } else {
+    termi_search_bar_show(win);
+  }
+}
+void termi_kb_find_all_cb(TermiWindow *win)
+{
+  termi_find_all_start(win);
+}
+void termi_kb_broadcast_cb(TermiWindow *win)
+{
+  TermiTab *tab = termi_window_get_cur_tab(win);
+  termi_tab_set_broadcast(tab, !tab->broadcast);
+}
+#endif
+
+
+TermiTab *termi_tab_from_vte(VteTerminal *vte)
+{
+  TermiTab *tab = g_object_get_qdata(G_OBJECT(vte), termi.quark);
+  g_assert( tab != NULL );
+  return tab;
+}
+
+TermiTab *termi_tab_from_index(TermiWindow *win, gint index)
+{
+  GtkWidget *page = gtk_notebook_get_nth_page(win->notebook, index);
+  g_assert( page != NULL );
+  TermiTab *tab = g_object_get_qdata(G_OBJECT(page), termi.quark);
+  g_assert( tab != NULL );
+  return tab;
+}
+
+gint termi_tab_get_index(TermiTab *tab)
+{
+  gint index = gtk_notebook_page_num(tab->win->notebook, tab->page);
+  g_assert( index != -1 );
+  return index;
+}
+
+
+typedef struct {
+  gchar *title;
+  gchar *cwd;
+  gchar *command;
+} termi_opt_tab_t;
+
+typedef struct {
+  gboolean version;
+  gboolean daemon;
+  gboolean client;
+  gboolean same_window;
+  gboolean startup_time;
+  gint64 launch_time;
+  gchar *execute;
+  gchar *title;
+  gchar *geometry;
+  GArray *tabs;
+  gboolean bench;
+  gint bench_tabs;
+  gint bench_size;
+  gchar *bench_generate;
+  gchar *replay;
+  gboolean replay_fast;
+  gboolean restore;
+} termi_opt_data_t;
+
+void termi_opt_tab_free(gpointer data)
+{
+  termi_opt_tab_t *d = data;
+  g_free(d->title);
+  g_free(d->cwd);
+  g_free(d->command);
+}
+
+gboolean termi_opt_tab_cb(const gchar *option_name, const gchar *value,
+                          gpointer data, GError **error)
+{
+  const gchar *sep = g_strstr_len(value, -1, "  ");
+  const gchar *end = value + strlen(value);
+  termi_opt_data_t *d = data;
+  termi_opt_tab_t tab = { NULL, NULL, NULL };
+  if(sep == NULL) {
+    if(end > value) {
+      tab.command = g_strdup(value);
+    }
+  } else {
+    if(sep > value) {
+      tab.title = g_strndup(value, sep-value);
+    }
+    const gchar *sep2 = g_strstr_len(sep+2, -1, "  ");
+    if(sep2 == NULL) {
+      if(end > sep+2) {
+        tab.command = g_strdup(sep+2);
+      }
+    } else {
+      if(sep2 > sep+2) {
+        tab.cwd = g_strndup(sep+2, sep2-(sep+2));
+      }
+      if(end > sep2+2) {
+        tab.command = g_strdup(sep2+2);
+      }
+    }
+  }
+  g_array_append_val(d->tabs, tab);
+  return TRUE;
+}
+
+
+void termi_opt_data_init(termi_opt_data_t *d)
+{
+  memset(d, 0, sizeof(*d));
+  d->tabs = g_array_new(FALSE, FALSE, sizeof(termi_opt_tab_t));
+  d->bench_tabs = 1;
+  d->bench_size = 16;
+}
+
+void termi_opt_data_clear(termi_opt_data_t *d)
+{
+  g_free(d->execute);
+  g_free(d->title);
+  g_free(d->geometry);
+  g_free(d->bench_generate);
+  g_free(d->replay);
+  // g_array_set_clear_func() requires GLib 2.32
+  guint i;
+  for( i=0; i<d->tabs->len; i++ ) {
+    termi_opt_tab_free(&g_array_index(d->tabs, termi_opt_tab_t, i));
+  }
+  g_array_free(d->tabs, TRUE);
+}
+
+/** @brief Parse command line options.
+ *
+ * If \e gtk is TRUE, GTK options are parsed too (the display is not opened
+ * yet). Otherwise, unknown options are ignored.
+ */
+gboolean termi_opt_parse(termi_opt_data_t *d, int *argc, char ***argv, gboolean gtk, GError **error)
+{
+  const GOptionEntry opt_entries[] = {
+    { "execute", 'e', 0, G_OPTION_ARG_STRING, &d->execute, "Execute given command in first tab", NULL },
+    { "title", 't', 0, G_OPTION_ARG_STRING, &d->title, "Window title", NULL },
+    { "version", 0, 0, G_OPTION_ARG_NONE, &d->version, "Display version number", NULL },
+    { "geometry", 0, 0, G_OPTION_ARG_STRING, &d->geometry, "X geometry for the window", NULL },
+    { "tab", 0, 0, G_OPTION_ARG_CALLBACK, &termi_opt_tab_cb, "Create a tab; format is \"[tab-title  [cwd  ]][command]\"", NULL },
+    { "daemon", 0, 0, G_OPTION_ARG_NONE, &d->daemon, "Keep running in background and open windows for clients", NULL },
+    { "client", 0, 0, G_OPTION_ARG_NONE, &d->client, "Ask the running daemon to open the window", NULL },
+    { "same-window", 0, 0, G_OPTION_ARG_NONE, &d->same_window, "With --client, add tabs to the last focused window", NULL },
+    { "startup-time", 0, 0, G_OPTION_ARG_NONE, &d->startup_time, "Print the time from launch to the first output of the first tab", NULL },
+    { "launch-time", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_INT64, &d->launch_time, NULL, NULL },
+#if VTE_CHECK_VERSION(0,26,0)
+    { "bench", 0, 0, G_OPTION_ARG_NONE, &d->bench, "Run benchmarks, print results as JSON (use Xvfb for reproducible results)", NULL },
+    { "bench-tabs", 0, 0, G_OPTION_ARG_INT, &d->bench_tabs, "Tabs run for each benchmark (default: 1)", "N" },
+    { "bench-size", 0, 0, G_OPTION_ARG_INT, &d->bench_size, "Output size of each benchmark tab, in MiB (default: 16)", "MB" },
+    { "bench-generate", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING, &d->bench_generate, NULL, NULL },
+    { "replay", 0, 0, G_OPTION_ARG_FILENAME, &d->replay, "Replay an asciicast recording", "FILE" },
+    { "replay-fast", 0, 0, G_OPTION_ARG_NONE, &d->replay_fast, "With --replay, feed output as fast as possible and print results as JSON", NULL },
+    { "restore", 0, 0, G_OPTION_ARG_NONE, &d->restore, "Reopen windows and tabs of the last session", NULL },
+#endif
+    { NULL, 0, 0, 0, NULL, NULL, NULL }
+  };
+
+  GOptionContext *opt_context = g_option_context_new("- mini terminal emulator");
+  GOptionGroup *opt_group = g_option_group_new(NULL, NULL, NULL, d, NULL);
+  g_option_context_set_main_group(opt_context, opt_group);
+  g_option_context_add_main_entries(opt_context, opt_entries, NULL);
+  if( gtk ) {
+    g_option_context_add_group(opt_context, gtk_get_option_group(FALSE));
+  } else {
+    g_option_context_set_ignore_unknown_options(opt_context, TRUE);
+  }
+  gboolean ret = g_option_context_parse(opt_context, argc, argv, error);
+  g_option_context_free(opt_context);
+  return ret;
+}
+
+/** @brief Create tabs requested by command line options.
+ *
+ * Tabs are added to a new window, or to the last focused one with
+ * --same-window.
+ * If \e cwd is not NULL, it is used for tabs without working directory.
+ *
+ * @return FALSE if no tab has been created.
+ */
+gboolean termi_opt_open_tabs(const termi_opt_data_t *opt, const gchar *cwd)
+{
+  gboolean new_win = !opt->same_window || termi.windows == NULL;
+  TermiWindow *win = new_win ? termi_window_new() : termi.windows->data;
+  gint npages_init = gtk_notebook_get_n_pages(win->notebook);
+
+  if( opt->title != NULL) {
+    gtk_window_set_title(win->winmain, opt->title);
+  }
+
+  // only the first tab is spawned immediately, if lazy tabs are enabled
+  gboolean lazy = FALSE;
+  gboolean has_opt_tabs = opt->tabs->len > 0;
+  if(opt->execute || !has_opt_tabs) {
+    // "default" tab
+    TermiTab *tab = termi_tab_new(win, opt->execute, cwd, FALSE);
+    if(tab == NULL) {
+      termi_error("failed to create default tab");
+    } else {
+      lazy = termi.lazy_tabs_enabled;
+    }
+  }
+  if(has_opt_tabs) {
+    guint i;
+    for(i=0; i<opt->tabs->len; i++) {
+      termi_opt_tab_t *opt_tab = &g_array_index(opt->tabs, termi_opt_tab_t, i);
+      TermiTab *tab = termi_tab_new(win, opt_tab->command, opt_tab->cwd ? opt_tab->cwd : cwd, lazy);
+      if(tab == NULL) {
+        termi_error("failed to create tab '%s'", opt_tab->title);
+      } else {
+        lazy = termi.lazy_tabs_enabled;
+        if(opt_tab->title != NULL) {
+          termi_tab_set_title(tab, opt_tab->title);
+        }
+      }
+    }
+  }
+
+  if( gtk_notebook_get_n_pages(win->notebook) == npages_init ) {
+    if( new_win ) {
+      termi_window_close(win);
+    }
+    return FALSE;
+  }
+  if( !new_win ) {
+    if( opt->startup_time ) {
+      termi_tab_from_index(win, npages_init)->launch_time = opt->launch_time;
+    }
+    gtk_window_present(win->winmain);
+    return TRUE;
+  }
+
+  termi_resize(win, 80, 24);
+
+  // set geometry (has to be done before showing the main window)
+  if( opt->geometry != NULL ) {
+    if( !gtk_window_parse_geometry(win->winmain, opt->geometry) ) {
+      termi_error("invalid geometry string");
+    }
+  }
+
+  gtk_widget_show_all(GTK_WIDGET(win->winmain));
+
+  // select first tab
+  TermiTab *tab = termi_tab_from_index(win, 0);
+  if( opt->startup_time ) {
+    tab->launch_time = opt->launch_time;
+  }
+  termi_tab_focus(tab);
+  if( tab->vte == NULL ) {
+    return TRUE;
+  }
+  //XXX:hack colors are not properly set for the first tab, it seems the window
+  // has to ben realized first.
+  // This may be fixed in newer versions of libvte.
+  // copy paste from term_tab_new()
+  vte_terminal_set_color_foreground(tab->vte, &termi.vte_fg_color);
+  vte_terminal_set_color_background(tab->vte, &termi.vte_bg_color);
+  if( !termi.vte_cursor_color_default ) {
+    vte_terminal_set_color_cursor(tab->vte, &termi.vte_cursor_color);
+  }
+  return TRUE;
+}
+
+
+gboolean termi_socket_addr(struct sockaddr_un *addr)
+{
+  if( termi.socket_path == NULL ) {
+    // one daemon per display
+    gchar *name = g_strdup_printf(PROGRAM_NAME"-%s.sock", g_getenv("DISPLAY") ? g_getenv("DISPLAY") : "");
+    g_strdelimit(name, "/", '_');
+#if GLIB_CHECK_VERSION(2,28,0)
+    termi.socket_path = g_build_filename(g_get_user_runtime_dir(), name, NULL);
+#else
+    termi.socket_path = g_build_filename(g_get_user_cache_dir(), name, NULL);
+#endif
+    g_free(name);
+  }
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if( strlen(termi.socket_path) >= sizeof(addr->sun_path) ) {
+    termi_error("socket path is too long: %s", termi.socket_path);
+    return FALSE;
+  }
+  strcpy(addr->sun_path, termi.socket_path);
+  return TRUE;
+}
+
+/** @brief Process a client request.
+ *
+ * Request is made of NUL-terminated fields: client working directory, then
+ * command line arguments.
+ *
+ * @return NULL on success, an allocated error message otherwise.
+ */
+gchar *termi_daemon_process_request(const gchar *data, gsize len)
+{
+  GPtrArray *args = g_ptr_array_new();
+  const gchar *p;
+  for( p=data; p<data+len; p+=strlen(p)+1 ) {
+    g_ptr_array_add(args, (gchar *)p);
+  }
+  if( args->len == 0 ) {
+    g_ptr_array_free(args, TRUE);
+    return g_strdup("empty request");
+  }
+  const gchar *cwd = g_ptr_array_index(args, 0);
+  g_ptr_array_index(args, 0) = PROGRAM_NAME;
+  int argc = args->len;
+  g_ptr_array_add(args, NULL);
+  char **argv = (char **)args->pdata;
+
+  gchar *ret = NULL;
+  termi_opt_data_t opt_data;
+  termi_opt_data_init(&opt_data);
+  opt_data.launch_time = g_get_monotonic_time();
+  GError *gerror = NULL;
+  if( !termi_opt_parse(&opt_data, &argc, &argv, FALSE, &gerror) ) {
+    ret = g_strdup_printf("option parsing failed: %s", gerror->message);
+    g_error_free(gerror);
+  } else if( !termi_opt_open_tabs(&opt_data, cwd) ) {
+    ret = g_strdup("failed to create tabs");
+  }
+  termi_opt_data_clear(&opt_data);
+  g_ptr_array_free(args, TRUE);
+  return ret;
+}
+
+gboolean termi_daemon_client_read_cb(GIOChannel *channel, GIOCondition cond, GString *req)
+{
+  int fd = g_io_channel_unix_get_fd(channel);
+  char buf[4096];
+  ssize_t n = read(fd, buf, sizeof(buf));
+  if( n > 0 && req->len + n > TERMI_DAEMON_REQUEST_MAX ) {
+    termi_error("daemon client request too large, dropped");
+  } else if( n > 0 ) {
+    g_string_append_len(req, buf, n);
+    return TRUE;
+  } else if( n == -1 && (errno == EINTR || errno == EAGAIN) ) {
+    return TRUE;
+  }
+
+  // request is complete, process it and reply
+  if( n == 0 ) {
+    gchar *reply = termi_daemon_process_request(req->str, req->len);
+    if( reply != NULL ) {
+      send(fd, reply, strlen(reply), MSG_NOSIGNAL);  // ignore errors
+      g_free(reply);
+    }
+  }
+  g_string_free(req, TRUE);
+  close(fd);
+  return FALSE;
+}
+
+gboolean termi_daemon_accept_cb(GIOChannel *channel, GIOCondition cond, void *data)
+{
+  int fd = accept(termi.socket_fd, NULL, NULL);
+  if( fd == -1 ) {
+    if( errno != EINTR && errno != EAGAIN ) {
+      termi_error("failed to accept client: %s", g_strerror(errno));
+    }
+    return TRUE;
+  }
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  GIOChannel *client_channel = g_io_channel_unix_new(fd);
+  g_io_add_watch(client_channel, G_IO_IN|G_IO_HUP|G_IO_ERR, (GIOFunc)termi_daemon_client_read_cb, g_string_new(NULL));
+  g_io_channel_unref(client_channel);
+  return TRUE;
+}
+
+gboolean termi_daemon_start(void)
+{
+  struct sockaddr_un addr;
+  if( !termi_socket_addr(&addr) ) {
+    return FALSE;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+  if( fd == -1 ) {
+    termi_error("cannot create daemon socket: %s", g_strerror(errno));
+    return FALSE;
+  }
+  // check for a running daemon, remove stale socket
+  if( connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 ) {
+    termi_error("a daemon is already running");
+    close(fd);
+    return FALSE;
+  }
+  unlink(addr.sun_path);
+
+  gchar *socket_dir = g_path_get_dirname(termi.socket_path);
+  g_mkdir_with_parents(socket_dir, 0700);
+  g_free(socket_dir);
+  if( bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0 ) {
+    termi_error("cannot listen on %s: %s", termi.socket_path, g_strerror(errno));
+    close(fd);
+    return FALSE;
+  }
+  termi.socket_fd = fd;
+
+  GIOChannel *channel = g_io_channel_unix_new(fd);
+  g_io_add_watch(channel, G_IO_IN, (GIOFunc)termi_daemon_accept_cb, NULL);
+  g_io_channel_unref(channel);
+  return TRUE;
+}
+
+int termi_client_request(gchar **argv, gint64 launch_time)
+{
+  struct sockaddr_un addr;
+  if( !termi_socket_addr(&addr) ) {
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+  if( fd == -1 ) {
+    return -1;
+  }
+  if( connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ) {
+    close(fd);
+    return -1;
+  }
+
+  GString *req = g_string_new(NULL);
+  gchar *cwd = g_get_current_dir();
+  g_string_append_len(req, cwd, strlen(cwd)+1);
+  g_free(cwd);
+  gchar **arg_it;
+  for( arg_it=argv+1; *arg_it!=NULL; arg_it++ ) {
+    g_string_append_len(req, *arg_it, strlen(*arg_it)+1);
+  }
+  // monotonic clock is shared with the daemon, for --startup-time
+  g_string_append_printf(req, "--launch-time=%" G_GINT64_FORMAT, launch_time);
+  g_string_append_c(req, '\0');
+  gsize pos = 0;
+  while( pos < req->len ) {
+    ssize_t n = send(fd, req->str+pos, req->len-pos, MSG_NOSIGNAL);
+    if( n == -1 && errno != EINTR ) {
+      break;
+    }
+    pos += n > 0 ? n : 0;
+  }
+  gboolean sent = pos == req->len;
+  g_string_free(req, TRUE);
+  if( !sent ) {
+    close(fd);
+    return -1;
+  }
+  shutdown(fd, SHUT_WR);
+
+  // reply is empty on success, an error message otherwise
+  GString *reply = g_string_new(NULL);
+  char buf[1024];
+  for(;;) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if( n > 0 ) {
+      g_string_append_len(reply, buf, n);
+    } else if( n == 0 || errno != EINTR ) {
+      break;
+    }
+  }
+  close(fd);
+  int ret = 0;
+  if( reply->len > 0 ) {
+    termi_error("%s", reply->str);
+    ret = 1;
+  }
+  g_string_free(reply, TRUE);
+  return ret;
+}
+
+
+
+#if VTE_CHECK_VERSION(0,26,0)
+
+/// Interval between two measures of main loop stalls, in milliseconds.
+#define TERMI_BENCH_TICK_MS  10
+/// RSS growth allowed on top of scrollback, with infinite scrollback, in MiB.
+#define TERMI_BENCH_RSS_SLACK_MB  32
+
+/// Dense printable ASCII.
+void termi_bench_gen_ascii(GString *buf, guint64 n)
+{
+  guint i;
+  for( i=0; i<79; i++ ) {
+    g_string_append_c(buf, '!' + (n + i) % 94);
+  }
+  g_string_append_c(buf, '\n');
+}
+
+/// Foreground, background and attributes changed on each word.
+void termi_bench_gen_sgr(GString *buf, guint64 n)
+{
+  guint i;
+  for( i=0; i<10; i++ ) {
+    g_string_append_printf(buf, "\033[%u;3%u;4%umword%02u ",
+                           (guint)(n + i) % 2, (guint)(n + i) % 8, (guint)(n + 3*i) % 8, i);
+  }
+  g_string_append(buf, "\033[0m\n");
+}
+
+/// Output scrolled in a region, with some reverse scrolling.
+void termi_bench_gen_scroll(GString *buf, guint64 n)
+{
+  g_string_append(buf, "\033[5;20r\033[20;1H");
+  guint i;
+  for( i=0; i<16; i++ ) {
+    g_string_append_printf(buf, "region line %" G_GUINT64_FORMAT "-%02u\n", n, i);
+  }
+  g_string_append(buf, "\033[5;1H\033M\033M\033[r");
+}
+
+/// Wide CJK characters and combining characters.
+void termi_bench_gen_unicode(GString *buf, guint64 n)
+{
+  guint i;
+  for( i=0; i<20; i++ ) {
+    g_string_append_unichar(buf, 0x4e00 + (n * 20 + i) % 2000);
+  }
+  g_string_append_c(buf, ' ');
+  for( i=0; i<10; i++ ) {
+    g_string_append(buf, "e\xcc\x81");
+  }
+  g_string_append_c(buf, '\n');
+}
+
+/// Short numbered lines, like a build log (run with infinite scrollback).
+void termi_bench_gen_lines(GString *buf, guint64 n)
+{
+  g_string_append_printf(buf, "[%" G_GUINT64_FORMAT "] CC src/file%u.o\n", n, (guint)(n % 1000));
+}
+
+/// Full-screen redraws with cursor addressing.
+void termi_bench_gen_redraw(GString *buf, guint64 n)
+{
+  g_string_append(buf, "\033[H");
+  guint row, col;
+  for( row=1; row<=24; row++ ) {
+    g_string_append_printf(buf, "\033[%u;1H", row);
+    for( col=0; col<80; col++ ) {
+      g_string_append_c(buf, 'A' + (n + row + col) % 26);
+    }
+  }
+}
+
+/// Synthetic output generators, for benchmarks.
+static const struct {
+  const char *name;
+  void (*fill)(GString *buf, guint64 n);  ///< Append a unit of output.
+  gboolean archive;  ///< Run with infinite scrollback, to check that RSS stays flat.
+} termi_bench_generators[] = {
+  { "ascii", termi_bench_gen_ascii, FALSE },
+  { "sgr", termi_bench_gen_sgr, FALSE },
+  { "scroll", termi_bench_gen_scroll, FALSE },
+  { "unicode", termi_bench_gen_unicode, FALSE },
+  { "redraw", termi_bench_gen_redraw, FALSE },
+  { "lines", termi_bench_gen_lines, TRUE },
+};
+
+int termi_bench_generate(const gchar *name, guint size_mb)
+{
+  guint gen;
+  for( gen=0; gen<G_N_ELEMENTS(termi_bench_generators); gen++ ) {
+    if( strcmp(name, termi_bench_generators[gen].name) == 0 ) {
+      break;
+    }
+  }
+  if( gen == G_N_ELEMENTS(termi_bench_generators) ) {
+    termi_error("unknown benchmark generator: %s", name);
+    return 1;
+  }
+
+  guint64 total = (guint64)size_mb << 20;
+  guint64 written = 0;
+  guint64 n = 0;
+  GString *buf = g_string_sized_new(2 * 65536);
+  while( written < total ) {
+    g_string_truncate(buf, 0);
+    while( buf->len < 65536 ) {
+      termi_bench_generators[gen].fill(buf, n++);
+    }
+    gsize pos = 0;
+    while( pos < buf->len ) {
+      ssize_t ret = write(STDOUT_FILENO, buf->str + pos, buf->len - pos);
+      if( ret == -1 && errno != EINTR ) {
+        g_string_free(buf, TRUE);
+        return 1;
+      } else if( ret > 0 ) {
+        pos += ret;
+      }
+    }
+    written += buf->len;
+  }
+  g_string_free(buf, TRUE);
+  return 0;
+}
+
+gboolean termi_bench_start(guint ntabs, guint size_mb)
+{
+  if( ntabs == 0 || size_mb == 0 ) {
+    termi_error("invalid benchmark parameters");
+    return FALSE;
+  }
+  TermiBench *bench = g_new0(TermiBench, 1);
+  bench->ntabs = ntabs;
+  bench->size_mb = size_mb;
+  bench->stalls = g_array_new(FALSE, FALSE, sizeof(gint64));
+  bench->report = g_string_new(NULL);
+  bench->infinite_scrollback = termi.infinite_scrollback;
+  g_string_append_printf(bench->report, "{\n  \"version\": \"%s\",\n  \"tabs\": %u,\n  \"size_mb\": %u,\n  \"results\": [",
+                         VERSION, ntabs, size_mb);
+  termi.bench = bench;
+
+  bench->tick_time = g_get_monotonic_time() + TERMI_BENCH_TICK_MS * 1000;
+  bench->tick_id = g_timeout_add(TERMI_BENCH_TICK_MS, termi_bench_tick_cb, NULL);
+  g_idle_add(termi_bench_next_cb, NULL);
+  return TRUE;
+}
+
+/// Get a memory size of the process from /proc/self/status, in KiB (0 if unknown).
+guint64 termi_bench_proc_status_kb(const gchar *field)
+{
+  gchar *status = NULL;
+  if( !g_file_get_contents("/proc/self/status", &status, NULL, NULL) ) {
+    return 0;
+  }
+  guint64 kb = 0;
+  gchar *p = strstr(status, field);
+  if( p != NULL && p[strlen(field)] == ':' ) {
+    kb = g_ascii_strtoull(p + strlen(field) + 1, NULL, 10);
+  }
+  g_free(status);
+  return kb;
+}
+
+/// Compare two gint64, for sorting.
+gint termi_bench_cmp_int64(gconstpointer a, gconstpointer b)
+{
+  gint64 va = *(const gint64 *)a;
+  gint64 vb = *(const gint64 *)b;
+  return va < vb ? -1 : va > vb;
+}
+
+void termi_bench_tab_done(TermiTab *tab)
+{
+  TermiBench *bench = termi.bench;
+  bench->bytes += tab->output_bytes;
+  bench->lines += tab->output_lines;
+  if( --bench->running > 0 ) {
+    return;
+  }
+
+  // all tabs of the generator are done: report
+  double seconds = (g_get_monotonic_time() - bench->start_time) / 1e6;
+  GArray *stalls = bench->stalls;
+  g_array_sort(stalls, termi_bench_cmp_int64);
+  gint64 p50 = 0, p99 = 0, max = 0;
+  if( stalls->len > 0 ) {
+    p50 = g_array_index(stalls, gint64, stalls->len * 50 / 100);
+    p99 = g_array_index(stalls, gint64, MIN(stalls->len - 1, stalls->len * 99 / 100));
+    max = g_array_index(stalls, gint64, stalls->len - 1);
+  }
+  guint64 rss_peak = termi_bench_proc_status_kb("VmHWM");
+  gchar s_seconds[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar s_mbps[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar s_lps[G_ASCII_DTOSTR_BUF_SIZE];
+  g_ascii_formatd(s_seconds, sizeof(s_seconds), "%.3f", seconds);
+  g_ascii_formatd(s_mbps, sizeof(s_mbps), "%.2f", bench->bytes / 1048576.0 / seconds);
+  g_ascii_formatd(s_lps, sizeof(s_lps), "%.0f", bench->lines / seconds);
+  g_string_append_printf(
+      bench->report,
+      "%s\n    {\"generator\": \"%s\", \"bytes\": %" G_GUINT64_FORMAT ", \"seconds\": %s,"
+      " \"mb_per_s\": %s, \"lines_per_s\": %s, \"frames\": %" G_GUINT64_FORMAT ","
+      " \"stall_us\": {\"p50\": %" G_GINT64_FORMAT ", \"p99\": %" G_GINT64_FORMAT ", \"max\": %" G_GINT64_FORMAT "},"
+      " \"rss_kb\": {\"start\": %" G_GUINT64_FORMAT ", \"peak\": %" G_GUINT64_FORMAT ", \"end\": %" G_GUINT64_FORMAT "}",
+      bench->generator == 0 ? "" : ",", termi_bench_generators[bench->generator].name,
+      bench->bytes, s_seconds, s_mbps, s_lps, bench->frames, p50, p99, max,
+      bench->rss_start, rss_peak, termi_bench_proc_status_kb("VmRSS"));
+  if( termi_bench_generators[bench->generator].archive ) {
+    // archived lines must not stay in memory: only scrollback may grow RSS
+    guint64 bound = (guint64)bench->ntabs * termi.buffer_lines * 80 * TERMI_SCROLLBACK_CELL_SIZE / 1024 +
+        TERMI_BENCH_RSS_SLACK_MB * 1024;
+    gboolean bounded = rss_peak <= bench->rss_start + bound;
+    g_string_append_printf(bench->report, ", \"rss_bound_kb\": %" G_GUINT64_FORMAT ", \"rss_bounded\": %s",
+                           bound, bounded ? "true" : "false");
+    if( !bounded ) {
+      termi_error("benchmark %s: RSS grew by %" G_GUINT64_FORMAT " KiB, more than %" G_GUINT64_FORMAT " KiB",
+                  termi_bench_generators[bench->generator].name, rss_peak - bench->rss_start, bound);
+      termi.exit_status = 1;
+    }
+  }
+  g_string_append_c(bench->report, '}');
+  termi.infinite_scrollback = bench->infinite_scrollback;
+
+  bench->generator++;
+  g_idle_add(termi_bench_next_cb, NULL);
+}
+
+gboolean termi_bench_next_cb(void *data)
+{
+  TermiBench *bench = termi.bench;
+  if( bench->generator == G_N_ELEMENTS(termi_bench_generators) ) {
+    g_string_append(bench->report, "\n  ]\n}\n");
+    g_print("%s", bench->report->str);
+    g_source_remove(bench->tick_id);
+    g_string_free(bench->report, TRUE);
+    g_array_free(bench->stalls, TRUE);
+    g_free(bench);
+    termi.bench = NULL;
+    termi_quit();
+    return FALSE;
+  }
+
+  bench->running = 0;
+  bench->bytes = 0;
+  bench->lines = 0;
+  bench->frames = 0;
+  g_array_set_size(bench->stalls, 0);
+  termi.infinite_scrollback = bench->infinite_scrollback || termi_bench_generators[bench->generator].archive;
+  // reset the peak RSS (VmHWM)
+  int fd = open("/proc/self/clear_refs", O_WRONLY);
+  if( fd != -1 ) {
+    if( write(fd, "5", 1) == -1 ) {
+      // old kernel: peak is the one of the whole process
+    }
+    close(fd);
+  }
+  bench->rss_start = termi_bench_proc_status_kb("VmRSS");
+  bench->start_time = g_get_monotonic_time();
+
+  // generators are run by termi itself
+  gchar *exe = g_file_read_link("/proc/self/exe", NULL);
+  gchar *quoted = g_shell_quote(exe != NULL ? exe : PROGRAM_NAME);
+  gchar *cmd = g_strdup_printf("%s --bench-generate %s --bench-size %u",
+                               quoted, termi_bench_generators[bench->generator].name, bench->size_mb);
+  g_free(quoted);
+  g_free(exe);
+  TermiWindow *win = termi_window_new();
+  guint i;
+  for( i=0; i<bench->ntabs; i++ ) {
+    if( termi_tab_new(win, cmd, NULL, FALSE) != NULL ) {
+      bench->running++;
+    }
+  }
+  g_free(cmd);
+  if( bench->running == 0 ) {
+    termi_error("cannot run benchmark tabs");
+    termi_window_close(win);
+    bench->generator = G_N_ELEMENTS(termi_bench_generators);
+    g_idle_add(termi_bench_next_cb, NULL);
+    return FALSE;
+  }
+  termi_resize(win, 80, 24);
+  gtk_widget_show_all(GTK_WIDGET(win->winmain));
+  return FALSE;
+}
+
+gboolean termi_bench_tick_cb(void *data)
+{
+  TermiBench *bench = termi.bench;
+  gint64 now = g_get_monotonic_time();
+  gint64 stall = now - bench->tick_time;
+  if( stall < 0 ) {
+    stall = 0;
+  }
+  g_array_append_val(bench->stalls, stall);
+  bench->tick_time = now + TERMI_BENCH_TICK_MS * 1000;
+  return TRUE;
+}
+
+
+gboolean termi_replay_start(const gchar *path, gboolean fast)
+{
+  GFile *file = g_file_new_for_commandline_arg(path);
+  GError *gerror = NULL;
+  GFileInputStream *stream = g_file_read(file, NULL, &gerror);
+  g_object_unref(file);
+  if( stream == NULL ) {
+    termi_error("cannot open recording: %s", gerror->message);
+    g_error_free(gerror);
+    return FALSE;
+  }
+  GDataInputStream *in = g_data_input_stream_new(G_INPUT_STREAM(stream));
+  g_object_unref(stream);
+
+  // header: only the terminal size is used
+  gchar *header = g_data_input_stream_read_line(in, NULL, NULL, NULL);
+  if( header == NULL || *header != '{' || strstr(header, "\"version\": 2") == NULL ) {
+    termi_error("invalid recording (asciicast v2 expected): %s", path);
+    g_free(header);
+    g_object_unref(in);
+    return FALSE;
+  }
+  const gchar *p;
+  glong columns = 80, rows = 24;
+  if( (p = strstr(header, "\"width\":")) != NULL ) {
+    columns = strtol(p + 8, NULL, 10);
+  }
+  if( (p = strstr(header, "\"height\":")) != NULL ) {
+    rows = strtol(p + 9, NULL, 10);
+  }
+  g_free(header);
+
+  TermiReplay *replay = g_new0(TermiReplay, 1);
+  replay->path = g_strdup(path);
+  replay->in = in;
+  replay->fast = fast;
+  replay->data = g_string_new(NULL);
+  termi.replay = replay;
+
+  // create a tab without child: don't let it be spawned when selected
+  TermiWindow *win = termi_window_new();
+  g_signal_handlers_block_by_func(G_OBJECT(win->notebook), G_CALLBACK(termi_notebook_switch_page_cb), win);
+  TermiTab *tab = termi_tab_new(win, NULL, NULL, TRUE);
+  g_signal_handlers_unblock_by_func(G_OBJECT(win->notebook), G_CALLBACK(termi_notebook_switch_page_cb), win);
+  g_queue_delete_link(&termi.lazy_tabs, tab->lazy_link);
+  tab->lazy_link = NULL;
+  win->cur_tab = tab;
+  tab->vte = VTE_TERMINAL(vte_terminal_new());
+  g_object_set_qdata(G_OBJECT(tab->vte), termi.quark, tab);
+  termi_tab_attach_vte(tab);
+  replay->tab = tab;
+  termi_resize(win, columns > 0 ? columns : 80, rows > 0 ? rows : 24);
+  gtk_widget_show_all(GTK_WIDGET(win->winmain));
+
+  replay->start_time = g_get_monotonic_time();
+  g_idle_add(termi_replay_next_cb, NULL);
+  return TRUE;
+}
+
+/// Skip a comma and surrounding spaces, between JSON values.
+gboolean termi_replay_skip_comma(const gchar **p)
+{
+  const gchar *s = *p;
+  while( g_ascii_isspace(*s) ) s++;
+  if( *s++ != ',' ) {
+    return FALSE;
+  }
+  while( g_ascii_isspace(*s) ) s++;
+  *p = s;
+  return TRUE;
+}
+
+gboolean termi_replay_read(TermiReplay *replay)
+{
+  for(;;) {
+    gchar *line = g_data_input_stream_read_line(replay->in, NULL, NULL, NULL);
+    if( line == NULL ) {
+      return FALSE;
+    }
+    // [time, "type", "data"]
+    const gchar *p = line;
+    while( g_ascii_isspace(*p) ) p++;
+    gboolean ok = *p == '[';
+    if( ok ) {
+      gchar *end;
+      replay->time = g_ascii_strtod(p + 1, &end);
+      ok = end != p + 1;
+      p = end;
+    }
+    g_string_truncate(replay->data, 0);
+    ok = ok && termi_replay_skip_comma(&p) && termi_json_unescape(&p, replay->data) && replay->data->len > 0;
+    if( ok ) {
+      replay->type = replay->data->str[0];
+      g_string_truncate(replay->data, 0);
+      ok = termi_replay_skip_comma(&p) && termi_json_unescape(&p, replay->data);
+      if( !ok ) {
+        replay->type = 0;
+      }
+    }
+    if( !ok && *line != '\0' ) {
+      termi_error("invalid recording event, ignored: %s", line);
+    }
+    g_free(line);
+    if( ok ) {
+      return TRUE;
+    }
+  }
+}
+
+void termi_replay_done(TermiReplay *replay)
+{
+  if( replay->fast ) {
+    double seconds = (g_get_monotonic_time() - replay->start_time) / 1e6;
+    gchar s_seconds[G_ASCII_DTOSTR_BUF_SIZE];
+    gchar s_mbps[G_ASCII_DTOSTR_BUF_SIZE];
+    g_ascii_formatd(s_seconds, sizeof(s_seconds), "%.3f", seconds);
+    g_ascii_formatd(s_mbps, sizeof(s_mbps), "%.2f", replay->bytes / 1048576.0 / seconds);
+    GString *file = g_string_new(NULL);
+    termi_json_escape(file, replay->path, strlen(replay->path));
+    g_print("{\"version\": \"%s\", \"file\": \"%s\", \"events\": %" G_GUINT64_FORMAT ","
+            " \"bytes\": %" G_GUINT64_FORMAT ", \"seconds\": %s, \"mb_per_s\": %s, \"frames\": %" G_GUINT64_FORMAT "}\n",
+            VERSION, file->str, replay->events, replay->bytes, s_seconds, s_mbps, replay->frames);
+    g_string_free(file, TRUE);
+  }
+  g_object_unref(replay->in);
+  g_string_free(replay->data, TRUE);
+  g_free(replay->path);
+  gboolean fast = replay->fast;
+  g_free(replay);
+  termi.replay = NULL;
+  if( fast ) {
+    termi_quit();
+  }
+}
+
+gboolean termi_replay_next_cb(void *data)
 {
-  gint size = pango_font_description_get_size(termi.vte_font);
-  size += PANGO_SCALE;
-  pango_font_description_set_size(termi.vte_font, size);
-  termi_set_vte_font(termi.vte_font);
+  TermiReplay *replay = termi.replay;
+  for(;;) {
+    if( replay->tab == NULL ) {
+      termi_replay_done(replay);  // tab closed
+      return FALSE;
+    }
+    if( replay->type == 0 && !termi_replay_read(replay) ) {
+      termi_replay_done(replay);
+      return FALSE;
+    }
+    if( !replay->fast ) {
+      gint64 delay = replay->start_time + (gint64)(replay->time * 1e6) - g_get_monotonic_time();
+      if( delay > 0 ) {
+        g_timeout_add(delay / 1000 + 1, termi_replay_next_cb, NULL);
+        return FALSE;
+      }
+    }
+
+    TermiTab *tab = replay->tab;
+    if( replay->type == 'o' ) {
+      vte_terminal_feed(tab->vte, replay->data->str, replay->data->len);
+      replay->bytes += replay->data->len;
+    } else if( replay->type == 'r' ) {
+      glong columns, rows;
+      if( sscanf(replay->data->str, "%ldx%ld", &columns, &rows) == 2 && columns > 0 && rows > 0 ) {
+        termi_resize(tab->win, columns, rows);
+      }
+    }
+    replay->events++;
+    replay->type = 0;
+    if( replay->fast ) {
+      return TRUE;  // let the terminal redraw between events
+    }
+  }
 }
 
-void termi_tab_window_title_changed_cb(VteTerminal *vte, void *data)
+
+/// Session file name, in the session directory.
+#define TERMI_SESSION_FILE  "session"
+/// Prefix of session scrollback files.
+#define TERMI_SESSION_SCROLLBACK_PREFIX  "scrollback-"
+/// Prefix of session groups describing a tab.
+#define TERMI_SESSION_TAB_PREFIX  "Tab "
+
+gchar *termi_session_dir(void)
 {
-  if( !termi.force_tab_title ) {
-    TermiTab *tab = termi_tab_from_vte(vte);
-    termi_tab_set_title(tab, vte->window_title);
-  }
+  return g_build_filename(g_get_user_data_dir(), PROGRAM_NAME, NULL);
 }
 
-void termi_tab_beep_cb(VteTerminal *vte, void *data)
+void termi_session_save_start(void)
 {
-  if( !gtk_window_is_active(termi.winmain) ) {
-    gtk_window_set_urgency_hint(termi.winmain, TRUE);
+  if( termi.session != NULL || termi.session_saving ) {
+    return;  // next snapshot is taken by the timer
   }
+  TermiSession *session = termi_session_new();
+  termi.session = session;
+  session->idle_id = g_idle_add_full(G_PRIORITY_LOW, termi_session_step_cb, NULL, NULL);
 }
 
-gboolean termi_tab_button_press_event_cb(VteTerminal *vte, GdkEventButton *ev, void *data)
+void termi_session_save_now(void)
 {
-  if( ev->button == 3 ) {  // right click
-    TermiTab *tab = termi_tab_from_vte(vte);
-    termi_menu_popup(tab, (GdkEvent *)ev, TRUE);
-  } else if( ev->button == 2 ) {  // middle click
-    TermiTab *tab = termi_tab_from_vte(vte);
-    // open URI under the cursor, if any
-    gchar *uri = termi_get_cursor_uri(tab, ev);
-    if( uri == NULL ) {
-      return FALSE;
-    }
-    termi_open_uri(uri);
-    g_free(uri);
+  if( termi.session_timer_id != 0 ) {
+    g_source_remove(termi.session_timer_id);
+    termi.session_timer_id = 0;
+  }
+  // a snapshot in progress is completed below
+  termi_session_save_wait();
+  TermiSession *session = termi.session;
+  if( session == NULL ) {
+    session = termi_session_new();
   } else {
-    return FALSE;
+    g_source_remove(session->idle_id);
+    session->idle_id = 0;
+    termi.session = NULL;
   }
-  return TRUE; // handled
+  if( session->tabs->len == 0 ) {
+    // all windows are closed, keep the last session to restore
+    termi_session_free(session);
+    return;
+  }
+  while( session->next < session->tabs->len ) {
+    termi_session_snapshot_tab(session, session->next++);
+  }
+  termi_session_write_start(session);
 }
 
-gboolean termi_tablbl_button_press_event_cb(GtkWidget *lbl, GdkEventButton *ev, TermiTab *tab)
+void termi_session_save_wait(void)
 {
-  if( ev->button == 3 ) {  // right click
-    termi_menu_popup(tab, (GdkEvent *)ev, FALSE);
-  } else if( ev->button == 2 ) {  // middle click
-    termi_tab_del(tab);
-  } else {
-    return FALSE;
+  while( termi.session_saving ) {
+    g_main_context_iteration(NULL, TRUE);
   }
-  return TRUE; // handled
 }
 
-void termi_dlgcolor_cursor_toggled_cb(GtkToggleButton *toggle, GtkWidget *button)
+void termi_session_schedule(void)
 {
-  gtk_widget_set_sensitive(button, !gtk_toggle_button_get_active(toggle));
+  if( termi.session_timer_id != 0 || termi.session_save_interval == 0 ) {
+    return;
+  }
+  termi.session_timer_id = g_timeout_add_seconds(termi.session_save_interval, termi_session_timer_cb, NULL);
 }
 
-void termi_dlgtitle_entry_changed_cb(GtkEntry *entry, GtkDialog *dlg)
+TermiSession *termi_session_new(void)
 {
-  gtk_dialog_set_response_sensitive(dlg, GTK_RESPONSE_ACCEPT, *gtk_entry_get_text(entry) != '\0');
+  TermiSession *session = g_new0(TermiSession, 1);
+  session->dir = termi_session_dir();
+  session->kf = g_key_file_new();
+  session->tabs = g_array_new(FALSE, FALSE, sizeof(TermiSessionTab));
+  session->dumps = g_ptr_array_new();
+
+  // most recently focused window last, to be restored on top
+  GList *l;
+  guint window = 0;
+  for( l=g_list_last(termi.windows); l!=NULL; l=l->prev ) {
+    TermiWindow *win = l->data;
+    gint i, n = gtk_notebook_get_n_pages(win->notebook);
+    for( i=0; i<n; i++ ) {
+      TermiSessionTab stab = { termi_tab_from_index(win, i), window };
+      g_array_append_val(session->tabs, stab);
+    }
+    window++;
+  }
+  return session;
 }
 
-#if VTE_CHECK_VERSION(0,26,0)
-void termi_dlgfind_entry_changed_cb(GtkEntry *entry, GtkDialog *dlg)
+void termi_session_free(TermiSession *session)
 {
-  const gchar *txt = gtk_entry_get_text(entry);
-  gboolean sensitive = FALSE;
-  if( *txt == '\0' ) {
-    sensitive = TRUE;
-  } else {
-    GError *gerror = NULL;
-    GRegex *regex = g_regex_new(txt, 0, 0, &gerror);
-    if( gerror ) {
-      sensitive = FALSE;
-      g_error_free(gerror);
-    } else {
-      g_regex_unref(regex);
-      sensitive = TRUE;
+  guint i;
+  for( i=0; i<session->dumps->len; i++ ) {
+    TermiSessionDump *dump = g_ptr_array_index(session->dumps, i);
+    g_free(dump->file);
+    if( dump->text != NULL ) {
+      g_string_free(dump->text, TRUE);
     }
+    g_free(dump);
   }
-  gtk_dialog_set_response_sensitive(dlg, GTK_RESPONSE_ACCEPT, sensitive);
+  g_ptr_array_free(session->dumps, TRUE);
+  g_array_free(session->tabs, TRUE);
+  g_key_file_free(session->kf);
+  g_free(session->data);
+  g_free(session->dir);
+  g_free(session);
 }
-#endif
-
 
-
-void termi_kb_new_tab_cb(void)   { termi_tab_new(NULL, NULL); }
-void termi_kb_left_tab_cb(void)  { termi_tab_focus_rel(-1); }
-void termi_kb_right_tab_cb(void) { termi_tab_focus_rel(+1); }
-void termi_kb_prev_tab_cb(void)  { if( termi.prev_tab ) termi_tab_focus(termi.prev_tab); }
-void termi_kb_copy_cb(void)
+void termi_session_snapshot_tab(TermiSession *session, guint index)
 {
-  TermiTab *tab = termi_tab_from_index(gtk_notebook_get_current_page(termi.notebook));
-  if( vte_terminal_get_has_selection(tab->vte) ) {
-    vte_terminal_copy_clipboard(tab->vte);
+  TermiSessionTab *stab = &g_array_index(session->tabs, TermiSessionTab, index);
+  TermiTab *tab = stab->tab;
+  if( !termi_tab_exists(tab) ) {
+    return;  // closed since the snapshot started
+  }
+  GKeyFile *kf = session->kf;
+  gchar *group = g_strdup_printf(TERMI_SESSION_TAB_PREFIX"%u", index);
+
+  g_key_file_set_integer(kf, group, "Window", stab->window);
+  g_key_file_set_string(kf, group, "Title", gtk_label_get_text(tab->lbl));
+  gchar *cwd = NULL;
+  if( tab->pid >= 0 ) {
+    gchar *p = g_strdup_printf("/proc/%d/cwd", tab->pid);
+    cwd = g_file_read_link(p, NULL); // ignore errors
+    g_free(p);
+  }
+  if( cwd == NULL ) {
+    cwd = g_strdup(tab->wdir);
+  }
+  if( cwd != NULL ) {
+    g_key_file_set_string(kf, group, "Cwd", cwd);
+    g_free(cwd);
+  }
+  if( tab->cmd != NULL ) {
+    g_key_file_set_string(kf, group, "Command", tab->cmd);
+  }
+  if( tab == tab->win->cur_tab ) {
+    g_key_file_set_boolean(kf, group, "Current", TRUE);
+  }
+  if( tab->vte != NULL ) {
+    g_key_file_set_integer(kf, group, "Columns", tab->vte->column_count);
+    g_key_file_set_integer(kf, group, "Rows", tab->vte->row_count);
+  } else if( tab->hibernated ) {
+    g_key_file_set_integer(kf, group, "Columns", tab->columns);
+    g_key_file_set_integer(kf, group, "Rows", tab->rows);
+  }
+
+  if( termi.session_scrollback ) {
+    // throttled output has not been fed yet, it will be saved next time
+    guint64 fed = tab->output_bytes - (tab->throttled != NULL ? tab->throttled->len : 0);
+    if( tab->vte != NULL && (tab->session_file == NULL || tab->session_bytes != fed) ) {
+      GString *text = termi_tab_dump(tab);
+      if( text != NULL ) {
+        g_free(tab->session_file);
+        tab->session_file = g_strdup_printf(TERMI_SESSION_SCROLLBACK_PREFIX"%d-%u.z",
+                                            getpid(), termi.session_file_nb++);
+        tab->session_bytes = fed;
+        TermiSessionDump *dump = g_new(TermiSessionDump, 1);
+        dump->file = g_strdup(tab->session_file);
+        dump->text = text;
+        g_ptr_array_add(session->dumps, dump);
+      }
+    }
+    // unchanged, hibernated or not spawned since restored: keep the previous file
+    const gchar *file = tab->session_file != NULL ? tab->session_file : tab->restore_file;
+    if( file != NULL ) {
+      g_key_file_set_string(kf, group, "Scrollback", file);
+    }
   }
+  g_free(group);
 }
-void termi_kb_paste_cb(void)
+
+void termi_session_write_start(TermiSession *session)
 {
-  TermiTab *tab = termi_tab_from_index(gtk_notebook_get_current_page(termi.notebook));
-  vte_terminal_paste_clipboard(tab->vte);
+  session->data = g_key_file_to_data(session->kf, NULL, NULL);
+  if( session->dumps->len == 0 && g_strcmp0(session->data, termi.session_data) == 0 ) {
+    termi_session_free(session);
+    return;  // nothing changed
+  }
+  g_free(termi.session_data);
+  termi.session_data = g_strdup(session->data);
+#if GLIB_CHECK_VERSION(2,36,0)
+  termi.session_saving = TRUE;
+  GTask *task = g_task_new(NULL, NULL, termi_session_write_done_cb, NULL);
+  g_task_set_task_data(task, session, (GDestroyNotify)termi_session_free);
+  g_task_run_in_thread(task, (GTaskThreadFunc)termi_session_write_thread);
+  g_object_unref(task);
+#else
+  termi_session_write(session);
+  termi_session_free(session);
+#endif
 }
 
-#if VTE_CHECK_VERSION(0,26,0)
-void termi_kb_find_cb(void)
+void termi_session_write(TermiSession *session)
 {
-  if( termi_search_modify() && termi.search_regex ) {
-    TermiTab *tab = termi_tab_from_index(gtk_notebook_get_current_page(termi.notebook));
-    termi_search_find(tab, +1);
+  if( g_mkdir_with_parents(session->dir, 0700) == -1 ) {
+    termi_error("cannot create session directory: %s", g_strerror(errno));
+    return;
+  }
+
+  // scrollback first, the session file must not refer to missing files
+  guint i;
+  for( i=0; i<session->dumps->len; i++ ) {
+    TermiSessionDump *dump = g_ptr_array_index(session->dumps, i);
+    GConverter *conv = G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW, 1));
+    GByteArray *packed = g_byte_array_new();
+    gboolean ok = termi_convert(conv, (guint8 *)dump->text->str, dump->text->len, packed);
+    g_object_unref(conv);
+    g_string_free(dump->text, TRUE);
+    dump->text = NULL;
+    if( ok ) {
+      termi_session_write_file(session, dump->file, (gchar *)packed->data, packed->len);
+    }
+    g_byte_array_free(packed, TRUE);
+  }
+
+  if( !termi_session_write_file(session, TERMI_SESSION_FILE, session->data, strlen(session->data)) ) {
+    return;  // keep files of the previous session
+  }
+
+  // remove scrollback of closed tabs and of previous snapshots, but not
+  // the one of other running instances
+  GHashTable *used = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  gchar **groups = g_key_file_get_groups(session->kf, NULL);
+  gchar **group;
+  for( group=groups; *group!=NULL; group++ ) {
+    gchar *file = g_key_file_get_string(session->kf, *group, "Scrollback", NULL);
+    if( file != NULL ) {
+      g_hash_table_insert(used, file, file);
+    }
   }
+  g_strfreev(groups);
+  GDir *dir = g_dir_open(session->dir, 0, NULL);
+  if( dir != NULL ) {
+    const gchar *name;
+    while( (name = g_dir_read_name(dir)) != NULL ) {
+      if( !g_str_has_prefix(name, TERMI_SESSION_SCROLLBACK_PREFIX) || g_hash_table_lookup(used, name) ) {
+        continue;
+      }
+      pid_t pid = strtol(name + strlen(TERMI_SESSION_SCROLLBACK_PREFIX), NULL, 10);
+      if( pid != getpid() && pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH) ) {
+        continue;  // owned by another instance
+      }
+      gchar *p = g_build_filename(session->dir, name, NULL);
+      unlink(p);
+      g_free(p);
+    }
+    g_dir_close(dir);
+  }
+  g_hash_table_destroy(used);
 }
-void termi_kb_find_next_cb(void)
+
+gboolean termi_session_write_file(TermiSession *session, const gchar *name, const gchar *data, gsize len)
 {
-  if( termi.search_regex || (termi_search_modify() && termi.search_regex) ) {
-    TermiTab *tab = termi_tab_from_index(gtk_notebook_get_current_page(termi.notebook));
-    termi_search_find(tab, +1);
+  gchar *path = g_build_filename(session->dir, name, NULL);
+  GFile *file = g_file_new_for_path(path);
+  g_free(path);
+  GError *gerror = NULL;
+  GOutputStream *out = G_OUTPUT_STREAM(g_file_replace(file, NULL, FALSE, G_FILE_CREATE_PRIVATE, NULL, &gerror));
+  g_object_unref(file);
+  gboolean ok = out != NULL;
+  if( ok ) {
+    ok = g_output_stream_write_all(out, data, len, NULL, NULL, &gerror);
+    if( ok ) {
+      ok = g_output_stream_close(out, NULL, &gerror);
+    } else {
+      // closing a cancelled stream keeps the previous content
+      GCancellable *cancellable = g_cancellable_new();
+      g_cancellable_cancel(cancellable);
+      g_output_stream_close(out, cancellable, NULL);
+      g_object_unref(cancellable);
+    }
+    g_object_unref(out);
+  }
+  if( !ok ) {
+    termi_error("cannot write session file %s: %s", name, gerror->message);
+    g_error_free(gerror);
   }
+  return ok;
 }
-void termi_kb_find_prev_cb(void)
+
+gboolean termi_session_step_cb(void *data)
 {
-  if( termi.search_regex || (termi_search_modify() && termi.search_regex) ) {
-    TermiTab *tab = termi_tab_from_index(gtk_notebook_get_current_page(termi.notebook));
-    termi_search_find(tab, -1);
+  TermiSession *session = termi.session;
+  if( session->next < session->tabs->len ) {
+    termi_session_snapshot_tab(session, session->next++);
+    return TRUE;
   }
+  session->idle_id = 0;
+  termi.session = NULL;
+  termi_session_write_start(session);
+  return FALSE;
 }
-#endif
-
 
-TermiTab *termi_tab_from_vte(VteTerminal *vte)
+gboolean termi_session_timer_cb(void *data)
 {
-  TermiTab *tab = g_object_get_qdata(G_OBJECT(vte), termi.quark);
-  g_assert( tab != NULL );
-  return tab;
+  termi.session_timer_id = 0;
+  termi_session_save_start();
+  termi_session_schedule();
+  return FALSE;
 }
 
-TermiTab *termi_tab_from_index(gint index)
+#if GLIB_CHECK_VERSION(2,36,0)
+void termi_session_write_thread(GTask *task, gpointer source, TermiSession *session, GCancellable *cancellable)
 {
-  GtkWidget *vte = gtk_notebook_get_nth_page(termi.notebook, index);
-  g_assert( vte != NULL );
-  TermiTab *tab = g_object_get_qdata(G_OBJECT(vte), termi.quark);
-  g_assert( tab != NULL );
-  return tab;
+  termi_session_write(session);
+  g_task_return_boolean(task, TRUE);
 }
 
-gint termi_tab_get_index(TermiTab *tab)
+void termi_session_write_done_cb(GObject *source, GAsyncResult *res, void *data)
 {
-  gint index = gtk_notebook_page_num(termi.notebook, GTK_WIDGET(tab->vte));
-  g_assert( index != -1 );
-  return index;
+  termi.session_saving = FALSE;
 }
+#endif
 
-
-typedef struct {
-  gchar *title;
-  gchar *cwd;
-  gchar *command;
-} termi_opt_tab_t;
-
-typedef struct {
-  GArray *tabs;
-} termi_opt_data_t;
-
-void termi_opt_tab_free(gpointer data)
+gboolean termi_session_restore(void)
 {
-  termi_opt_tab_t *d = data;
-  g_free(d->title);
-  g_free(d->cwd);
-  g_free(d->command);
+  gchar *dir = termi_session_dir();
+  gchar *path = g_build_filename(dir, TERMI_SESSION_FILE, NULL);
+  g_free(dir);
+  GKeyFile *kf = g_key_file_new();
+  GError *gerror = NULL;
+  gboolean ok = g_key_file_load_from_file(kf, path, G_KEY_FILE_NONE, &gerror);
+  g_free(path);
+  if( !ok ) {
+    termi_error("cannot load session: %s", gerror->message);
+    g_error_free(gerror);
+    g_key_file_free(kf);
+    return FALSE;
+  }
+  // don't rewrite the session until something changes
+  termi.session_data = g_key_file_to_data(kf, NULL, NULL);
+
+  // group tabs by window, keeping their order
+  GPtrArray *windows = g_ptr_array_new();
+  gchar **groups = g_key_file_get_groups(kf, NULL);
+  gchar **group;
+  for( group=groups; *group!=NULL; group++ ) {
+    if( !g_str_has_prefix(*group, TERMI_SESSION_TAB_PREFIX) ) {
+      continue;
+    }
+    gint window = g_key_file_get_integer(kf, *group, "Window", NULL);
+    if( window < 0 || (guint)window > windows->len ) {
+      window = windows->len;
+    }
+    if( (guint)window == windows->len ) {
+      g_ptr_array_add(windows, g_ptr_array_new());
+    }
+    g_ptr_array_add(g_ptr_array_index(windows, window), *group);
+  }
+
+  guint ntabs = 0;
+  guint i;
+  for( i=0; i<windows->len; i++ ) {
+    GPtrArray *win_groups = g_ptr_array_index(windows, i);
+    ntabs += termi_session_restore_window(kf, win_groups);
+    g_ptr_array_free(win_groups, TRUE);
+  }
+  g_ptr_array_free(windows, TRUE);
+  g_strfreev(groups);
+  g_key_file_free(kf);
+  return ntabs > 0;
 }
 
-gboolean termi_opt_tab_cb(const gchar *option_name, const gchar *value,
-                          gpointer data, GError **error)
+guint termi_session_restore_window(GKeyFile *kf, GPtrArray *groups)
 {
-  const gchar *sep = g_strstr_len(value, -1, "  ");
-  const gchar *end = value + strlen(value);
-  termi_opt_data_t *d = data;
-  termi_opt_tab_t tab = { NULL, NULL, NULL };
-  if(sep == NULL) {
-    if(end > value) {
-      tab.command = g_strdup(value);
+  guint cur_index = 0;
+  guint i;
+  for( i=0; i<groups->len; i++ ) {
+    if( g_key_file_get_boolean(kf, g_ptr_array_index(groups, i), "Current", NULL) ) {
+      cur_index = i;
     }
-  } else {
-    if(sep > value) {
-      tab.title = g_strndup(value, sep-value);
+  }
+
+  // the first tab of a notebook is selected, thus spawned, when added:
+  // add the current tab first, then move it back to its place
+  TermiWindow *win = termi_window_new();
+  const gchar *cur_group = g_ptr_array_index(groups, cur_index);
+  TermiTab *cur_tab = termi_session_restore_tab(kf, cur_group, win);
+  gint cur_pos = 0;
+  for( i=0; i<groups->len; i++ ) {
+    if( i != cur_index && termi_session_restore_tab(kf, g_ptr_array_index(groups, i), win) != NULL && i < cur_index ) {
+      cur_pos++;
     }
-    const gchar *sep2 = g_strstr_len(sep+2, -1, "  ");
-    if(sep2 == NULL) {
-      if(end > sep+2) {
-        tab.command = g_strdup(sep+2);
-      }
-    } else {
-      if(sep2 > sep+2) {
-        tab.cwd = g_strndup(sep+2, sep2-(sep+2));
-      }
-      if(end > sep2+2) {
-        tab.command = g_strdup(sep2+2);
-      }
+  }
+  guint ntabs = gtk_notebook_get_n_pages(win->notebook);
+  if( ntabs == 0 ) {
+    termi_window_close(win);
+    return 0;
+  }
+  if( cur_tab != NULL ) {
+    gtk_notebook_reorder_child(win->notebook, cur_tab->page, cur_pos);
+  }
+
+  gint columns = g_key_file_get_integer(kf, cur_group, "Columns", NULL);
+  gint rows = g_key_file_get_integer(kf, cur_group, "Rows", NULL);
+  termi_resize(win, columns > 0 ? columns : 80, rows > 0 ? rows : 24);
+  gtk_widget_show_all(GTK_WIDGET(win->winmain));
+
+  TermiTab *tab = termi_window_get_cur_tab(win);
+  termi_tab_focus(tab);
+  if( tab->vte != NULL ) {
+    //XXX:hack see termi_opt_open_tabs()
+    vte_terminal_set_color_foreground(tab->vte, &termi.vte_fg_color);
+    vte_terminal_set_color_background(tab->vte, &termi.vte_bg_color);
+    if( !termi.vte_cursor_color_default ) {
+      vte_terminal_set_color_cursor(tab->vte, &termi.vte_cursor_color);
     }
   }
-  g_array_append_val(d->tabs, tab);
-  return TRUE;
+  return ntabs;
 }
 
+TermiTab *termi_session_restore_tab(GKeyFile *kf, const gchar *group, TermiWindow *win)
+{
+  gchar *cmd = g_key_file_get_string(kf, group, "Command", NULL);
+  gchar *cwd = g_key_file_get_string(kf, group, "Cwd", NULL);
+  TermiTab *tab = termi_tab_new(win, cmd, cwd, TRUE);
+  g_free(cmd);
+  g_free(cwd);
+  if( tab == NULL ) {
+    termi_error("failed to restore tab '%s'", group);
+    return NULL;
+  }
+  gchar *title = g_key_file_get_string(kf, group, "Title", NULL);
+  if( title != NULL ) {
+    termi_tab_set_title(tab, title);
+    g_free(title);
+  }
+  tab->restore_file = g_key_file_get_string(kf, group, "Scrollback", NULL);
+  if( tab->restore_file != NULL && tab->vte != NULL ) {
+    termi_tab_restore_scrollback(tab);  // first tab, already spawned
+  }
+  return tab;
+}
 
-
-int main(int argc, char *argv[])
+void termi_tab_restore_scrollback(TermiTab *tab)
 {
-  gboolean opt_version = FALSE;
-  gchar *opt_execute = NULL;
-  gchar *opt_title = NULL;
-  gchar *opt_geometry = NULL;
+  gchar *dir = termi_session_dir();
+  gchar *path = g_build_filename(dir, tab->restore_file, NULL);
+  g_free(dir);
+  g_free(tab->restore_file);
+  tab->restore_file = NULL;
+
+  gchar *packed;
+  gsize len;
+  GError *gerror = NULL;
+  gboolean ok = g_file_get_contents(path, &packed, &len, &gerror);
+  g_free(path);
+  if( !ok ) {
+    termi_error("cannot read session scrollback: %s", gerror->message);
+    g_error_free(gerror);
+    return;
+  }
+  GByteArray *dump = g_byte_array_new();
+  GConverter *conv = G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW));
+  ok = termi_convert(conv, (guint8 *)packed, len, dump);
+  g_object_unref(conv);
+  g_free(packed);
+  if( ok ) {
+    // the new prompt starts on its own line
+    vte_terminal_feed(tab->vte, (gchar *)dump->data, dump->len);
+    vte_terminal_feed(tab->vte, "\r\n", 2);
+  }
+  g_byte_array_free(dump, TRUE);
+}
 
-  const GOptionEntry opt_entries[] = {
-    { "execute", 'e', 0, G_OPTION_ARG_STRING, &opt_execute, "Execute given command in first tab", NULL },
-    { "title", 't', 0, G_OPTION_ARG_STRING, &opt_title, "Window title", NULL },
-    { "version", 0, 0, G_OPTION_ARG_NONE, &opt_version, "Display version number", NULL },
-    { "geometry", 0, 0, G_OPTION_ARG_STRING, &opt_geometry, "X geometry for the window", NULL },
-    { "tab", 0, 0, G_OPTION_ARG_CALLBACK, &termi_opt_tab_cb, "Create a tab; format is \"[tab-title  [cwd  ]][command]\"", NULL },
-    { NULL, 0, 0, 0, NULL, NULL, NULL }
-  };
+#endif
 
-  termi_opt_data_t opt_data = {
-    .tabs = g_array_new(FALSE, FALSE, sizeof(termi_opt_tab_t)),
-  };
-  g_array_set_clear_func(opt_data.tabs, termi_opt_tab_free);
 
-  GOptionContext *opt_context = g_option_context_new("- mini terminal emulator");
-  GOptionGroup *opt_group = g_option_group_new(NULL, NULL, NULL, &opt_data, NULL);
-  g_option_context_set_main_group(opt_context, opt_group);
-  g_option_context_add_main_entries(opt_context, opt_entries, NULL);
-  g_option_context_add_group(opt_context, gtk_get_option_group(TRUE));
+int main(int argc, char *argv[])
+{
+  gint64 launch_time = g_get_monotonic_time();
+  termi_opt_data_t opt_data;
+  termi_opt_data_init(&opt_data);
+  opt_data.launch_time = launch_time;
+  // arguments are forwarded as is to the daemon
+  gchar **orig_argv = g_strdupv(argv);
 
   GError *gerror = NULL;
-  g_option_context_parse(opt_context, &argc, &argv, &gerror);
-  g_option_context_free(opt_context);
-  if( gerror ) {
+  if( !termi_opt_parse(&opt_data, &argc, &argv, TRUE, &gerror) ) {
     termi_error("option parsing failed: %s", gerror->message);
     g_error_free(gerror);
     exit(1);
   }
 
-  if( opt_version ) {
+  if( opt_data.version ) {
     g_print("%s\n", VERSION);
     return 0;
   }
+#if VTE_CHECK_VERSION(0,26,0)
+  if( opt_data.bench_generate != NULL ) {
+    return termi_bench_generate(opt_data.bench_generate, opt_data.bench_size);
+  }
+#endif
+
+  if( opt_data.client ) {
+    if( opt_data.daemon ) {
+      termi_error("--client and --daemon are mutually exclusive");
+      exit(1);
+    }
+    int ret = termi_client_request(orig_argv, launch_time);
+    if( ret != -1 ) {
+      return ret;
+    }
+    termi_error("cannot connect to daemon, starting a new instance");
+  }
+  g_strfreev(orig_argv);
 
   // global init
   termi.quark = g_quark_from_static_string(TERMI_QUARK_STR);
-  termi.uri_regex = g_regex_new("[a-zA-Z0-9+-]+://\\S*[a-zA-Z0-9_/%&=]", G_REGEX_OPTIMIZE, 0, NULL);
 
   gtk_init(&argc, &argv);
-  termi_winmain_init();
-  // load configuration (window has to be created first)
+  termi_icons_init();
   termi_conf_load();
+  termi_conf_monitor_start();
+#if GLIB_CHECK_VERSION(2,36,0)
+  g_unix_signal_add(SIGUSR1, termi_sigusr1_cb, NULL);
+#endif
 
-  if( opt_title != NULL) {
-    gtk_window_set_title(termi.winmain, opt_title);
-    g_free(opt_title);
-  }
-
-  // create initial tabs
-  gboolean has_opt_tabs = opt_data.tabs->len > 0;
-  if(opt_execute || !has_opt_tabs) {
-    // "default" tab
-    TermiTab *tab = termi_tab_new(opt_execute, NULL);
-    if(tab == NULL) {
-      termi_error("failed to create default tab");
+  if( opt_data.daemon ) {
+    termi.daemon = TRUE;
+    if( !termi_daemon_start() ) {
+      exit(1);
     }
-    g_free(opt_execute);
-  }
-  if(has_opt_tabs) {
-    guint i;
-    for(i=0; i<opt_data.tabs->len; i++) {
-      termi_opt_tab_t *opt_tab = &g_array_index(opt_data.tabs, termi_opt_tab_t, i);
-      TermiTab *tab = termi_tab_new(opt_tab->command, opt_tab->cwd);
-      if(tab == NULL) {
-        termi_error("failed to create tab '%s'", opt_tab->title);
-      }
-      if(opt_tab->title != NULL) {
-        termi_tab_set_title(tab, opt_tab->title);
-      }
+#if VTE_CHECK_VERSION(0,26,0)
+  } else if( opt_data.bench ) {
+    if( !termi_bench_start(opt_data.bench_tabs, opt_data.bench_size) ) {
+      exit(1);
     }
-  }
-  termi_resize(80, 24);
-
-  // free opt_data
-  g_array_free(opt_data.tabs, TRUE);
-
-  // set geometry (has to be done before showing the main window)
-  if( opt_geometry != NULL ) {
-    if( !gtk_window_parse_geometry(termi.winmain, opt_geometry) ) {
-      termi_error("invalid geometry string");
+  } else if( opt_data.replay != NULL ) {
+    if( !termi_replay_start(opt_data.replay, opt_data.replay_fast) ) {
+      exit(1);
     }
-    g_free(opt_geometry);
+  } else if( opt_data.restore && termi_session_restore() ) {
+    // tabs of the last session are open
+#endif
+  } else if( !termi_opt_open_tabs(&opt_data, NULL) ) {
+    exit(1);
   }
-
-  gtk_widget_show_all(GTK_WIDGET(termi.winmain));
-
-  // select first tab
-  TermiTab *tab = termi_tab_from_index(0);
-  termi_tab_focus(tab);
-  //XXX:hack colors are not properly set for the first tab, it seems the window
-  // has to ben realized first.
-  // This may be fixed in newer versions of libvte.
-  // copy paste from term_tab_new()
-  vte_terminal_set_color_foreground(tab->vte, &termi.vte_fg_color);
-  vte_terminal_set_color_background(tab->vte, &termi.vte_bg_color);
-  if( !termi.vte_cursor_color_default ) {
-    vte_terminal_set_color_cursor(tab->vte, &termi.vte_cursor_color);
+#if VTE_CHECK_VERSION(0,26,0)
+  if( termi.bench == NULL && termi.replay == NULL ) {
+    termi.session_enabled = TRUE;
+    termi_session_schedule();
   }
+#endif
+  termi_opt_data_clear(&opt_data);
 
   gtk_main();
 
-  return 0;
+  return termi.exit_status;
 }
 